@@ -0,0 +1,348 @@
+/**
+ * \file
+ *         Parallel multi-experiment analysis runner.
+ *
+ *         Usage: batch-stats [-t] [-j JOBS] [-b BASELINE] [-o REPORT]
+ *                            [--pdr-drop PP] [--dc-rise PCT] [--lat-rise PCT]
+ *                            PATH...
+ *
+ *         Every PATH is either a log file or a directory; directories are
+ *         searched (non-recursively) for *.txt and *.log files, and for
+ *         *.lpc columnar files written by `parse-stats --columnar`, which
+ *         take precedence over the log they were parsed from. The logs
+ *         are parsed in parallel on all cores and a single tab-separated
+ *         report with PDR, duty cycle and latency per experiment and per
+ *         node is written to REPORT (default: batch-report.csv).
+ *
+ *         When a BASELINE experiment is given (file name, with or without
+ *         extension), every other experiment and node is compared against
+ *         it and regressions beyond the given thresholds are flagged.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include "colstore.h"
+#include "stats.h"
+/*---------------------------------------------------------------------------*/
+/* Default regression thresholds */
+#define PDR_DROP_PP    1.0   /* PDR drop in percentage points */
+#define DC_RISE_PCT    10.0  /* relative duty-cycle increase in % */
+#define LAT_RISE_PCT   10.0  /* relative latency increase in % */
+/*---------------------------------------------------------------------------*/
+/* Metrics of one experiment (node 0) or of one of its nodes */
+struct metrics {
+  uint32_t sent = 0;
+  uint32_t recv = 0;
+  double pdr = NAN;
+  double dc = NAN;
+  double latency_ms = NAN;
+};
+
+struct result {
+  std::string path;
+  std::string name;
+  bool ok = false;
+  metrics total;
+  std::map<uint16_t, metrics> nodes;
+};
+/*---------------------------------------------------------------------------*/
+static bool
+is_log_name(const std::string &name)
+{
+  auto ends_with = [&](const char *s) {
+    size_t n = strlen(s);
+    return name.size() >= n && name.compare(name.size() - n, n, s) == 0;
+  };
+  /* The PowerTracker companions (*_dc.log) are not experiments: the duty
+   * cycle comes from the Energest lines of the log itself */
+  if(ends_with("_dc.log")) {
+    return false;
+  }
+  return ends_with(".txt") || ends_with(".log") || ends_with(COLSTORE_EXT);
+}
+/*---------------------------------------------------------------------------*/
+static std::string
+experiment_name(const std::string &path)
+{
+  std::string prefix = output_prefix(path);
+  size_t slash = prefix.rfind('/');
+  return slash == std::string::npos ? prefix : prefix.substr(slash + 1);
+}
+/*---------------------------------------------------------------------------*/
+static void
+collect_logs(const char *path, std::vector<std::string> *logs)
+{
+  struct stat st;
+  if(stat(path, &st) != 0) {
+    fprintf(stderr, "batch-stats: %s does not exist\n", path);
+    return;
+  }
+  if(!S_ISDIR(st.st_mode)) {
+    logs->push_back(path);
+    return;
+  }
+  DIR *dir = opendir(path);
+  if(dir == nullptr) {
+    perror(path);
+    return;
+  }
+  std::vector<std::string> found;
+  while(struct dirent *de = readdir(dir)) {
+    std::string name = de->d_name;
+    std::string full = std::string(path) + "/" + name;
+    if(is_log_name(name) && stat(full.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      found.push_back(full);
+    }
+  }
+  closedir(dir);
+  std::sort(found.begin(), found.end());
+
+  /* Skip logs that have already been converted to the columnar format */
+  std::vector<std::string> columnar;
+  for(const auto &f : found) {
+    if(output_prefix(f) + COLSTORE_EXT == f) {
+      columnar.push_back(output_prefix(f));
+    }
+  }
+  /* Stripping the extension changes the order ("exp-2.lpc" < "exp.lpc") */
+  std::sort(columnar.begin(), columnar.end());
+  found.erase(std::remove_if(found.begin(), found.end(), [&](const std::string &f) {
+    return output_prefix(f) + COLSTORE_EXT != f
+           && std::binary_search(columnar.begin(), columnar.end(), output_prefix(f));
+  }), found.end());
+  logs->insert(logs->end(), found.begin(), found.end());
+}
+/*---------------------------------------------------------------------------*/
+static void
+analyze(result *res, log_format fmt)
+{
+  experiment exp;
+  if(!load_experiment(res->path.c_str(), fmt, &exp)) {
+    return;
+  }
+  res->ok = true;
+
+  for(const auto &p : compute_node_pdr(exp)) {
+    metrics &m = res->nodes[p.node];
+    m.sent = p.sent;
+    m.recv = p.recv;
+    m.pdr = p.pdr;
+    res->total.sent += p.sent;
+    res->total.recv += p.recv;
+  }
+  if(res->total.sent > 0) {
+    res->total.pdr = 100.0 * res->total.recv / res->total.sent;
+  }
+
+  double dc_sum = 0;
+  int dc_n = 0;
+  for(const auto &d : compute_node_duty_cycle(exp)) {
+    res->nodes[d.node].dc = d.dc;
+    if(!std::isnan(d.dc)) {
+      dc_sum += d.dc;
+      dc_n++;
+    }
+  }
+  if(dc_n > 0) {
+    res->total.dc = dc_sum / dc_n;
+  }
+
+  double lat_sum = 0;
+  uint64_t lat_n = 0;
+  for(const auto &l : compute_node_latency(exp)) {
+    res->nodes[l.node].latency_ms = l.mean_ms;
+    lat_sum += l.mean_ms * l.samples;
+    lat_n += l.samples;
+  }
+  if(lat_n > 0) {
+    res->total.latency_ms = lat_sum / lat_n;
+  }
+}
+/*---------------------------------------------------------------------------*/
+struct thresholds {
+  double pdr_drop;
+  double dc_rise;
+  double lat_rise;
+};
+/*---------------------------------------------------------------------------*/
+/* Comma-separated list of regressed metrics, empty if none */
+static std::string
+regressions(const metrics &m, const metrics &base, const thresholds &th)
+{
+  std::string flags;
+  auto add = [&](const char *f) {
+    if(!flags.empty()) {
+      flags += ',';
+    }
+    flags += f;
+  };
+  if(!std::isnan(m.pdr) && !std::isnan(base.pdr)
+     && base.pdr - m.pdr > th.pdr_drop) {
+    add("pdr");
+  }
+  if(!std::isnan(m.dc) && !std::isnan(base.dc) && base.dc > 0
+     && 100.0 * (m.dc - base.dc) / base.dc > th.dc_rise) {
+    add("dc");
+  }
+  if(!std::isnan(m.latency_ms) && !std::isnan(base.latency_ms)
+     && base.latency_ms > 0
+     && 100.0 * (m.latency_ms - base.latency_ms) / base.latency_ms > th.lat_rise) {
+    add("latency");
+  }
+  return flags;
+}
+/*---------------------------------------------------------------------------*/
+static void
+append_row(std::string &out, const std::string &name, const char *node,
+           const metrics &m, const std::string &flags)
+{
+  char buf[160];
+  snprintf(buf, sizeof(buf), "\t%s\t%u\t%u\t%.3f\t%.3f\t%.1f\t%s\n",
+           node, m.sent, m.recv, m.pdr, m.dc, m.latency_ms,
+           flags.empty() ? "-" : flags.c_str());
+  out += name;
+  out += buf;
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-t] [-j jobs] [-b baseline] [-o report] "
+          "[--pdr-drop pp] [--dc-rise pct] [--lat-rise pct] path...\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  log_format fmt = log_format::cooja;
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+  const char *baseline = nullptr;
+  const char *report = "batch-report.csv";
+  thresholds th = {PDR_DROP_PP, DC_RISE_PCT, LAT_RISE_PCT};
+  std::vector<std::string> logs;
+
+  for(int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has_value = i + 1 < argc;
+    if(!strcmp(a, "-t") || !strcmp(a, "--testbed")) {
+      fmt = log_format::testbed;
+    } else if(!strcmp(a, "-j") && has_value) {
+      jobs = std::max(1, atoi(argv[++i]));
+    } else if(!strcmp(a, "-b") && has_value) {
+      baseline = argv[++i];
+    } else if(!strcmp(a, "-o") && has_value) {
+      report = argv[++i];
+    } else if(!strcmp(a, "--pdr-drop") && has_value) {
+      th.pdr_drop = atof(argv[++i]);
+    } else if(!strcmp(a, "--dc-rise") && has_value) {
+      th.dc_rise = atof(argv[++i]);
+    } else if(!strcmp(a, "--lat-rise") && has_value) {
+      th.lat_rise = atof(argv[++i]);
+    } else if(a[0] != '-') {
+      collect_logs(a, &logs);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(logs.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* Parse all logs in parallel, one experiment per worker at a time */
+  std::vector<result> results(logs.size());
+  for(size_t i = 0; i < logs.size(); i++) {
+    results[i].path = logs[i];
+    results[i].name = experiment_name(logs[i]);
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  jobs = std::min<unsigned>(jobs, logs.size());
+  for(unsigned w = 0; w < jobs; w++) {
+    workers.emplace_back([&]() {
+      size_t i;
+      while((i = next++) < results.size()) {
+        analyze(&results[i], fmt);
+      }
+    });
+  }
+  for(auto &t : workers) {
+    t.join();
+  }
+
+  const result *base = nullptr;
+  if(baseline != nullptr) {
+    std::string b = experiment_name(baseline);
+    for(const auto &r : results) {
+      if(r.ok && (r.name == b || r.path == baseline)) {
+        base = &r;
+        break;
+      }
+    }
+    if(base == nullptr) {
+      fprintf(stderr, "batch-stats: baseline %s not among the parsed logs\n",
+              baseline);
+      return 1;
+    }
+  }
+
+  /* Merged report and console summary */
+  std::string out = "experiment\tnode\tsent\trecv\tpdr\tdc\tlatency_ms\tregression\n";
+  int nregressions = 0;
+  printf("%-40s %8s %8s %12s  %s\n", "Experiment", "PDR(%)", "DC(%)",
+         "Latency(ms)", base ? "Regression" : "");
+  for(const auto &r : results) {
+    if(!r.ok) {
+      fprintf(stderr, "batch-stats: cannot read %s\n", r.path.c_str());
+      continue;
+    }
+    bool compare = base != nullptr && &r != base;
+    std::string flags = compare ? regressions(r.total, base->total, th) : "";
+    append_row(out, r.name, "all", r.total, flags);
+    printf("%-40s %8.2f %8.3f %12.1f  %s\n", r.name.c_str(), r.total.pdr,
+           r.total.dc, r.total.latency_ms,
+           &r == base ? "(baseline)" : flags.c_str());
+    nregressions += !flags.empty();
+
+    for(const auto &kv : r.nodes) {
+      std::string nflags;
+      if(compare) {
+        auto it = base->nodes.find(kv.first);
+        if(it != base->nodes.end()) {
+          nflags = regressions(kv.second, it->second, th);
+        }
+      }
+      if(!nflags.empty()) {
+        printf("  node %-3u regressed: %s\n", kv.first, nflags.c_str());
+        nregressions++;
+      }
+      append_row(out, r.name, std::to_string(kv.first).c_str(), kv.second,
+                 nflags);
+    }
+  }
+
+  FILE *f = fopen(report, "w");
+  if(f == nullptr || fwrite(out.data(), 1, out.size(), f) != out.size()) {
+    perror(report);
+    return 1;
+  }
+  fclose(f);
+  printf("Saving merged report in: %s\n", report);
+
+  /* Non-zero exit status lets scripts stop on regressions */
+  return nregressions > 0 ? 2 : 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,238 @@
+/**
+ * \file
+ *         Columnar binary result format for parsed experiments (.lpc).
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include "colstore.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+/*---------------------------------------------------------------------------*/
+/* Times that could not be parsed are stored with this sentinel */
+#define TIME_UNKNOWN INT32_MIN
+/*---------------------------------------------------------------------------*/
+static const size_t column_width[COL_COUNT] = {
+  2,                /* node dictionary */
+  4, 2, 2, 4, 1,    /* recv */
+  4, 2, 2, 4, 1,    /* sent */
+  4, 2, 4, 4, 4, 4, 4, /* energest */
+  2,                /* booted */
+};
+/*---------------------------------------------------------------------------*/
+bool
+colstore_is_columnar(const char *data, size_t size)
+{
+  return size >= sizeof(colstore_header)
+         && memcmp(data, COLSTORE_MAGIC, 8) == 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Column buffer being built before writing */
+struct column {
+  std::string bytes;
+
+  template<typename T>
+  void
+  push(T v)
+  {
+    bytes.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+};
+/*---------------------------------------------------------------------------*/
+bool
+colstore_write(const experiment &exp, const std::string &path)
+{
+  colstore_header hdr;
+  column col[COL_COUNT];
+
+  /* Node dictionary */
+  std::vector<uint16_t> dict(exp.nodes);
+  for(const auto &r : exp.recv) {
+    dict.push_back(r.dest);
+    dict.push_back(r.src);
+  }
+  for(const auto &s : exp.sent) {
+    dict.push_back(s.dest);
+    dict.push_back(s.src);
+  }
+  for(const auto &e : exp.energest) {
+    dict.push_back(e.node);
+  }
+  std::sort(dict.begin(), dict.end());
+  dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+  std::unordered_map<uint16_t, uint16_t> index;
+  for(size_t i = 0; i < dict.size(); i++) {
+    index[dict[i]] = i;
+    col[COL_NODE_DICT].push<uint16_t>(dict[i]);
+  }
+
+  /* Time base: the earliest known time of the experiment */
+  int64_t base = INT64_MAX;
+  auto update_base = [&](int64_t t) {
+    if(t >= 0) {
+      base = std::min(base, t);
+    }
+  };
+  for(const auto &r : exp.recv) {
+    update_base(r.time_ms);
+  }
+  for(const auto &s : exp.sent) {
+    update_base(s.time_ms);
+  }
+  for(const auto &e : exp.energest) {
+    update_base(e.time_ms);
+  }
+  if(base == INT64_MAX) {
+    base = 0;
+  }
+  bool overflow = false;
+  auto rel = [&](int64_t t) -> int32_t {
+    if(t < 0) {
+      return TIME_UNKNOWN;
+    }
+    if(t - base > INT32_MAX) {
+      overflow = true;
+    }
+    return int32_t(t - base);
+  };
+
+  for(const auto &r : exp.recv) {
+    col[COL_RECV_TIME].push<int32_t>(rel(r.time_ms));
+    col[COL_RECV_DEST].push<uint16_t>(index[r.dest]);
+    col[COL_RECV_SRC].push<uint16_t>(index[r.src]);
+    col[COL_RECV_SEQN].push<uint32_t>(r.seqn);
+    col[COL_RECV_HOPS].push<uint8_t>(r.hops);
+  }
+  for(const auto &s : exp.sent) {
+    col[COL_SENT_TIME].push<int32_t>(rel(s.time_ms));
+    col[COL_SENT_DEST].push<uint16_t>(index[s.dest]);
+    col[COL_SENT_SRC].push<uint16_t>(index[s.src]);
+    col[COL_SENT_SEQN].push<uint32_t>(s.seqn);
+    col[COL_SENT_STATUS].push<uint8_t>(s.status);
+  }
+  for(const auto &e : exp.energest) {
+    col[COL_EN_TIME].push<int32_t>(rel(e.time_ms));
+    col[COL_EN_NODE].push<uint16_t>(index[e.node]);
+    col[COL_EN_CNT].push<uint32_t>(e.cnt);
+    col[COL_EN_CPU].push<uint32_t>(e.cpu);
+    col[COL_EN_LPM].push<uint32_t>(e.lpm);
+    col[COL_EN_TX].push<uint32_t>(e.tx);
+    col[COL_EN_RX].push<uint32_t>(e.rx);
+  }
+  for(uint16_t n : exp.nodes) {
+    col[COL_BOOTED].push<uint16_t>(index[n]);
+  }
+  if(overflow) {
+    fprintf(stderr, "colstore: %s spans more than %d ms\n",
+            exp.log_file.c_str(), INT32_MAX);
+    return false;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, COLSTORE_MAGIC, 8);
+  hdr.version = COLSTORE_VERSION;
+  hdr.format = exp.format == log_format::testbed ? 1 : 0;
+  hdr.time_base_ms = base;
+  hdr.n_nodes = dict.size();
+  hdr.n_booted = exp.nodes.size();
+  hdr.n_recv = exp.recv.size();
+  hdr.n_sent = exp.sent.size();
+  hdr.n_energest = exp.energest.size();
+
+  /* Lay out the columns, each aligned to 8 bytes */
+  std::string out(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  for(int c = 0; c < COL_COUNT; c++) {
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+    hdr.offset[c] = out.size();
+    out += col[c].bytes;
+  }
+  memcpy(&out[0], &hdr, sizeof(hdr));
+
+  FILE *f = fopen(path.c_str(), "wb");
+  if(f == nullptr) {
+    perror(path.c_str());
+    return false;
+  }
+  bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  return (fclose(f) == 0) && ok;
+}
+/*---------------------------------------------------------------------------*/
+bool
+colstore_read(const char *data, size_t size, experiment *exp)
+{
+  colstore_header hdr;
+
+  if(!colstore_is_columnar(data, size)) {
+    return false;
+  }
+  memcpy(&hdr, data, sizeof(hdr));
+  if(hdr.version != COLSTORE_VERSION) {
+    fprintf(stderr, "colstore: unsupported version %u\n", hdr.version);
+    return false;
+  }
+
+  /* Validate that every column lies within the file */
+  const uint64_t rows[COL_COUNT] = {
+    hdr.n_nodes,
+    hdr.n_recv, hdr.n_recv, hdr.n_recv, hdr.n_recv, hdr.n_recv,
+    hdr.n_sent, hdr.n_sent, hdr.n_sent, hdr.n_sent, hdr.n_sent,
+    hdr.n_energest, hdr.n_energest, hdr.n_energest, hdr.n_energest,
+    hdr.n_energest, hdr.n_energest, hdr.n_energest,
+    hdr.n_booted,
+  };
+  for(int c = 0; c < COL_COUNT; c++) {
+    if(hdr.offset[c] % 8 != 0 || hdr.offset[c] > size
+       || rows[c] > (size - hdr.offset[c]) / column_width[c]) {
+      fprintf(stderr, "colstore: corrupted column %d\n", c);
+      return false;
+    }
+  }
+
+  /* Columns are 8-byte aligned in a page-aligned mapping */
+  auto col = [&](int c) { return data + hdr.offset[c]; };
+  const uint16_t *dict = reinterpret_cast<const uint16_t *>(col(COL_NODE_DICT));
+  auto node = [&](int c, size_t i) -> uint16_t {
+    uint16_t idx = reinterpret_cast<const uint16_t *>(col(c))[i];
+    return idx < hdr.n_nodes ? dict[idx] : 0;
+  };
+  auto time = [&](int c, size_t i) -> int64_t {
+    int32_t t = reinterpret_cast<const int32_t *>(col(c))[i];
+    return t == TIME_UNKNOWN ? -1 : hdr.time_base_ms + t;
+  };
+  auto u32 = [&](int c, size_t i) {
+    return reinterpret_cast<const uint32_t *>(col(c))[i];
+  };
+  auto u8 = [&](int c, size_t i) {
+    return reinterpret_cast<const uint8_t *>(col(c))[i];
+  };
+
+  exp->format = hdr.format ? log_format::testbed : log_format::cooja;
+  exp->nodes.resize(hdr.n_booted);
+  for(size_t i = 0; i < hdr.n_booted; i++) {
+    exp->nodes[i] = node(COL_BOOTED, i);
+  }
+  exp->recv.resize(hdr.n_recv);
+  for(size_t i = 0; i < hdr.n_recv; i++) {
+    exp->recv[i] = {{}, time(COL_RECV_TIME, i), node(COL_RECV_DEST, i),
+                    node(COL_RECV_SRC, i), u32(COL_RECV_SEQN, i),
+                    u8(COL_RECV_HOPS, i)};
+  }
+  exp->sent.resize(hdr.n_sent);
+  for(size_t i = 0; i < hdr.n_sent; i++) {
+    exp->sent[i] = {{}, time(COL_SENT_TIME, i), node(COL_SENT_DEST, i),
+                    node(COL_SENT_SRC, i), u32(COL_SENT_SEQN, i),
+                    u8(COL_SENT_STATUS, i)};
+  }
+  exp->energest.resize(hdr.n_energest);
+  for(size_t i = 0; i < hdr.n_energest; i++) {
+    exp->energest[i] = {{}, time(COL_EN_TIME, i), node(COL_EN_NODE, i),
+                        u32(COL_EN_CNT, i), u32(COL_EN_CPU, i),
+                        u32(COL_EN_LPM, i), u32(COL_EN_TX, i),
+                        u32(COL_EN_RX, i)};
+  }
+  return true;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,89 @@
+/**
+ * \file
+ *         Columnar binary result format for parsed experiments (.lpc).
+ *
+ *         A .lpc file stores the recv, sent and energest tables of one
+ *         experiment column by column:
+ *
+ *           - node ids are dictionary-encoded (uint16 index into a sorted
+ *             dictionary of the node ids seen in the log),
+ *           - sequence numbers and Energest counters are plain integers,
+ *           - times are fixed-point milliseconds, stored as int32 offsets
+ *             from a 64-bit base time kept in the header.
+ *
+ *         Every column starts on an 8-byte boundary so that the file can be
+ *         memory-mapped and the columns used in place. All integers are
+ *         little-endian.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#ifndef COLSTORE_H
+#define COLSTORE_H
+/*---------------------------------------------------------------------------*/
+#include <cstdint>
+#include <string>
+#include "stats.h"
+/*---------------------------------------------------------------------------*/
+#define COLSTORE_MAGIC   "LPWNCOL1"
+#define COLSTORE_VERSION 1
+#define COLSTORE_EXT     ".lpc"
+/*---------------------------------------------------------------------------*/
+/* Column identifiers, in file order */
+enum colstore_column {
+  COL_NODE_DICT = 0,  /* uint16[n_nodes] */
+  COL_RECV_TIME,      /* int32[n_recv] */
+  COL_RECV_DEST,      /* uint16[n_recv], dictionary index */
+  COL_RECV_SRC,       /* uint16[n_recv], dictionary index */
+  COL_RECV_SEQN,      /* uint32[n_recv] */
+  COL_RECV_HOPS,      /* uint8[n_recv] */
+  COL_SENT_TIME,      /* int32[n_sent] */
+  COL_SENT_DEST,      /* uint16[n_sent], dictionary index */
+  COL_SENT_SRC,       /* uint16[n_sent], dictionary index */
+  COL_SENT_SEQN,      /* uint32[n_sent] */
+  COL_SENT_STATUS,    /* uint8[n_sent] */
+  COL_EN_TIME,        /* int32[n_energest] */
+  COL_EN_NODE,        /* uint16[n_energest], dictionary index */
+  COL_EN_CNT,         /* uint32[n_energest] */
+  COL_EN_CPU,         /* uint32[n_energest] */
+  COL_EN_LPM,         /* uint32[n_energest] */
+  COL_EN_TX,          /* uint32[n_energest] */
+  COL_EN_RX,          /* uint32[n_energest] */
+  COL_BOOTED,         /* uint16[n_booted], dictionary index */
+  COL_COUNT
+};
+/*---------------------------------------------------------------------------*/
+/* On-disk header, followed by the columns */
+struct colstore_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;          /* 0 Cooja, 1 testbed */
+  int64_t time_base_ms;     /* all times are offsets from this value */
+  uint32_t n_nodes;
+  uint32_t n_booted;
+  uint64_t n_recv;
+  uint64_t n_sent;
+  uint64_t n_energest;
+  uint64_t offset[COL_COUNT]; /* byte offset of every column */
+} __attribute__((packed));
+/*---------------------------------------------------------------------------*/
+/* Check whether the mapped data starts with a .lpc header */
+bool colstore_is_columnar(const char *data, size_t size);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Write the tables of exp to path in the columnar format
+ * \return         false on I/O errors or if times do not fit the format
+ */
+bool colstore_write(const experiment &exp, const std::string &path);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Fill exp from an already mapped .lpc file
+ *
+ *                 No text is parsed: the rows are decoded straight from the
+ *                 columns. Row time strings are left empty.
+ * \return         false if the file is not a valid .lpc file
+ */
+bool colstore_read(const char *data, size_t size, experiment *exp);
+/*---------------------------------------------------------------------------*/
+#endif /* COLSTORE_H */
@@ -0,0 +1,469 @@
+/**
+ * \file
+ *         Hand-written scanners for Cooja and testbed data collection logs.
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ *
+ *         Every scanner is anchored at the start of the line, exactly like
+ *         the regular expressions used by parse-stats.py (re.match), and
+ *         only accepts the record if the full prefix matches.
+ */
+
+#include "log-scan.h"
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+/*---------------------------------------------------------------------------*/
+/* Firefly addresses, same table as addr_id_map in parse-stats.py */
+static const struct {
+  uint8_t hi, lo;
+  uint16_t id;
+} addr_id_map[] = {
+  {0xf7, 0x9c,  1}, {0xd9, 0x76,  2}, {0xf3, 0x84,  3}, {0xf3, 0xee,  4},
+  {0xf7, 0x92,  5}, {0xf3, 0x9a,  6}, {0xde, 0x21,  7}, {0xf2, 0xa1,  8},
+  {0xd8, 0xb5,  9}, {0xf2, 0x1e, 10}, {0xd9, 0x5f, 11}, {0xf2, 0x33, 12},
+  {0xde, 0x0c, 13}, {0xf2, 0x0e, 14}, {0xd9, 0x49, 15}, {0xf3, 0xdc, 16},
+  {0xd9, 0x23, 17}, {0xf3, 0x8b, 18}, {0xf3, 0xc2, 19}, {0xf3, 0xb7, 20},
+  {0xde, 0xe4, 21}, {0xf3, 0x88, 22}, {0xf7, 0x9a, 23}, {0xf7, 0xe7, 24},
+  {0xf2, 0x85, 25}, {0xf2, 0x27, 26}, {0xf2, 0x64, 27}, {0xf3, 0xd3, 28},
+  {0xf3, 0x8d, 29}, {0xf7, 0xe1, 30}, {0xde, 0xaf, 31}, {0xf2, 0x91, 32},
+  {0xf2, 0xd7, 33}, {0xf3, 0xa3, 34}, {0xf2, 0xd9, 35}, {0xd9, 0x9f, 36},
+  {0xf3, 0x90, 50}, {0xf2, 0x3d, 51}, {0xf7, 0xab, 52}, {0xf7, 0xc9, 53},
+  {0xf2, 0x6c, 54}, {0xf2, 0xfc, 56}, {0xf1, 0xf6, 57}, {0xf3, 0xcf, 62},
+  {0xf3, 0xc3, 63}, {0xf7, 0xd6, 64}, {0xf7, 0xb6, 65}, {0xf7, 0xb7, 70},
+  {0xf3, 0xf3, 71}, {0xf1, 0xf3, 72}, {0xf2, 0x48, 73}, {0xf3, 0xdb, 74},
+  {0xf3, 0xfa, 75}, {0xf3, 0x83, 76}, {0xf2, 0xb4, 77},
+};
+/*---------------------------------------------------------------------------*/
+uint16_t
+testbed_addr_to_id(uint8_t hi, uint8_t lo)
+{
+  for(const auto &e : addr_id_map) {
+    if(e.hi == hi && e.lo == lo) {
+      return e.id;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+mapped_file::~mapped_file()
+{
+  if(data_ != nullptr && size_ > 0) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
+/*---------------------------------------------------------------------------*/
+bool
+mapped_file::open(const char *path)
+{
+  struct stat st;
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) {
+    return false;
+  }
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  if(size_ == 0) {
+    /* mmap() refuses empty mappings; an empty log is simply empty */
+    close(fd);
+    data_ = "";
+    return true;
+  }
+  void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) {
+    size_ = 0;
+    return false;
+  }
+  madvise(p, size_, MADV_SEQUENTIAL);
+  data_ = static_cast<const char *>(p);
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+/* Minimal cursor used by the scanners below */
+struct cursor {
+  const char *p;
+  const char *end;
+
+  bool
+  lit(std::string_view s)
+  {
+    if(size_t(end - p) < s.size() || memcmp(p, s.data(), s.size()) != 0) {
+      return false;
+    }
+    p += s.size();
+    return true;
+  }
+  bool
+  num(uint32_t *v)
+  {
+    const char *start = p;
+    uint32_t acc = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+      acc = acc * 10 + (*p++ - '0');
+    }
+    *v = acc;
+    return p != start;
+  }
+  /* \w+ interpreted as a hexadecimal byte, like int(x, 16) in the script */
+  bool
+  hex(uint32_t *v)
+  {
+    const char *start = p;
+    uint32_t acc = 0;
+    while(p < end) {
+      char c = *p;
+      if(c >= '0' && c <= '9') {
+        acc = (acc << 4) | (c - '0');
+      } else if(c >= 'a' && c <= 'f') {
+        acc = (acc << 4) | (c - 'a' + 10);
+      } else if(c >= 'A' && c <= 'F') {
+        acc = (acc << 4) | (c - 'A' + 10);
+      } else {
+        break;
+      }
+      p++;
+    }
+    *v = acc;
+    return p != start;
+  }
+  bool
+  space()
+  {
+    const char *start = p;
+    while(p < end && (*p == ' ' || *p == '\t')) {
+      p++;
+    }
+    return p != start;
+  }
+};
+/*---------------------------------------------------------------------------*/
+/* Cooja timestamps are "[H:]MM:SS.mmm" in the log listener and plain
+ * microseconds in the logs written by the headless test scripts */
+static bool
+parse_cooja_time(std::string_view t, int64_t *ms)
+{
+  int64_t secs = 0, field = 0, frac = 0;
+  int frac_digits = -1;
+  bool plain = true;
+  for(char c : t) {
+    if(c >= '0' && c <= '9') {
+      if(frac_digits >= 0) {
+        if(frac_digits < 3) {
+          frac = frac * 10 + (c - '0');
+        }
+        frac_digits++;
+      } else {
+        field = field * 10 + (c - '0');
+      }
+    } else if(c == ':' && frac_digits < 0) {
+      secs = (secs + field) * 60;
+      field = 0;
+      plain = false;
+    } else if(c == '.' && frac_digits < 0) {
+      frac_digits = 0;
+      plain = false;
+    } else {
+      return false;
+    }
+  }
+  secs += field;
+  if(plain) {
+    *ms = secs / 1000;
+    return true;
+  }
+  for(int i = frac_digits < 0 ? 0 : frac_digits; i < 3; i++) {
+    frac *= 10;
+  }
+  *ms = secs * 1000 + frac;
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+static inline int
+digits(const char *p, int n)
+{
+  int v = 0;
+  for(int i = 0; i < n; i++) {
+    v = v * 10 + (p[i] - '0');
+  }
+  return v;
+}
+/*---------------------------------------------------------------------------*/
+/* Testbed timestamps are "YYYY-MM-DD HH:MM:SS,mmm" in local time, as
+ * interpreted by datetime.strptime(...).timestamp(). mktime() is only
+ * called once per hour of log; the rest is plain arithmetic. */
+static bool
+parse_testbed_time(std::string_view t, int64_t *ms)
+{
+  static thread_local char cached_hour[13];
+  static thread_local time_t cached_base = -1;
+
+  if(t.size() != 23) {
+    return false;
+  }
+  for(size_t i : {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18, 20, 21, 22}) {
+    if(t[i] < '0' || t[i] > '9') {
+      return false;
+    }
+  }
+  if(cached_base < 0 || memcmp(cached_hour, t.data(), 13) != 0) {
+    struct tm tm = {};
+    tm.tm_year = digits(&t[0], 4) - 1900;
+    tm.tm_mon = digits(&t[5], 2) - 1;
+    tm.tm_mday = digits(&t[8], 2);
+    tm.tm_hour = digits(&t[11], 2);
+    tm.tm_isdst = -1;
+    cached_base = mktime(&tm);
+    memcpy(cached_hour, t.data(), 13);
+  }
+  *ms = (int64_t(cached_base) + digits(&t[14], 2) * 60 + digits(&t[17], 2)) * 1000
+    + digits(&t[20], 3);
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+/* Node id of a Rime address printed as %02x:%02x, 0 if unknown */
+static uint16_t
+addr_to_id(log_format fmt, uint32_t a, uint32_t b)
+{
+  if(fmt == log_format::testbed) {
+    uint16_t id = testbed_addr_to_id(a, b);
+    if(id == 0) {
+      fprintf(stderr, "KeyError Exception: key %02x:%02x not found in "
+              "addr_id_map\n", a, b);
+    }
+    return id;
+  }
+  /* Cooja node N has address N & 0xff : N >> 8, the second byte is
+   * only non-zero in simulations with more than 255 nodes */
+  return a | (b << 8);
+}
+/*---------------------------------------------------------------------------*/
+/* Scan the node message (after the Cooja/testbed prefix) */
+static bool
+scan_message(cursor &c, log_format fmt, log_record *rec)
+{
+  uint32_t a, b, v[6];
+
+  if(c.lit("App: ")) {
+    if(c.lit("Recv from ")) {
+      if(!c.hex(&a) || !c.lit(":") || !c.hex(&b) || !c.lit(" seqn ")
+         || !c.num(&rec->seqn) || !c.lit(" hops ") || !c.num(&v[0])) {
+        return false;
+      }
+      rec->src = addr_to_id(fmt, a, b);
+      if(rec->src == 0) {
+        return false;
+      }
+      rec->hops = v[0];
+      rec->type = REC_RECV;
+      return true;
+    }
+    if(c.lit("Send seqn ")) {
+      if(!c.num(&rec->seqn)) {
+        return false;
+      }
+      rec->type = REC_SENT;
+      return true;
+    }
+    if(c.lit("packet with seqn ")) {
+      if(!c.num(&rec->seqn) || !c.lit(" could not be scheduled.")) {
+        return false;
+      }
+      rec->type = REC_NOTSENT;
+      return true;
+    }
+    return false;
+  }
+  if(c.lit("Energest: ")) {
+    for(int i = 0; i < 5; i++) {
+      if((i > 0 && !c.lit(" ")) || !c.num(&v[i])) {
+        return false;
+      }
+    }
+    rec->cnt = v[0];
+    rec->cpu = v[1];
+    rec->lpm = v[2];
+    rec->tx = v[3];
+    rec->rx = v[4];
+    rec->type = REC_ENERGEST;
+    return true;
+  }
+  if(c.lit("Energest-phase: ")) {
+    for(int i = 0; i < 6; i++) {
+      if((i > 0 && !c.lit(" ")) || !c.num(&v[i])) {
+        return false;
+      }
+    }
+    rec->cnt = v[0];
+    rec->phase = v[1];
+    rec->cpu = v[2];
+    rec->lpm = v[3];
+    rec->tx = v[4];
+    rec->rx = v[5];
+    rec->type = REC_ENERGEST_PHASE;
+    return true;
+  }
+  if(c.lit("Sync: ")) {
+    /* B seqn | E seqn hops ago_ms | R seqn hops */
+    if(c.lit("B ")) {
+      rec->type = REC_SYNC_BEACON;
+      return c.num(&rec->seqn);
+    }
+    if(c.lit("E ")) {
+      if(!c.num(&rec->seqn) || !c.lit(" ") || !c.num(&v[0]) || !c.lit(" ")
+         || !c.num(&rec->ago_ms)) {
+        return false;
+      }
+      rec->hops = v[0];
+      rec->type = REC_SYNC_EPOCH;
+      return true;
+    }
+    if(c.lit("R ")) {
+      if(!c.num(&rec->seqn) || !c.lit(" ") || !c.num(&v[0])) {
+        return false;
+      }
+      rec->hops = v[0];
+      rec->type = REC_SYNC_RADIO_ON;
+      return true;
+    }
+    return false;
+  }
+  if(c.lit("Telemetry: ")) {
+    /* src hops epoch radio_on ticks retries drops parent rssi */
+    uint32_t pa, pb, rssi;
+    bool neg;
+    if(!c.hex(&a) || !c.lit(":") || !c.hex(&b) || !c.lit(" ") || !c.num(&v[0])
+       || !c.lit(" ") || !c.num(&rec->seqn) || !c.lit(" ")
+       || !c.num(&rec->radio_on) || !c.lit(" ") || !c.num(&rec->ticks)
+       || !c.lit(" ") || !c.num(&rec->retries) || !c.lit(" ")
+       || !c.num(&rec->drops) || !c.lit(" ") || !c.hex(&pa) || !c.lit(":")
+       || !c.hex(&pb) || !c.lit(" ")) {
+      return false;
+    }
+    neg = c.lit("-");
+    if(!c.num(&rssi)) {
+      return false;
+    }
+    rec->src = addr_to_id(fmt, a, b);
+    /* No parent yet: 00:00 */
+    rec->parent = (pa | pb) ? addr_to_id(fmt, pa, pb) : 0;
+    if(rec->src == 0) {
+      return false;
+    }
+    rec->hops = v[0];
+    rec->rssi = neg ? -int16_t(rssi) : int16_t(rssi);
+    rec->type = REC_TELEMETRY;
+    return true;
+  }
+  if(c.lit("Route: ")) {
+    /* seqn parent */
+    if(!c.num(&rec->seqn) || !c.lit(" ") || !c.hex(&a) || !c.lit(":")
+       || !c.hex(&b)) {
+      return false;
+    }
+    rec->parent = (a | b) ? addr_to_id(fmt, a, b) : 0;
+    rec->type = REC_ROUTE;
+    return true;
+  }
+  /* Parent switches: failover of sched_collect and my_collect, and the
+   * parent selection of my_collect (printed with and without prefix) */
+  bool prefixed = c.lit("sched_collect: ") || c.lit("my_collect: ");
+  if(prefixed && c.lit("parent ")) {
+    if(!c.hex(&a) || !c.lit(":") || !c.hex(&b)
+       || !(c.lit(" failed, switching to ") || c.lit(" lost, switching to "))
+       || !c.hex(&a) || !c.lit(":") || !c.hex(&b)) {
+      return false;
+    }
+    rec->parent = addr_to_id(fmt, a, b);
+    rec->type = REC_PARENT_SWITCH;
+    return rec->parent != 0;
+  }
+  if(c.lit("Metric number flush happened!, new parent selection (")) {
+    if(!c.hex(&a) || !c.lit(":") || !c.hex(&b)) {
+      return false;
+    }
+    rec->parent = addr_to_id(fmt, a, b);
+    rec->type = REC_PARENT_SWITCH;
+    return rec->parent != 0;
+  }
+  if(prefixed) {
+    return false;
+  }
+  if(c.lit(fmt == log_format::testbed ? "Rime configured with address "
+                                      : "Rime started with address ")) {
+    if(!c.num(&a) || c.p >= c.end) {
+      return false;
+    }
+    c.p++; /* any separator, the script uses '.' unescaped */
+    if(!c.num(&b)) {
+      return false;
+    }
+    rec->type = REC_BOOT;
+    return true;
+  }
+  return false;
+}
+/*---------------------------------------------------------------------------*/
+bool
+scan_line(std::string_view line, log_format fmt, log_record *rec)
+{
+  cursor c = {line.data(), line.data() + line.size()};
+  uint32_t id;
+
+  rec->type = REC_NONE;
+  if(fmt == log_format::testbed) {
+    /* [YYYY-MM-DD HH:MM:SS,mmm] INFO:firefly.N: N.firefly < b'...' */
+    if(line.size() < 25 || line[0] != '[' || line[24] != ']') {
+      return false;
+    }
+    rec->time = line.substr(1, 23);
+    c.p += 25;
+    if(!c.lit(" INFO:firefly.") || !c.num(&id) || !c.lit(": ")) {
+      return false;
+    }
+    uint32_t unused;
+    if(!c.num(&unused) || !c.lit(".firefly < b'")) {
+      return false;
+    }
+    /* Drop the closing quote of the python bytes literal */
+    if(c.end > c.p && c.end[-1] == '\'') {
+      c.end--;
+    }
+    if(!scan_message(c, fmt, rec)) {
+      return false;
+    }
+    if(!parse_testbed_time(rec->time, &rec->time_ms)) {
+      return false;
+    }
+  } else {
+    /* TIME<ws>ID:N<ws>... */
+    const char *t = c.p;
+    while(c.p < c.end && (isalnum((unsigned char)*c.p) || *c.p == '_'
+                          || *c.p == ':' || *c.p == '.')) {
+      c.p++;
+    }
+    if(c.p == t) {
+      return false;
+    }
+    rec->time = std::string_view(t, c.p - t);
+    if(!c.space() || !c.lit("ID:") || !c.num(&id) || !c.space()) {
+      return false;
+    }
+    if(!scan_message(c, fmt, rec)) {
+      return false;
+    }
+    if(!parse_cooja_time(rec->time, &rec->time_ms)) {
+      rec->time_ms = -1;
+    }
+  }
+  rec->self_id = id;
+  return true;
+}
+/*---------------------------------------------------------------------------*/
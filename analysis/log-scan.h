@@ -0,0 +1,129 @@
+/**
+ * \file
+ *         Hand-written scanners for Cooja and testbed data collection logs.
+ *
+ *         The scanners recognise the fixed record formats printed by the
+ *         collection applications (`App: Recv`, `App: Send`, `could not be
+ *         scheduled`, `Energest:`, `Energest-phase:`, the
+ *         `Telemetry:` records relayed by the sink, the `Sync:` timing records of
+ *         sched_collect, its `Route:` records and the parent switches of
+ *         both collection protocols, and the Rime boot line) without regular
+ *         expressions, so that multi-hour logs can be parsed in one pass
+ *         over a memory-mapped file.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#ifndef LOG_SCAN_H
+#define LOG_SCAN_H
+/*---------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+/*---------------------------------------------------------------------------*/
+#define SINK_ID 1
+/*---------------------------------------------------------------------------*/
+/* Log flavours: Cooja without GUI or the Firefly testbed serial logs */
+enum class log_format {
+  cooja,
+  testbed
+};
+/*---------------------------------------------------------------------------*/
+/* Record types recognised by scan_line() */
+enum record_type {
+  REC_NONE = 0,
+  REC_BOOT,
+  REC_RECV,
+  REC_SENT,
+  REC_NOTSENT,
+  REC_ENERGEST,
+  REC_ENERGEST_PHASE,     /* Energest counters of one phase of the epoch */
+  REC_SYNC_BEACON,        /* sink: beacon of epoch seqn sent */
+  REC_SYNC_EPOCH,         /* node: estimated start of epoch seqn */
+  REC_SYNC_RADIO_ON,      /* node: radio turned on for epoch seqn */
+  REC_TELEMETRY,          /* sink: telemetry report of node src */
+  REC_ROUTE,              /* node: parent of the packets of epoch seqn */
+  REC_PARENT_SWITCH       /* node: parent changed, e.g. after a failure */
+};
+/*---------------------------------------------------------------------------*/
+/* One parsed log line. Only the fields of the given type are valid. */
+struct log_record {
+  record_type type;
+  std::string_view time;  /* raw timestamp text, points into the log */
+  int64_t time_ms;        /* Cooja: ms since start, testbed: ms since epoch */
+  uint16_t self_id;       /* node that printed the line */
+  uint16_t src;           /* REC_RECV, REC_TELEMETRY: originator node id */
+  uint32_t seqn;          /* REC_RECV, REC_SENT, REC_NOTSENT, REC_SYNC_*,
+                             REC_TELEMETRY, REC_ROUTE (epoch) */
+  uint8_t hops;           /* REC_RECV, REC_SYNC_EPOCH, REC_SYNC_RADIO_ON,
+                             REC_TELEMETRY */
+  uint32_t ago_ms;        /* REC_SYNC_EPOCH: estimate is this much in the past */
+  uint32_t cnt;           /* REC_ENERGEST, REC_ENERGEST_PHASE */
+  uint8_t phase;          /* REC_ENERGEST_PHASE */
+  uint32_t cpu, lpm, tx, rx;
+  /* REC_TELEMETRY: energest ticks since the previous report, MAC
+   * retransmissions, dropped packets, parent and its beacon RSSI */
+  uint32_t radio_on, ticks;
+  uint32_t retries, drops;
+  uint16_t parent;        /* also REC_ROUTE, REC_PARENT_SWITCH (new one) */
+  int16_t rssi;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Read-only memory mapping of a whole log file
+ *
+ *               The mapping stays valid for the lifetime of the object, so
+ *               string views handed out by scan_line() may be kept as long
+ *               as the mapped_file is alive.
+ */
+class mapped_file {
+public:
+  mapped_file() = default;
+  ~mapped_file();
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  bool open(const char *path);
+  const char *begin() const { return data_; }
+  const char *end() const { return data_ + size_; }
+  size_t size() const { return size_; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Parse a single log line (without the trailing newline)
+ * \param line   The line to be scanned
+ * \param fmt    Cooja or testbed log flavour
+ * \param rec    Filled with the parsed fields on success
+ * \return       false if the line is not one of the known records
+ */
+bool scan_line(std::string_view line, log_format fmt, log_record *rec);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Call fn(line) for every line in [begin, end)
+ *
+ *               Lines are split with memchr(); a trailing '\r' is dropped.
+ */
+template<typename Fn>
+void
+for_each_line(const char *begin, const char *end, Fn fn)
+{
+  const char *p = begin;
+  while(p < end) {
+    const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    const char *eol = nl ? nl : end;
+    const char *stop = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+    fn(std::string_view(p, stop - p));
+    p = nl ? nl + 1 : end;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Map a testbed 16-bit address ("f7:9c") to its Firefly node id, 0 if unknown */
+uint16_t testbed_addr_to_id(uint8_t hi, uint8_t lo);
+/*---------------------------------------------------------------------------*/
+#endif /* LOG_SCAN_H */
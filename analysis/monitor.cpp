@@ -0,0 +1,351 @@
+/**
+ * \file
+ *         Live streaming PDR and duty-cycle monitor.
+ *
+ *         Usage: monitor [-t] [-f] [-e EPOCH_S] [-s SILENT_EPOCHS]
+ *                        [-r REFRESH_S] [FILE|-]
+ *
+ *         Reads a Cooja or testbed log (or the sink's serial stream on
+ *         stdin, e.g. piped from serialdump) and keeps per-node PDR, duty
+ *         cycle, missing epochs and sequence gaps up to date while the
+ *         experiment runs. Nodes that send in-band telemetry are covered
+ *         from the sink's stream alone: their duty cycle, MAC retries,
+ *         drops, parent and parent RSSI come from the `Telemetry:` records
+ *         when the node's own `Energest:` lines are not in the input.
+ *         With -f a growing file is followed like
+ *         `tail -f`. Every record is folded into the per-node state in
+ *         O(1); the table is redrawn every REFRESH_S seconds and an alert
+ *         is printed as soon as a node has not been heard for more than
+ *         SILENT_EPOCHS epochs.
+ *
+ *         Node liveness is measured on the log clock, which keeps running
+ *         on the wall clock while the input is idle, so a network that
+ *         went completely silent is reported as well.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "log-scan.h"
+/*---------------------------------------------------------------------------*/
+#define EPOCH_S_DEFAULT          30  /* EPOCH_DURATION of sched_collect */
+#define SILENT_EPOCHS_DEFAULT    2
+#define REFRESH_S_DEFAULT        1
+#define POLL_MS                  200
+#define READ_CHUNK               65536
+/*---------------------------------------------------------------------------*/
+/* Incremental per-node state, updated in O(1) for every record */
+struct node_state {
+  bool known = false;
+  bool silent = false;       /* an alert is currently raised */
+  int64_t last_heard_ms = -1;
+  /* Sender side */
+  uint32_t sent = 0;
+  uint32_t not_scheduled = 0;
+  /* Sink side */
+  uint32_t recv = 0;
+  uint32_t dups = 0;
+  bool have_seqn = false;
+  uint32_t last_seqn = 0;
+  uint32_t missing = 0;      /* sequence numbers (epochs) never received */
+  uint32_t gaps = 0;         /* runs of consecutive missing numbers */
+  uint8_t hops = 0;
+  /* Energest, first two reports are discarded like parse-stats */
+  uint64_t time = 0;
+  uint64_t radio = 0;
+  /* In-band telemetry relayed by the sink */
+  uint64_t tm_time = 0;
+  uint64_t tm_radio = 0;
+  uint32_t retries = 0;
+  uint32_t drops = 0;
+  uint16_t parent = 0;
+  int16_t rssi = 0;
+  bool have_tm = false;
+};
+/*---------------------------------------------------------------------------*/
+static std::vector<node_state> nodes;
+static volatile sig_atomic_t stop_requested;
+/*---------------------------------------------------------------------------*/
+static node_state &
+node(uint16_t id)
+{
+  if(id >= nodes.size()) {
+    nodes.resize(size_t(id) + 1);
+  }
+  node_state &n = nodes[id];
+  n.known = true;
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+heard(node_state &n, int64_t now_ms, uint16_t id)
+{
+  if(n.silent) {
+    n.silent = false;
+    fprintf(stderr, "RECOVERED: node %u heard again after %.1f s\n", id,
+            (now_ms - n.last_heard_ms) / 1000.0);
+  }
+  n.last_heard_ms = std::max(n.last_heard_ms, now_ms);
+}
+/*---------------------------------------------------------------------------*/
+static void
+update(const log_record &rec)
+{
+  node_state &self = node(rec.self_id);
+  heard(self, rec.time_ms, rec.self_id);
+
+  switch(rec.type) {
+  case REC_SENT:
+    self.sent++;
+    break;
+  case REC_NOTSENT:
+    self.not_scheduled++;
+    break;
+  case REC_RECV: {
+    node_state &src = node(rec.src);
+    heard(src, rec.time_ms, rec.src);
+    src.hops = rec.hops;
+    if(src.have_seqn && rec.seqn <= src.last_seqn) {
+      /* Duplicate or reordered packet: the gap was counted already */
+      src.dups++;
+      break;
+    }
+    if(src.have_seqn && rec.seqn > src.last_seqn + 1) {
+      src.missing += rec.seqn - src.last_seqn - 1;
+      src.gaps++;
+    }
+    src.have_seqn = true;
+    src.last_seqn = rec.seqn;
+    src.recv++;
+    break;
+  }
+  case REC_TELEMETRY: {
+    node_state &src = node(rec.src);
+    heard(src, rec.time_ms, rec.src);
+    src.tm_time += rec.ticks;
+    src.tm_radio += rec.radio_on;
+    src.retries += rec.retries;
+    src.drops += rec.drops;
+    src.parent = rec.parent;
+    src.rssi = rec.rssi;
+    src.hops = rec.hops;
+    src.have_tm = true;
+    break;
+  }
+  case REC_ENERGEST:
+    if(rec.cnt >= 2) {
+      self.time += uint64_t(rec.cpu) + rec.lpm;
+      self.radio += uint64_t(rec.tx) + rec.rx;
+    }
+    break;
+  default:
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+check_silence(int64_t now_ms, int64_t limit_ms)
+{
+  for(size_t id = 0; id < nodes.size(); id++) {
+    node_state &n = nodes[id];
+    if(!n.known || n.silent || id == SINK_ID || n.last_heard_ms < 0) {
+      continue;
+    }
+    if(now_ms - n.last_heard_ms > limit_ms) {
+      n.silent = true;
+      fprintf(stderr, "ALERT: node %zu silent for %.1f s (last seqn %u)\n",
+              id, (now_ms - n.last_heard_ms) / 1000.0, n.last_seqn);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_table(int64_t now_ms, bool clear)
+{
+  uint64_t sent = 0, recv = 0;
+
+  if(clear) {
+    printf("\033[H\033[2J");
+  }
+  printf("t=%.1f s\n", now_ms / 1000.0);
+  printf("%4s %6s %6s %6s %8s %8s %5s %5s %4s %5s %5s %6s %5s %8s %s\n",
+         "node", "sent", "nosch", "recv", "PDR(%)", "DC(%)", "miss", "gaps",
+         "hops", "retry", "drop", "parent", "rssi", "silent", "");
+  for(size_t id = 0; id < nodes.size(); id++) {
+    const node_state &n = nodes[id];
+    if(!n.known) {
+      continue;
+    }
+    /* Without the node's own log (sink-only stream) the PDR is computed
+     * over the sequence numbers the sink expected */
+    uint32_t expected = n.sent ? n.sent : n.recv + n.missing;
+    double pdr = expected ? 100.0 * std::min(n.recv, expected) / expected : NAN;
+    /* The node's own Energest lines, else its telemetry */
+    double dc = n.time ? 100.0 * n.radio / n.time
+      : n.tm_time ? 100.0 * n.tm_radio / n.tm_time : NAN;
+    char retries[12] = "-", drops[12] = "-", parent[8] = "-", rssi[8] = "-";
+    if(n.have_tm) {
+      snprintf(retries, sizeof(retries), "%u", n.retries);
+      snprintf(drops, sizeof(drops), "%u", n.drops);
+      snprintf(parent, sizeof(parent), "%u", n.parent);
+      snprintf(rssi, sizeof(rssi), "%d", n.rssi);
+    }
+    printf("%4zu %6u %6u %6u %8.2f %8.3f %5u %5u %4u %5s %5s %6s %5s %8.1f %s\n",
+           id, n.sent, n.not_scheduled, n.recv, pdr, dc, n.missing, n.gaps,
+           n.hops, retries, drops, parent, rssi,
+           n.last_heard_ms < 0 ? 0.0 : (now_ms - n.last_heard_ms) / 1000.0,
+           n.silent ? "SILENT" : "");
+    if(id != SINK_ID) {
+      sent += expected;
+      recv += std::min(n.recv, expected);
+    }
+  }
+  printf("Overall PDR: %.2f%% (%" PRIu64 "/%" PRIu64 ")\n",
+         sent ? 100.0 * recv / sent : NAN, recv, sent);
+  fflush(stdout);
+}
+/*---------------------------------------------------------------------------*/
+static void
+on_signal(int sig)
+{
+  (void)sig;
+  stop_requested = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-t] [-f] [-e epoch_s] [-s silent_epochs] "
+          "[-r refresh_s] [file|-]\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  log_format fmt = log_format::cooja;
+  bool follow = false;
+  double epoch_s = EPOCH_S_DEFAULT;
+  double silent_epochs = SILENT_EPOCHS_DEFAULT;
+  double refresh_s = REFRESH_S_DEFAULT;
+  const char *path = "-";
+
+  for(int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has_value = i + 1 < argc;
+    if(!strcmp(a, "-t") || !strcmp(a, "--testbed")) {
+      fmt = log_format::testbed;
+    } else if(!strcmp(a, "-f") || !strcmp(a, "--follow")) {
+      follow = true;
+    } else if(!strcmp(a, "-e") && has_value) {
+      epoch_s = atof(argv[++i]);
+    } else if(!strcmp(a, "-s") && has_value) {
+      silent_epochs = atof(argv[++i]);
+    } else if(!strcmp(a, "-r") && has_value) {
+      refresh_s = atof(argv[++i]);
+    } else if(a[0] != '-' || !strcmp(a, "-")) {
+      path = a;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+  if(fd < 0) {
+    perror(path);
+    return 1;
+  }
+  struct stat st;
+  bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  /* Pipes and serial lines are always followed until they are closed */
+  follow = follow || !regular;
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  using wall_clock = std::chrono::steady_clock;
+  const int64_t limit_ms = int64_t(silent_epochs * epoch_s * 1000);
+  const bool tty = isatty(STDOUT_FILENO);
+  int64_t log_now_ms = -1;
+  auto last_input = wall_clock::now();
+  auto last_refresh = wall_clock::time_point();
+  std::string pending;
+  std::vector<char> chunk(READ_CHUNK);
+  log_record rec;
+
+  while(!stop_requested) {
+    ssize_t n = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if(regular || poll(&pfd, 1, POLL_MS) > 0) {
+      n = read(fd, chunk.data(), chunk.size());
+    }
+    if(n < 0) {
+      perror(path);
+      break;
+    }
+
+    if(n > 0) {
+      last_input = wall_clock::now();
+      pending.append(chunk.data(), n);
+      size_t start = 0, nl;
+      while((nl = pending.find('\n', start)) != std::string::npos) {
+        std::string_view line(pending.data() + start, nl - start);
+        if(!line.empty() && line.back() == '\r') {
+          line.remove_suffix(1);
+        }
+        if(scan_line(line, fmt, &rec) && rec.time_ms >= 0) {
+          log_now_ms = std::max(log_now_ms, rec.time_ms);
+          update(rec);
+        }
+        start = nl + 1;
+      }
+      pending.erase(0, start);
+    } else if(!follow) {
+      break;
+    } else if(regular) {
+      /* End of a growing file: wait for more, reopen if truncated */
+      if(fstat(fd, &st) == 0 && st.st_size < lseek(fd, 0, SEEK_CUR)) {
+        lseek(fd, 0, SEEK_SET);
+      }
+      usleep(POLL_MS * 1000);
+    } else if(pfd.revents & (POLLHUP | POLLERR)) {
+      break;
+    }
+
+    /* The log clock keeps running on the wall clock while input is idle */
+    auto wall_now = wall_clock::now();
+    int64_t idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      wall_now - last_input).count();
+    int64_t now_ms = log_now_ms + (follow ? idle_ms : 0);
+    if(log_now_ms >= 0) {
+      check_silence(now_ms, limit_ms);
+    }
+    if(follow && wall_now - last_refresh >= std::chrono::duration<double>(refresh_s)) {
+      print_table(now_ms, tty);
+      last_refresh = wall_now;
+    }
+  }
+
+  if(log_now_ms >= 0) {
+    check_silence(log_now_ms, limit_ms);
+  }
+  print_table(log_now_ms, false);
+  if(fd != STDIN_FILENO) {
+    close(fd);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
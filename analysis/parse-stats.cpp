@@ -0,0 +1,111 @@
+/**
+ * \file
+ *         Native replacement for the ingestion part of parse-stats.py.
+ *
+ *         Usage: parse-stats [-t|--testbed] [-c|--columnar] LOGFILE
+ *
+ *         Memory-maps the Cooja or testbed log, scans it once and writes
+ *         the same -recv, -sent, -energest, -pdr and -dc CSV files as the
+ *         Python script, next to the log, and the per-phase duty-cycle
+ *         breakdown (-phase-dc) when the log has `Energest-phase:`
+ *         records. From the `Route:` records and parent switches it
+ *         rebuilds the routing tree of every epoch and reports the load of
+ *         each relay (-route, -relay) and the most loaded ones. With
+ *         --columnar the parsed
+ *         tables are also stored in a .lpc file (see colstore.h), which
+ *         parse-stats and batch-stats accept in place of the log.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include "colstore.h"
+#include "stats.h"
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-t|--testbed] [-c|--columnar] logfile\n"
+          "  logfile         data collection logfile (or .lpc file) to be parsed\n"
+          "                  and analyzed.\n"
+          "  -t, --testbed   flag for testbed experiments\n"
+          "  -c, --columnar  also save the parsed tables in a .lpc file\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  const char *log_file = nullptr;
+  bool testbed = false;
+  bool columnar = false;
+  struct stat st;
+
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-t") || !strcmp(argv[i], "--testbed")) {
+      testbed = true;
+    } else if(!strcmp(argv[i], "-c") || !strcmp(argv[i], "--columnar")) {
+      columnar = true;
+    } else if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      usage(argv[0]);
+      return 0;
+    } else if(log_file == nullptr && argv[i][0] != '-') {
+      log_file = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(log_file == nullptr) {
+    printf("Log file needs to be specified as 1st positional argument.\n");
+    usage(argv[0]);
+    return 1;
+  }
+  if(stat(log_file, &st) != 0) {
+    printf("The logfile argument %s does not exist.\n", log_file);
+    return 1;
+  }
+  if(!S_ISREG(st.st_mode)) {
+    printf("The logfile argument %s is not a file.\n", log_file);
+    return 1;
+  }
+
+  /* Print some basic information for the user */
+  printf("Logfile: %s\n", log_file);
+  printf("%s\n", testbed ? "Testbed experiment" : "Cooja simulation");
+
+  experiment exp;
+  if(!load_experiment(log_file, testbed ? log_format::testbed : log_format::cooja,
+                      &exp)) {
+    perror(log_file);
+    return 1;
+  }
+
+  /* Nodes that did not manage to send data */
+  std::vector<uint16_t> fails = silent_nodes(exp);
+  if(!fails.empty()) {
+    printf("----- WARNING -----\n");
+    for(uint16_t n : fails) {
+      printf("Warning: node %u did not send any data.\n", n);
+    }
+    printf("\n"); /* To separate clearly from the following set of prints */
+  }
+
+  std::vector<node_pdr> pdr = compute_node_pdr(exp);
+  print_node_pdr(pdr);
+  print_node_duty_cycle(exp);
+  print_node_phase_duty_cycle(compute_node_phase_duty_cycle(exp));
+  print_relay_load(compute_relay_load(exp));
+
+  bool ok = write_csv_tables(exp, pdr, compute_node_duty_cycle(exp));
+  if(columnar && !colstore_is_columnar(exp.log->begin(), exp.log->size())) {
+    std::string lpc = output_prefix(exp.log_file) + COLSTORE_EXT;
+    printf("Saving columnar tables in: %s\n", lpc.c_str());
+    ok = colstore_write(exp, lpc) && ok;
+  }
+  return ok ? 0 : 1;
+}
+/*---------------------------------------------------------------------------*/
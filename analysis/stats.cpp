@@ -0,0 +1,812 @@
+/**
+ * \file
+ *         Experiment tables and PDR / duty-cycle statistics.
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include "stats.h"
+#include "colstore.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+/*---------------------------------------------------------------------------*/
+bool
+load_experiment(const char *log_file, log_format fmt, experiment *exp)
+{
+  exp->log_file = log_file;
+  exp->format = fmt;
+  exp->log.reset(new mapped_file());
+  if(!exp->log->open(log_file)) {
+    return false;
+  }
+  if(colstore_is_columnar(exp->log->begin(), exp->log->size())) {
+    /* Already parsed: decode the columns, no text to scan */
+    return colstore_read(exp->log->begin(), exp->log->size(), exp);
+  }
+
+  std::unordered_set<uint16_t> booted;
+  log_record rec;
+  for_each_line(exp->log->begin(), exp->log->end(), [&](std::string_view line) {
+    if(!scan_line(line, fmt, &rec)) {
+      return;
+    }
+    switch(rec.type) {
+    case REC_BOOT:
+      if(booted.insert(rec.self_id).second) {
+        exp->nodes.push_back(rec.self_id);
+      }
+      break;
+    case REC_RECV:
+      exp->recv.push_back({rec.time, rec.time_ms, rec.self_id, rec.src,
+                           rec.seqn, rec.hops});
+      break;
+    case REC_SENT:
+    case REC_NOTSENT:
+      exp->sent.push_back({rec.time, rec.time_ms, SINK_ID, rec.self_id,
+                           rec.seqn, uint8_t(rec.type == REC_SENT)});
+      break;
+    case REC_ENERGEST:
+      exp->energest.push_back({rec.time, rec.time_ms, rec.self_id, rec.cnt,
+                               rec.cpu, rec.lpm, rec.tx, rec.rx});
+      break;
+    case REC_ENERGEST_PHASE:
+      exp->energest_phase.push_back({rec.time, rec.time_ms, rec.self_id,
+                                     rec.cnt, rec.phase, rec.cpu, rec.lpm,
+                                     rec.tx, rec.rx});
+      break;
+    case REC_SYNC_BEACON:
+      exp->route.push_back({rec.time, rec.time_ms, rec.self_id, 0,
+                            ROUTE_BEACON});
+      break;
+    case REC_ROUTE:
+    case REC_PARENT_SWITCH:
+      exp->route.push_back({rec.time, rec.time_ms, rec.self_id, rec.parent,
+                            uint8_t(rec.type == REC_ROUTE ? ROUTE_EPOCH
+                                                          : ROUTE_SWITCH)});
+      break;
+    default:
+      break;
+    }
+  });
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+std::vector<uint16_t>
+silent_nodes(const experiment &exp)
+{
+  std::unordered_set<uint16_t> senders;
+  for(const auto &s : exp.sent) {
+    senders.insert(s.src);
+  }
+  std::vector<uint16_t> fails;
+  std::vector<uint16_t> nodes(exp.nodes);
+  std::sort(nodes.begin(), nodes.end());
+  for(uint16_t n : nodes) {
+    if(n != SINK_ID && senders.count(n) == 0) {
+      fails.push_back(n);
+    }
+  }
+  return fails;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t
+packet_key(uint16_t src, uint16_t dest, uint32_t seqn)
+{
+  return (uint64_t(src) << 48) | (uint64_t(dest) << 32) | seqn;
+}
+/*---------------------------------------------------------------------------*/
+std::vector<node_pdr>
+compute_node_pdr(const experiment &exp)
+{
+  /* Remove duplicates, keeping the first occurrence */
+  std::unordered_set<uint64_t> received;
+  received.reserve(exp.recv.size());
+  for(const auto &r : exp.recv) {
+    received.insert(packet_key(r.src, r.dest, r.seqn));
+  }
+  std::unordered_set<uint64_t> seen;
+  seen.reserve(exp.sent.size());
+  std::vector<const sent_row *> sent;
+  sent.reserve(exp.sent.size());
+  for(const auto &s : exp.sent) {
+    if(seen.insert(packet_key(s.src, s.dest, s.seqn)).second) {
+      sent.push_back(&s);
+    }
+  }
+  if(sent.empty()) {
+    return {};
+  }
+
+  /* Discard first and last sequence number:
+   * The first packet may not be sent as nodes boot at different times.
+   * The last packet may not be sent in case the test stops before or
+   * in the middle of the data collection phase */
+  uint32_t min_seqn = UINT32_MAX, max_seqn = 0;
+  for(const sent_row *s : sent) {
+    min_seqn = std::min(min_seqn, s->seqn);
+    max_seqn = std::max(max_seqn, s->seqn);
+  }
+
+  /* Nodes are taken before filtering, like sdf.src.unique() */
+  std::vector<uint16_t> nodes;
+  std::unordered_map<uint16_t, node_pdr> per_node;
+  for(const sent_row *s : sent) {
+    if(per_node.find(s->src) == per_node.end()) {
+      per_node[s->src] = {s->src, 0, 0, 0, 0.0};
+      nodes.push_back(s->src);
+    }
+    if(s->seqn <= min_seqn || s->seqn >= max_seqn) {
+      continue;
+    }
+    node_pdr &p = per_node[s->src];
+    p.sent_trials++;
+    if(s->status != 0) {
+      p.sent++;
+    }
+    if(received.count(packet_key(s->src, s->dest, s->seqn))) {
+      p.recv++;
+    }
+  }
+  std::sort(nodes.begin(), nodes.end());
+
+  std::vector<node_pdr> res;
+  res.reserve(nodes.size());
+  for(uint16_t n : nodes) {
+    node_pdr p = per_node[n];
+    p.pdr = p.sent ? 100.0 * p.recv / p.sent : NAN;
+    res.push_back(p);
+  }
+  return res;
+}
+/*---------------------------------------------------------------------------*/
+std::vector<node_dc>
+compute_node_duty_cycle(const experiment &exp, bool all)
+{
+  struct totals {
+    uint64_t time;
+    uint64_t radio;
+  };
+  std::unordered_map<uint16_t, totals> per_node;
+  for(const auto &e : exp.energest) {
+    /* Discard first two Energest reports */
+    if(e.cnt < 2) {
+      continue;
+    }
+    totals &t = per_node[e.node];
+    t.time += uint64_t(e.cpu) + e.lpm;
+    t.radio += uint64_t(e.tx) + e.rx;
+  }
+
+  std::vector<node_dc> res;
+  for(const auto &kv : per_node) {
+    if(!all && kv.first <= SINK_ID) {
+      continue;
+    }
+    double dc = kv.second.time ? 100.0 * kv.second.radio / kv.second.time : NAN;
+    res.push_back({kv.first, dc});
+  }
+  std::sort(res.begin(), res.end(),
+            [](const node_dc &a, const node_dc &b) { return a.node < b.node; });
+  return res;
+}
+/*---------------------------------------------------------------------------*/
+const char *
+phase_name(uint8_t phase)
+{
+  static const char *names[] = {"idle", "sync", "collect", "off"};
+  return phase < sizeof(names) / sizeof(names[0]) ? names[phase] : "?";
+}
+/*---------------------------------------------------------------------------*/
+std::vector<node_phase_dc>
+compute_node_phase_duty_cycle(const experiment &exp)
+{
+  struct totals {
+    uint64_t time;
+    uint64_t radio;
+  };
+  /* (node, phase) -> totals, plus the totals of every node */
+  std::unordered_map<uint32_t, totals> per_phase;
+  std::unordered_map<uint16_t, totals> per_node;
+  for(const auto &e : exp.energest_phase) {
+    if(e.cnt < 2 || e.node <= SINK_ID) {
+      continue;
+    }
+    uint64_t time = uint64_t(e.cpu) + e.lpm;
+    uint64_t radio = uint64_t(e.tx) + e.rx;
+    totals &p = per_phase[(uint32_t(e.node) << 8) | e.phase];
+    p.time += time;
+    p.radio += radio;
+    totals &n = per_node[e.node];
+    n.time += time;
+    n.radio += radio;
+  }
+
+  std::vector<node_phase_dc> res;
+  for(const auto &kv : per_phase) {
+    uint16_t node = kv.first >> 8;
+    const totals &p = kv.second;
+    const totals &n = per_node[node];
+    res.push_back({node, uint8_t(kv.first & 0xff),
+                   n.time ? 100.0 * p.time / n.time : NAN,
+                   p.time ? 100.0 * p.radio / p.time : NAN,
+                   n.time ? 100.0 * p.radio / n.time : NAN,
+                   n.radio ? 100.0 * p.radio / n.radio : NAN});
+  }
+  std::sort(res.begin(), res.end(), [](const node_phase_dc &a,
+                                       const node_phase_dc &b) {
+    return a.node != b.node ? a.node < b.node : a.phase < b.phase;
+  });
+  return res;
+}
+/*---------------------------------------------------------------------------*/
+std::vector<node_latency>
+compute_node_latency(const experiment &exp)
+{
+  std::unordered_map<uint64_t, int64_t> sent_at;
+  sent_at.reserve(exp.sent.size());
+  for(const auto &s : exp.sent) {
+    if(s.status != 0 && s.time_ms >= 0) {
+      sent_at.emplace(packet_key(s.src, s.dest, s.seqn), s.time_ms);
+    }
+  }
+
+  std::unordered_set<uint64_t> seen;
+  std::unordered_map<uint16_t, node_latency> per_node;
+  for(const auto &r : exp.recv) {
+    uint64_t key = packet_key(r.src, r.dest, r.seqn);
+    auto it = sent_at.find(key);
+    if(it == sent_at.end() || r.time_ms < it->second || !seen.insert(key).second) {
+      continue;
+    }
+    double l = double(r.time_ms - it->second);
+    node_latency &n = per_node[r.src];
+    n.node = r.src;
+    n.samples++;
+    n.mean_ms += l; /* sum for now, divided below */
+    n.max_ms = std::max(n.max_ms, l);
+  }
+
+  std::vector<node_latency> res;
+  for(auto &kv : per_node) {
+    kv.second.mean_ms /= kv.second.samples;
+    res.push_back(kv.second);
+  }
+  std::sort(res.begin(), res.end(), [](const node_latency &a,
+                                       const node_latency &b) {
+    return a.node < b.node;
+  });
+  return res;
+}
+/*---------------------------------------------------------------------------*/
+/* Pearson correlation, NAN with fewer than three points or no variance */
+static double
+correlation(const std::vector<double> &x, const std::vector<double> &y)
+{
+  double n = x.size(), sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+  if(x.size() < 3) {
+    return NAN;
+  }
+  for(size_t i = 0; i < x.size(); i++) {
+    sx += x[i];
+    sy += y[i];
+  }
+  for(size_t i = 0; i < x.size(); i++) {
+    double dx = x[i] - sx / n, dy = y[i] - sy / n;
+    sxx += dx * dx;
+    syy += dy * dy;
+    sxy += dx * dy;
+  }
+  return sxx > 0 && syy > 0 ? sxy / std::sqrt(sxx * syy) : NAN;
+}
+/*---------------------------------------------------------------------------*/
+tree_load
+compute_relay_load(const experiment &exp)
+{
+  tree_load res = {};
+  res.r_dc = res.r_loss = NAN;
+
+  /* Observations in time order (log order within the same millisecond) */
+  std::vector<const route_row *> obs;
+  std::vector<int64_t> starts;
+  bool expire = false;
+  uint16_t max_id = SINK_ID;
+  for(const auto &r : exp.route) {
+    if(r.time_ms < 0) {
+      continue;
+    }
+    if(r.kind == ROUTE_BEACON) {
+      if(r.node == SINK_ID) {
+        starts.push_back(r.time_ms);
+      }
+      continue;
+    }
+    obs.push_back(&r);
+    expire = expire || r.kind == ROUTE_EPOCH;
+    max_id = std::max({max_id, r.node, r.parent});
+  }
+  if(obs.empty()) {
+    return res;
+  }
+  std::stable_sort(obs.begin(), obs.end(), [](const route_row *a,
+                                              const route_row *b) {
+    return a->time_ms < b->time_ms;
+  });
+  std::sort(starts.begin(), starts.end());
+  int64_t t0 = obs.front()->time_ms;
+  for(const auto &s : exp.sent) {
+    if(s.time_ms >= 0) {
+      t0 = std::min(t0, s.time_ms);
+    }
+  }
+  auto epoch_of = [&](int64_t t) -> uint32_t {
+    if(starts.empty()) {
+      return t > t0 ? uint32_t((t - t0) / EPOCH_MS) : 0;
+    }
+    auto it = std::upper_bound(starts.begin(), starts.end(), t);
+    return it == starts.begin() ? 0 : uint32_t(it - starts.begin() - 1);
+  };
+
+  /* Route: times of every source, to place its packets */
+  std::unordered_map<uint16_t, std::vector<int64_t>> route_at;
+  for(const route_row *r : obs) {
+    if(r->kind == ROUTE_EPOCH) {
+      route_at[r->node].push_back(r->time_ms);
+    }
+  }
+  auto packet_epoch = [&](uint16_t src, int64_t t) -> uint32_t {
+    auto it = route_at.find(src);
+    if(it != route_at.end()) {
+      auto r = std::lower_bound(it->second.begin(), it->second.end(), t);
+      if(r != it->second.end()) {
+        return epoch_of(*r);
+      }
+    }
+    return epoch_of(t);
+  };
+
+  /* Unique packets, by epoch: sent ones (lost or not) and received ones */
+  struct packet {
+    uint16_t src;
+    bool received;
+    bool sent;
+    uint8_t hops;
+  };
+  std::unordered_map<uint64_t, packet> packets;
+  std::unordered_map<uint64_t, uint32_t> epoch_of_packet;
+  for(const auto &r : exp.recv) {
+    uint64_t key = packet_key(r.src, r.dest, r.seqn);
+    if(packets.emplace(key, packet{r.src, true, false, r.hops}).second) {
+      epoch_of_packet[key] = packet_epoch(r.src, r.time_ms);
+    }
+  }
+  for(const auto &s : exp.sent) {
+    if(s.status == 0 || s.time_ms < 0) {
+      continue;
+    }
+    uint64_t key = packet_key(s.src, s.dest, s.seqn);
+    packet &p = packets.emplace(key, packet{s.src, false, false, 0}).first->second;
+    if(!p.sent) {
+      p.sent = true;
+      epoch_of_packet[key] = packet_epoch(s.src, s.time_ms);
+    }
+    max_id = std::max(max_id, s.src);
+  }
+  for(const auto &kv : packets) {
+    max_id = std::max(max_id, kv.second.src);
+  }
+  uint32_t epochs = 0;
+  std::vector<std::vector<const packet *>> by_epoch;
+  for(const auto &kv : packets) {
+    uint32_t e = epoch_of_packet[kv.first];
+    if(e >= by_epoch.size()) {
+      by_epoch.resize(e + 1);
+    }
+    by_epoch[e].push_back(&kv.second);
+  }
+  epochs = std::max<uint32_t>(by_epoch.size(), epoch_of(obs.back()->time_ms) + 1);
+  by_epoch.resize(epochs);
+
+  /* Per node totals */
+  struct totals {
+    uint32_t epochs, subtree_max, forwarded, sent, lost;
+    uint64_t subtree_sum;
+  };
+  std::vector<totals> tot(max_id + 1, totals{});
+  std::vector<uint16_t> parent(max_id + 1, 0);
+  std::vector<uint32_t> subtree(max_id + 1, 0);
+  std::vector<uint16_t> path;
+  /* Ancestors of n below the sink, false if the chain does not reach it */
+  auto ancestors = [&](uint16_t n) -> bool {
+    path.clear();
+    for(uint16_t a = parent[n]; a != SINK_ID; a = parent[a]) {
+      if(a == 0 || a == n || path.size() > max_id) {
+        return false;
+      }
+      path.push_back(a);
+    }
+    return true;
+  };
+
+  size_t next = 0;
+  for(uint32_t e = 0; e < epochs; e++) {
+    if(expire) {
+      std::fill(parent.begin(), parent.end(), 0);
+    }
+    while(next < obs.size() && epoch_of(obs[next]->time_ms) <= e) {
+      parent[obs[next]->node] = obs[next]->parent;
+      next++;
+    }
+    std::fill(subtree.begin(), subtree.end(), 0);
+    for(uint16_t n = 0; n <= max_id; n++) {
+      if(n == SINK_ID || parent[n] == 0 || !ancestors(n)) {
+        continue;
+      }
+      tot[n].epochs++;
+      for(uint16_t a : path) {
+        subtree[a]++;
+      }
+    }
+    for(uint16_t n = 0; n <= max_id; n++) {
+      tot[n].subtree_sum += subtree[n];
+      tot[n].subtree_max = std::max(tot[n].subtree_max, subtree[n]);
+    }
+    for(const packet *p : by_epoch[e]) {
+      bool routed = p->src != SINK_ID && parent[p->src] != 0 &&
+        ancestors(p->src);
+      if(p->received) {
+        res.packets++;
+        if(routed) {
+          res.attributed++;
+          res.hops_match += p->hops == path.size();
+        }
+      }
+      if(!routed) {
+        continue;
+      }
+      for(uint16_t a : path) {
+        tot[a].forwarded += p->received;
+        tot[a].sent += p->sent;
+        tot[a].lost += p->sent && !p->received;
+      }
+    }
+  }
+  res.epochs = epochs;
+
+  std::unordered_map<uint16_t, double> dc;
+  for(const auto &d : compute_node_duty_cycle(exp)) {
+    dc[d.node] = d.dc;
+  }
+  std::vector<double> fwd_all, dc_all, fwd_relay, loss_relay;
+  for(uint16_t n = 0; n <= max_id; n++) {
+    const totals &t = tot[n];
+    if(t.epochs == 0) {
+      continue;
+    }
+    relay_load r;
+    r.node = n;
+    r.epochs = t.epochs;
+    r.subtree = double(t.subtree_sum) / t.epochs;
+    r.subtree_max = t.subtree_max;
+    r.forwarded = t.forwarded;
+    r.fwd_per_epoch = double(t.forwarded) / t.epochs;
+    r.subtree_sent = t.sent;
+    r.subtree_lost = t.lost;
+    r.subtree_pdr = t.sent ? 100.0 * (t.sent - t.lost) / t.sent : NAN;
+    auto it = dc.find(n);
+    r.dc = it != dc.end() ? it->second : NAN;
+    res.nodes.push_back(r);
+    if(!std::isnan(r.dc)) {
+      fwd_all.push_back(r.fwd_per_epoch);
+      dc_all.push_back(r.dc);
+    }
+    if(t.subtree_max > 0 && t.sent > 0) {
+      fwd_relay.push_back(r.fwd_per_epoch);
+      loss_relay.push_back(100.0 - r.subtree_pdr);
+    }
+  }
+  res.r_dc = correlation(fwd_all, dc_all);
+  res.r_loss = correlation(fwd_relay, loss_relay);
+  return res;
+}
+/*---------------------------------------------------------------------------*/
+void
+print_node_pdr(const std::vector<node_pdr> &pdr)
+{
+  uint64_t trials = 0, sent = 0, recv = 0;
+
+  printf("\n***** PDR *****\n");
+  for(const auto &p : pdr) {
+    printf("Node: %2u  Sent trials: %u Packet actually sent: %u "
+           "Packets Received: %u Packets lost: %d "
+           "PDR over packets sent: %.3f%% (%u/%u)\n",
+           p.node, p.sent_trials, p.sent, p.recv, int(p.sent - p.recv), p.pdr,
+           p.recv, p.sent);
+    trials += p.sent_trials;
+    sent += p.sent;
+    recv += p.recv;
+  }
+
+  /* Print average statistics */
+  printf("Overall PDR over packets actually sent: %.2f%% (%" PRId64 " lost / %"
+         PRIu64 " sent)\n", sent ? 100.0 * recv / sent : NAN,
+         int64_t(sent - recv), sent);
+  printf("Sent trials: %" PRIu64 " Packets actually sent: %" PRIu64 "\n",
+         trials, sent);
+}
+/*---------------------------------------------------------------------------*/
+void
+print_node_duty_cycle(const experiment &exp)
+{
+  std::vector<node_dc> all = compute_node_duty_cycle(exp, true);
+  std::vector<double> dc_lst;
+
+  printf("\n----- Node Duty Cycle -----\n");
+  for(const auto &d : all) {
+    printf("Node: %u Duty Cycle: %.3f%%\n", d.node, d.dc);
+    if(d.node > SINK_ID) {
+      dc_lst.push_back(d.dc);
+    }
+  }
+  if(dc_lst.empty()) {
+    return;
+  }
+
+  double sum = 0, sq = 0;
+  double lo = dc_lst[0], hi = dc_lst[0];
+  for(double v : dc_lst) {
+    sum += v;
+    lo = std::min(lo, v);
+    hi = std::max(hi, v);
+  }
+  double mean = sum / dc_lst.size();
+  for(double v : dc_lst) {
+    sq += (v - mean) * (v - mean);
+  }
+  printf("\n----- Duty Cycle Stats -----\n");
+  printf("Average Duty Cycle: %.3f%%\nStandard Deviation: %.3f"
+         "\nMinimum: %.3f\nMaximum: %.3f\n", mean,
+         std::sqrt(sq / dc_lst.size()), lo, hi);
+}
+/*---------------------------------------------------------------------------*/
+void
+print_node_phase_duty_cycle(const std::vector<node_phase_dc> &phases)
+{
+  if(phases.empty()) {
+    return;
+  }
+  struct sums {
+    double time, dc, contrib, radio_share;
+    unsigned n;
+  };
+  std::vector<sums> avg;
+
+  printf("\n----- Per-phase Duty Cycle -----\n");
+  printf("%4s %-8s %8s %8s %8s %8s\n", "Node", "Phase", "Time%", "DC%",
+         "Contrib%", "Radio%");
+  for(const auto &p : phases) {
+    printf("%4u %-8s %8.3f %8.3f %8.3f %8.3f\n", p.node, phase_name(p.phase),
+           p.time, p.dc, p.contrib, p.radio_share);
+    if(p.phase >= avg.size()) {
+      avg.resize(p.phase + 1);
+    }
+    sums &s = avg[p.phase];
+    s.time += p.time;
+    s.dc += std::isnan(p.dc) ? 0 : p.dc;
+    s.contrib += p.contrib;
+    s.radio_share += std::isnan(p.radio_share) ? 0 : p.radio_share;
+    s.n++;
+  }
+
+  /* Average over the nodes: where the radio-on time goes */
+  printf("\n----- Per-phase Duty Cycle Stats -----\n");
+  for(size_t i = 0; i < avg.size(); i++) {
+    const sums &s = avg[i];
+    if(s.n == 0) {
+      continue;
+    }
+    printf("Phase: %-8s Time: %.3f%% Duty Cycle: %.3f%% "
+           "Contribution: %.3f%% Radio-on share: %.3f%%\n", phase_name(i),
+           s.time / s.n, s.dc / s.n, s.contrib / s.n, s.radio_share / s.n);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+print_relay_load(const tree_load &tree, size_t hotspots)
+{
+  if(tree.nodes.empty()) {
+    return;
+  }
+  std::vector<const relay_load *> relays;
+
+  printf("\n----- Relay Load -----\n");
+  printf("Epochs: %u Packets routed through the tree: %u/%u "
+         "Hop counts matching the tree: %.1f%%\n", tree.epochs,
+         tree.attributed, tree.packets,
+         tree.attributed ? 100.0 * tree.hops_match / tree.attributed : NAN);
+  printf("%4s %6s %8s %7s %9s %8s %9s %8s\n", "Node", "Epochs", "Subtree",
+         "Max", "Forwarded", "Fwd/ep", "SubPDR%", "DC%");
+  for(const auto &r : tree.nodes) {
+    if(r.subtree_max == 0) {
+      continue;
+    }
+    printf("%4u %6u %8.2f %7u %9u %8.2f %9.3f %8.3f\n", r.node, r.epochs,
+           r.subtree, r.subtree_max, r.forwarded, r.fwd_per_epoch,
+           r.subtree_pdr, r.dc);
+    relays.push_back(&r);
+  }
+  printf("Correlation of forwarded load with duty cycle (all nodes): %.3f\n",
+         tree.r_dc);
+  printf("Correlation of forwarded load with subtree loss (relays): %.3f\n",
+         tree.r_loss);
+
+  /* Most loaded relays, then highest duty cycle */
+  std::sort(relays.begin(), relays.end(), [](const relay_load *a,
+                                             const relay_load *b) {
+    if(a->fwd_per_epoch != b->fwd_per_epoch) {
+      return a->fwd_per_epoch > b->fwd_per_epoch;
+    }
+    return (std::isnan(b->dc) ? -1 : b->dc) < (std::isnan(a->dc) ? -1 : a->dc);
+  });
+  relays.resize(std::min(relays.size(), hotspots));
+  printf("\n----- Hotspot Relays -----\n");
+  for(const relay_load *r : relays) {
+    printf("Node: %u Forwarded/epoch: %.2f Subtree: %.2f (max %u) "
+           "Subtree PDR: %.3f%% Duty Cycle: %.3f%%\n", r->node,
+           r->fwd_per_epoch, r->subtree, r->subtree_max, r->subtree_pdr,
+           r->dc);
+  }
+}
+/*---------------------------------------------------------------------------*/
+std::string
+output_prefix(const std::string &log_file)
+{
+  size_t slash = log_file.rfind('/');
+  size_t dot = log_file.rfind('.');
+  if(dot == std::string::npos || (slash != std::string::npos && dot < slash)
+     || dot == (slash == std::string::npos ? 0 : slash + 1)) {
+    return log_file;
+  }
+  return log_file.substr(0, dot);
+}
+/*---------------------------------------------------------------------------*/
+/* Cooja times are copied verbatim, testbed times become POSIX timestamps
+ * printed like Python's repr(float) of a millisecond-resolution value.
+ * Rows decoded from a .lpc file have no text and are rebuilt from ms. */
+static void
+append_time(std::string &out, log_format fmt, std::string_view time,
+            int64_t time_ms)
+{
+  char buf[32];
+  if(fmt == log_format::cooja) {
+    if(time.empty() && time_ms >= 0) {
+      out.append(buf, snprintf(buf, sizeof(buf), "%02" PRId64 ":%02d.%03d",
+                               time_ms / 60000, int(time_ms / 1000 % 60),
+                               int(time_ms % 1000)));
+    } else {
+      out.append(time);
+    }
+    return;
+  }
+  int ms = int(time_ms % 1000);
+  int n = snprintf(buf, sizeof(buf), "%" PRId64 ".%03d", time_ms / 1000, ms);
+  while(n > 0 && buf[n - 1] == '0' && buf[n - 2] != '.') {
+    n--;
+  }
+  out.append(buf, n);
+}
+/*---------------------------------------------------------------------------*/
+static bool
+write_file(const std::string &path, const std::string &content)
+{
+  FILE *f = fopen(path.c_str(), "w");
+  if(f == nullptr) {
+    perror(path.c_str());
+    return false;
+  }
+  bool ok = fwrite(content.data(), 1, content.size(), f) == content.size();
+  ok = (fclose(f) == 0) && ok;
+  return ok;
+}
+/*---------------------------------------------------------------------------*/
+bool
+write_csv_tables(const experiment &exp, const std::vector<node_pdr> &pdr,
+                 const std::vector<node_dc> &dc)
+{
+  std::string prefix = output_prefix(exp.log_file);
+  std::string out;
+  char buf[128];
+  bool ok = true;
+
+  out.reserve(exp.recv.size() * 32);
+  out = "time_recv\tdest\tsrc\tseqn\thops\n";
+  for(const auto &r : exp.recv) {
+    append_time(out, exp.format, r.time, r.time_ms);
+    out.append(buf, snprintf(buf, sizeof(buf), "\t%u\t%u\t%u\t%u\n",
+                             r.dest, r.src, r.seqn, r.hops));
+  }
+  ok = write_file(prefix + "-recv.csv", out) && ok;
+
+  out = "time_sent\tdest\tsrc\tseqn\tstatus\n";
+  for(const auto &s : exp.sent) {
+    append_time(out, exp.format, s.time, s.time_ms);
+    out.append(buf, snprintf(buf, sizeof(buf), "\t%u\t%u\t%u\t%u\n",
+                             s.dest, s.src, s.seqn, s.status));
+  }
+  ok = write_file(prefix + "-sent.csv", out) && ok;
+
+  out = "time\tnode\tcnt\tcpu\tlpm\ttx\trx\n";
+  for(const auto &e : exp.energest) {
+    append_time(out, exp.format, e.time, e.time_ms);
+    out.append(buf, snprintf(buf, sizeof(buf), "\t%u\t%u\t%u\t%u\t%u\t%u\n",
+                             e.node, e.cnt, e.cpu, e.lpm, e.tx, e.rx));
+  }
+  ok = write_file(prefix + "-energest.csv", out) && ok;
+
+  out = "node\tsent_trials\tsent\trecv\tpdr\n";
+  for(const auto &p : pdr) {
+    out.append(buf, snprintf(buf, sizeof(buf), "%u\t%u\t%u\t%u\t%.3f\n",
+                             p.node, p.sent_trials, p.sent, p.recv, p.pdr));
+  }
+  printf("Saving PDR CSV file in: %s-pdr.csv\n", prefix.c_str());
+  ok = write_file(prefix + "-pdr.csv", out) && ok;
+
+  out = "node\tdc\n";
+  for(const auto &d : dc) {
+    out.append(buf, snprintf(buf, sizeof(buf), "%u\t%.3f\n", d.node, d.dc));
+  }
+  printf("Saving Duty Cycle CSV file in: %s-dc.csv\n", prefix.c_str());
+  ok = write_file(prefix + "-dc.csv", out) && ok;
+
+  if(!exp.route.empty()) {
+    static const char *kinds[] = {"beacon", "route", "switch"};
+    out = "time\tnode\tparent\tkind\n";
+    for(const auto &r : exp.route) {
+      append_time(out, exp.format, r.time, r.time_ms);
+      out.append(buf, snprintf(buf, sizeof(buf), "\t%u\t%u\t%s\n", r.node,
+                               r.parent, kinds[r.kind]));
+    }
+    ok = write_file(prefix + "-route.csv", out) && ok;
+
+    out = "node\tepochs\tsubtree\tsubtree_max\tforwarded\tfwd_per_epoch"
+      "\tsubtree_sent\tsubtree_lost\tsubtree_pdr\tdc\n";
+    for(const auto &r : compute_relay_load(exp).nodes) {
+      out.append(buf, snprintf(buf, sizeof(buf),
+                               "%u\t%u\t%.3f\t%u\t%u\t%.3f\t%u\t%u\t%.3f\t%.3f\n",
+                               r.node, r.epochs, r.subtree, r.subtree_max,
+                               r.forwarded, r.fwd_per_epoch, r.subtree_sent,
+                               r.subtree_lost, r.subtree_pdr, r.dc));
+    }
+    printf("Saving relay load CSV file in: %s-relay.csv\n", prefix.c_str());
+    ok = write_file(prefix + "-relay.csv", out) && ok;
+  }
+
+  if(exp.energest_phase.empty()) {
+    return ok;
+  }
+  out = "time\tnode\tcnt\tphase\tcpu\tlpm\ttx\trx\n";
+  for(const auto &e : exp.energest_phase) {
+    append_time(out, exp.format, e.time, e.time_ms);
+    out.append(buf, snprintf(buf, sizeof(buf),
+                             "\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n", e.node, e.cnt,
+                             e.phase, e.cpu, e.lpm, e.tx, e.rx));
+  }
+  ok = write_file(prefix + "-energest-phase.csv", out) && ok;
+
+  out = "node\tphase\ttime\tdc\tcontrib\tradio_share\n";
+  for(const auto &p : compute_node_phase_duty_cycle(exp)) {
+    out.append(buf, snprintf(buf, sizeof(buf),
+                             "%u\t%s\t%.3f\t%.3f\t%.3f\t%.3f\n", p.node,
+                             phase_name(p.phase), p.time, p.dc,
+                             p.contrib, p.radio_share));
+  }
+  printf("Saving per-phase Duty Cycle CSV file in: %s-phase-dc.csv\n",
+         prefix.c_str());
+  ok = write_file(prefix + "-phase-dc.csv", out) && ok;
+
+  return ok;
+}
+/*---------------------------------------------------------------------------*/
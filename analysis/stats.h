@@ -0,0 +1,229 @@
+/**
+ * \file
+ *         Experiment tables and PDR / duty-cycle statistics.
+ *
+ *         Native counterpart of parse_file(), compute_node_pdr() and
+ *         compute_node_duty_cycle() in parse-stats.py.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#ifndef STATS_H
+#define STATS_H
+/*---------------------------------------------------------------------------*/
+#include <memory>
+#include <string>
+#include <vector>
+#include "log-scan.h"
+/*---------------------------------------------------------------------------*/
+#define EPOCH_MS 30000  /* EPOCH_DURATION of sched_collect */
+/*---------------------------------------------------------------------------*/
+/* Rows of the -recv.csv, -sent.csv and -energest.csv tables */
+struct recv_row {
+  std::string_view time;
+  int64_t time_ms;
+  uint16_t dest;
+  uint16_t src;
+  uint32_t seqn;
+  uint8_t hops;
+};
+
+struct sent_row {
+  std::string_view time;
+  int64_t time_ms;
+  uint16_t dest;
+  uint16_t src;
+  uint32_t seqn;
+  uint8_t status; /* 1 sent, 0 could not be scheduled */
+};
+
+struct energest_row {
+  std::string_view time;
+  int64_t time_ms;
+  uint16_t node;
+  uint32_t cnt;
+  uint32_t cpu, lpm, tx, rx;
+};
+
+/* Energest counters of one phase of the epoch (simple_energest_phase) */
+struct energest_phase_row {
+  std::string_view time;
+  int64_t time_ms;
+  uint16_t node;
+  uint32_t cnt;
+  uint8_t phase;
+  uint32_t cpu, lpm, tx, rx;
+};
+/* Routing observations: a node's parent (Route: record of an epoch or
+ * parent switch) and the sink's beacons, which start the epochs */
+enum route_kind : uint8_t {
+  ROUTE_BEACON,
+  ROUTE_EPOCH,
+  ROUTE_SWITCH
+};
+
+struct route_row {
+  std::string_view time;
+  int64_t time_ms;
+  uint16_t node;
+  uint16_t parent;  /* 0: none */
+  uint8_t kind;     /* route_kind */
+};
+/*---------------------------------------------------------------------------*/
+/* A parsed log file. Time strings point into the mapped log. */
+struct experiment {
+  std::string log_file;
+  log_format format;
+  std::unique_ptr<mapped_file> log;
+  std::vector<uint16_t> nodes; /* nodes that booted, in order of appearance */
+  std::vector<recv_row> recv;
+  std::vector<sent_row> sent;
+  std::vector<energest_row> energest;
+  std::vector<energest_phase_row> energest_phase; /* not kept in .lpc files */
+  std::vector<route_row> route;                   /* not kept in .lpc files */
+};
+/*---------------------------------------------------------------------------*/
+/* Rows of the -pdr.csv and -dc.csv tables */
+struct node_pdr {
+  uint16_t node;
+  uint32_t sent_trials;
+  uint32_t sent;
+  uint32_t recv;
+  double pdr;
+};
+
+struct node_dc {
+  uint16_t node;
+  double dc;
+};
+
+/* Share of one phase of the epoch in a node's time and radio usage */
+struct node_phase_dc {
+  uint16_t node;
+  uint8_t phase;
+  double time;        /* % of the node's time spent in the phase */
+  double dc;          /* radio duty cycle within the phase (%) */
+  double contrib;     /* contribution to the node's duty cycle (%) */
+  double radio_share; /* % of the node's radio-on time */
+};
+
+/* Load of a node as a relay, over the epochs it was in the routing tree */
+struct relay_load {
+  uint16_t node;
+  uint32_t epochs;       /* epochs with a known route to the sink */
+  double subtree;        /* mean number of descendants */
+  uint32_t subtree_max;
+  uint32_t forwarded;    /* packets of descendants that reached the sink */
+  double fwd_per_epoch;
+  uint32_t subtree_sent; /* packets sent by descendants */
+  uint32_t subtree_lost;
+  double subtree_pdr;    /* NAN without descendants */
+  double dc;             /* NAN without Energest reports */
+};
+
+/* Routing tree rebuilt per epoch and the resulting relay load */
+struct tree_load {
+  uint32_t epochs;
+  uint32_t packets;      /* unique packets received by the sink */
+  uint32_t attributed;   /* ... whose source had a route in the tree */
+  uint32_t hops_match;   /* ... whose hop count matches the tree */
+  double r_dc;           /* correlation of fwd_per_epoch and duty cycle */
+  double r_loss;         /* ... and subtree loss, over the relays */
+  std::vector<relay_load> nodes; /* every node seen in a tree, by id */
+};
+
+/* End-to-end latency of the packets that reached the sink */
+struct node_latency {
+  uint16_t node;
+  uint32_t samples;
+  double mean_ms;
+  double max_ms;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Map and scan a whole log file into exp
+ *
+ *                 Columnar .lpc files (see colstore.h) are recognised by
+ *                 their header and decoded without any text parsing.
+ * \return         false if the file cannot be opened
+ */
+bool load_experiment(const char *log_file, log_format fmt, experiment *exp);
+/*---------------------------------------------------------------------------*/
+/* Non-sink nodes that booted but never tried to send */
+std::vector<uint16_t> silent_nodes(const experiment &exp);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Per-node PDR over packets actually sent
+ *
+ *                 Same semantics as compute_node_pdr() in parse-stats.py:
+ *                 duplicates are dropped, sent and received packets are
+ *                 joined on (src, dest, seqn) and the first and last
+ *                 sequence numbers are discarded.
+ */
+std::vector<node_pdr> compute_node_pdr(const experiment &exp);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Per-node radio duty cycle, skipping the first two reports
+ * \param all      Also include the sink in the result
+ */
+std::vector<node_dc> compute_node_duty_cycle(const experiment &exp,
+                                             bool all = false);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Per-node, per-phase duty cycle breakdown, skipping the
+ *                 first two reports like compute_node_duty_cycle()
+ *
+ *                 The contributions of the phases of a node add up to its
+ *                 duty cycle. Sorted by node and phase; the sink is left out.
+ */
+std::vector<node_phase_dc> compute_node_phase_duty_cycle(const experiment &exp);
+/* Name of a sched_collect epoch phase (SCHED_COLLECT_PHASE_*) */
+const char *phase_name(uint8_t phase);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Per-node latency between `App: Send` and `App: Recv`
+ *
+ *                 Packets are joined on (src, seqn); only packets that were
+ *                 actually sent and received at least once are counted.
+ */
+std::vector<node_latency> compute_node_latency(const experiment &exp);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Rebuild the routing tree of every epoch and the load of
+ *                 the relays
+ *
+ *                 Epochs start at the sink's `Sync: B` beacons (every
+ *                 EPOCH_MS without them). A node's parent in an epoch is
+ *                 the last one it logged up to the end of the epoch: with
+ *                 `Route:` records a node without one in the epoch is out
+ *                 of the tree, otherwise (parent switches only) parents
+ *                 persist. A packet belongs to the epoch of the first
+ *                 `Route:` record of its source after it was sent, which is
+ *                 the collection phase it was sent in, else to the epoch
+ *                 it was sent (or received) in. Its relays are the
+ *                 ancestors of the source in that tree.
+ */
+tree_load compute_relay_load(const experiment &exp);
+/*---------------------------------------------------------------------------*/
+/* Print the same summaries as parse-stats.py */
+void print_node_pdr(const std::vector<node_pdr> &pdr);
+void print_node_duty_cycle(const experiment &exp);
+void print_node_phase_duty_cycle(const std::vector<node_phase_dc> &phases);
+/* Relay table, load correlations and the `hotspots` most loaded relays */
+void print_relay_load(const tree_load &tree, size_t hotspots = 5);
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Write the -recv, -sent, -energest, -pdr and -dc CSV files
+ *                 next to the log file, the -energest-phase and -phase-dc
+ *                 files if the log has per-phase records and the -route and
+ *                 -relay files if it has routing records
+ * \return         false on I/O errors
+ */
+bool write_csv_tables(const experiment &exp, const std::vector<node_pdr> &pdr,
+                      const std::vector<node_dc> &dc);
+/*---------------------------------------------------------------------------*/
+/* "<dir>/<log name without extension>" used as prefix of the output files */
+std::string output_prefix(const std::string &log_file);
+/*---------------------------------------------------------------------------*/
+#endif /* STATS_H */
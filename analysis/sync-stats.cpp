@@ -0,0 +1,232 @@
+/**
+ * \file
+ *         Time-synchronisation error of sched_collect.
+ *
+ *         Usage: sync-stats [-t|--testbed] [-c CLOCK_SECOND] [-p PERCENTILE]
+ *                           LOGFILE
+ *
+ *         Uses the `Sync:` records printed by sched_collect: the sink logs
+ *         when it sends the beacon of every epoch (`Sync: B seqn`), the
+ *         other nodes log the epoch start they estimated from the beacon
+ *         delays (`Sync: E seqn hops ago_ms`) and the moment they turn the
+ *         radio back on for the next epoch (`Sync: R seqn hops`). All
+ *         times are taken from the log clock, so both errors are measured
+ *         against the sink's beacon on a common time base:
+ *
+ *           - epoch error:    estimated epoch start - sink beacon time
+ *           - radio-on error: radio on - sink beacon time (negative: early)
+ *
+ *         The distributions are printed per node and per hop count, saved
+ *         in the -sync.csv file next to the log, and the radio-on error at
+ *         the given percentile is turned into a suggested GUARD_TIME change.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "stats.h"
+/*---------------------------------------------------------------------------*/
+#define CLOCK_SECOND_DEFAULT  1024  /* CLOCK_CONF_SECOND in project-conf.h */
+#define PERCENTILE_DEFAULT    99
+/*---------------------------------------------------------------------------*/
+struct sync_sample {
+  uint16_t node;
+  uint8_t hops;
+  uint32_t seqn;
+  int64_t time_ms;
+};
+
+/* Signed error samples (ms) and their summary */
+struct distribution {
+  std::vector<double> v;
+  void add(double x) { v.push_back(x); }
+  double percentile(double p) {
+    if(v.empty()) {
+      return NAN;
+    }
+    std::sort(v.begin(), v.end());
+    size_t rank = size_t(std::ceil(p / 100.0 * v.size()));
+    return v[std::min(v.size(), std::max<size_t>(rank, 1)) - 1];
+  }
+  double mean() const {
+    double sum = 0;
+    for(double x : v) {
+      sum += x;
+    }
+    return v.empty() ? NAN : sum / v.size();
+  }
+};
+
+struct sync_errors {
+  uint8_t hops = 0;
+  distribution epoch;
+  distribution radio_on;
+  uint32_t late = 0;  /* radio turned on after the sink's beacon */
+};
+/*---------------------------------------------------------------------------*/
+static void
+print_row(const char *label, const std::string &id, const std::string &hops,
+          sync_errors &e, double p)
+{
+  printf("%-5s %3s %4s %6zu %8.1f %8.1f %8.1f %6zu %8.1f %8.1f %8.1f %5u\n",
+         label, id.c_str(), hops.c_str(), e.epoch.v.size(), e.epoch.mean(),
+         e.epoch.percentile(50), e.epoch.percentile(p), e.radio_on.v.size(),
+         e.radio_on.mean(), e.radio_on.percentile(50),
+         e.radio_on.percentile(p), e.late);
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-t|--testbed] [-c clock_second] [-p percentile] "
+          "logfile\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  const char *log_file = nullptr;
+  log_format fmt = log_format::cooja;
+  double clock_second = CLOCK_SECOND_DEFAULT;
+  double pct = PERCENTILE_DEFAULT;
+
+  for(int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if(!strcmp(argv[i], "-t") || !strcmp(argv[i], "--testbed")) {
+      fmt = log_format::testbed;
+    } else if(!strcmp(argv[i], "-c") && has_value) {
+      clock_second = atof(argv[++i]);
+    } else if(!strcmp(argv[i], "-p") && has_value) {
+      pct = atof(argv[++i]);
+    } else if(log_file == nullptr && argv[i][0] != '-') {
+      log_file = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(log_file == nullptr || pct <= 0 || pct > 100) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  mapped_file log;
+  if(!log.open(log_file)) {
+    perror(log_file);
+    return 1;
+  }
+
+  /* One pass: sink beacons by seqn, node estimates and radio-on times */
+  std::unordered_map<uint32_t, int64_t> beacon_ms;
+  std::vector<sync_sample> epochs, radio_on;
+  log_record rec;
+  for_each_line(log.begin(), log.end(), [&](std::string_view line) {
+    if(!scan_line(line, fmt, &rec) || rec.time_ms < 0) {
+      return;
+    }
+    switch(rec.type) {
+    case REC_SYNC_BEACON:
+      beacon_ms.emplace(rec.seqn, rec.time_ms);
+      break;
+    case REC_SYNC_EPOCH:
+      epochs.push_back({rec.self_id, rec.hops, rec.seqn,
+                        rec.time_ms - int64_t(rec.ago_ms)});
+      break;
+    case REC_SYNC_RADIO_ON:
+      radio_on.push_back({rec.self_id, rec.hops, rec.seqn, rec.time_ms});
+      break;
+    default:
+      break;
+    }
+  });
+  if(beacon_ms.empty()) {
+    printf("No Sync: B records from the sink in %s.\n", log_file);
+    return 1;
+  }
+
+  std::map<uint16_t, sync_errors> per_node;
+  std::map<uint8_t, sync_errors> per_hop;
+  sync_errors all;
+  for(const sync_sample &s : epochs) {
+    auto b = beacon_ms.find(s.seqn);
+    if(b == beacon_ms.end()) {
+      continue;
+    }
+    double err = double(s.time_ms - b->second);
+    per_node[s.node].hops = s.hops;
+    per_node[s.node].epoch.add(err);
+    per_hop[s.hops].epoch.add(err);
+    all.epoch.add(err);
+  }
+  for(const sync_sample &s : radio_on) {
+    auto b = beacon_ms.find(s.seqn);
+    if(b == beacon_ms.end()) {
+      continue;
+    }
+    double err = double(s.time_ms - b->second);
+    bool late = err > 0;
+    per_node[s.node].hops = s.hops;
+    per_node[s.node].radio_on.add(err);
+    per_node[s.node].late += late;
+    per_hop[s.hops].radio_on.add(err);
+    per_hop[s.hops].late += late;
+    all.radio_on.add(err);
+    all.late += late;
+  }
+
+  printf("Logfile: %s\n", log_file);
+  printf("Sync errors against the sink's beacon (ms), %zu epochs\n\n",
+         beacon_ms.size());
+  char p_label[16];
+  snprintf(p_label, sizeof(p_label), "p%g", pct);
+  printf("%-5s %3s %4s %6s %8s %8s %8s %6s %8s %8s %8s %5s\n", "", "id",
+         "hops", "epochs", "mean", "p50", p_label, "on", "mean", "p50", p_label,
+         "late");
+  for(auto &[node, e] : per_node) {
+    print_row("node", std::to_string(node), std::to_string(e.hops), e, pct);
+  }
+  printf("\n");
+  for(auto &[hops, e] : per_hop) {
+    print_row("hop", "", std::to_string(hops), e, pct);
+  }
+  print_row("all", "", "", all, pct);
+
+  /* Radio-on error at the percentile -> room left for GUARD_TIME */
+  double on_p = all.radio_on.percentile(pct);
+  if(!std::isnan(on_p)) {
+    long ticks = lround(-on_p * clock_second / 1000.0);
+    printf("\nRadio on after the sink's beacon in %u of %zu epochs.\n",
+           all.late, all.radio_on.v.size());
+    printf("p%g radio-on error %.1f ms: GUARD_TIME can change by %+ld ticks\n",
+           pct, on_p, ticks);
+  }
+
+  std::string csv = output_prefix(log_file) + "-sync.csv";
+  FILE *f = fopen(csv.c_str(), "w");
+  if(f == nullptr) {
+    perror(csv.c_str());
+    return 1;
+  }
+  printf("Saving sync CSV file in: %s\n", csv.c_str());
+  fprintf(f, "node\thops\tepochs\tepoch_mean\tepoch_p50\tepoch_p%g"
+          "\tradio_on\ton_mean\ton_p50\ton_p%g\tlate\n", pct, pct);
+  for(auto &[node, e] : per_node) {
+    fprintf(f, "%u\t%u\t%zu\t%.3f\t%.3f\t%.3f\t%zu\t%.3f\t%.3f\t%.3f\t%u\n",
+            node, e.hops, e.epoch.v.size(), e.epoch.mean(),
+            e.epoch.percentile(50), e.epoch.percentile(pct),
+            e.radio_on.v.size(), e.radio_on.mean(), e.radio_on.percentile(50),
+            e.radio_on.percentile(pct), e.late);
+  }
+  fclose(f);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,352 @@
+#!/usr/bin/env python3
+"""
+Benchmark of the data collection protocols of this repository.
+
+Runs Rime collect (collect_rand/app-collect.c), my_collect with nullRDC and
+with ContikiMAC (collect_rand/app.c) and sched_collect
+(sched-collect-template/app.c) on the same Cooja topologies, with the same
+seeds and the same traffic (one packet per node every 30 s), and reports
+side by side:
+
+	- PDR, over the packets sent until TAIL seconds before the end
+	- duty cycle of the non-sink nodes, from Cooja's PowerTracker
+	- mean and 95th percentile end-to-end latency
+	- control (broadcast) and data (unicast) frames on the air and the
+	  share of control bytes, counted by the test script on the radio medium
+
+Every protocol is built once in its own copy of the project, then every
+(protocol, topology, seed) run is a headless Cooja instance whose test
+script is generated here, so all runs log and measure the same way:
+
+	./benchmark.py --csc ../sched-collect-template/test_nogui_udgm.csc \\
+		--csc ../collect_rand/test_nogui_mrm_10n.csc --seeds 3
+
+Only the topology and radio medium of a .csc template are used; mote types
+and scripts are replaced.
+"""
+
+import os
+import re
+import sys
+import shutil
+import argparse
+import subprocess
+from xml.sax.saxutils import escape
+from concurrent.futures import ThreadPoolExecutor
+
+bench_dir = os.path.dirname(os.path.abspath(__file__))
+repo_dir = os.path.dirname(bench_dir)
+
+# Protocols: project directory, its files, firmware and build definitions
+protocols = {
+	"rime-collect": {"project": "collect_rand", "firmware": "app-collect",
+		"defines": []},
+	"my_collect-nullrdc": {"project": "collect_rand", "firmware": "app",
+		"defines": ["COLLECT_CONF_RDC=nullrdc_driver"]},
+	"my_collect-contikimac": {"project": "collect_rand", "firmware": "app",
+		"defines": ["COLLECT_CONF_RDC=contikimac_driver"]},
+	"sched_collect": {"project": "sched-collect-template", "firmware": "app",
+		"defines": []},
+}
+project_files = {
+	"collect_rand": ["Makefile", "app.c", "app-collect.c", "my_collect.c",
+		"my_collect.h", "project-conf.h"],
+	"sched-collect-template": ["Makefile", "app.c", "sched_collect.c",
+		"sched_collect.h", "project-conf.h", "tools"],
+}
+
+# Packets sent in the last TAIL seconds are not counted in the PDR
+TAIL = 60
+SINK_ID = 1
+
+# Test script of every run: logs the motes' output, resets PowerTracker
+# after the settling time and classifies the frames on the air from their
+# 802.15.4 header (ack, broadcast or unicast data frame)
+script_template = """SIM_SETTLING_TIME = 1000
+        TIMEOUT({timeout});
+        try {{
+          load("nashorn:mozilla_compat.js");
+        }} catch(err) {{}}
+
+        importPackage(java.io);
+        importPackage(java.util);
+
+        ptplugin = sim.getCooja().getStartedPlugin("PowerTracker");
+        ptplugin.reset();
+
+        outputs = new FileWriter("{log}");
+        dcoutputs = new FileWriter("{dc_log}");
+
+        frames = {{bc: 0, bc_bytes: 0, uc: 0, uc_bytes: 0, ack: 0}};
+        medium = sim.getRadioMedium();
+        last_conn = null;
+        observer = new java.util.Observer({{
+          update: function(obs, obj) {{
+            conn = medium.getLastConnection();
+            if(conn == null || conn == last_conn) {{
+              return;
+            }}
+            last_conn = conn;
+            pkt = conn.getSource().getLastPacketTransmitted();
+            if(pkt == null) {{
+              return;
+            }}
+            data = pkt.getPacketData();
+            if(data.length < 3) {{
+              return;
+            }}
+            fcf = (data[0] & 0xff) | ((data[1] & 0xff) << 8);
+            if((fcf & 7) == 2) {{
+              frames.ack++;
+            }} else if(((fcf >> 10) & 3) == 2 && data.length >= 7 &&
+                      (data[5] & 0xff) == 0xff && (data[6] & 0xff) == 0xff) {{
+              frames.bc++;
+              frames.bc_bytes += data.length;
+            }} else {{
+              frames.uc++;
+              frames.uc_bytes += data.length;
+            }}
+          }}
+        }});
+        medium.addRadioMediumObserver(observer);
+
+        GENERATE_MSG(SIM_SETTLING_TIME, "Simulation Settling Time");
+
+        while (true) {{
+          if(msg.equals("Simulation Settling Time")) {{
+            ptplugin.reset();
+          }} else {{
+            outputs.write(time + "\\tID:" + id + "\\t" + msg + "\\n");
+          }}
+
+          try{{
+            YIELD();
+          }} catch (e) {{
+            dcoutputs.write(ptplugin.radioStatistics() + "\\n");
+            dcoutputs.write("FRAMES " + frames.bc + " " + frames.bc_bytes + " " +
+              frames.uc + " " + frames.uc_bytes + " " + frames.ack + "\\n");
+            outputs.close();
+            dcoutputs.close();
+            throw('test script killed');
+          }}
+        }}"""
+
+
+def run_cmd(cmd, cwd, log_name):
+	# Run a command, keeping its output in cwd/log_name
+	with open(os.path.join(cwd, log_name), "w") as out:
+		return subprocess.call(cmd, cwd=cwd, stdout=out,
+			stderr=subprocess.STDOUT) == 0
+
+
+def build_protocol(args, name):
+	# Copy the protocol's project and build its firmware
+	proto = protocols[name]
+	pdir = os.path.join(args.workdir, "build", name)
+	src_dir = os.path.join(repo_dir, proto["project"])
+	if os.path.exists(pdir):
+		shutil.rmtree(pdir)
+	os.makedirs(pdir)
+	for f in project_files[proto["project"]]:
+		src = os.path.join(src_dir, f)
+		if os.path.isdir(src):
+			shutil.copytree(src, os.path.join(pdir, f),
+				ignore=shutil.ignore_patterns("*.o", "obj_*"))
+		else:
+			shutil.copy(src, pdir)
+	cmd = ["make", proto["firmware"] + ".sky", "TARGET=sky",
+		"CONTIKI=" + args.contiki, "EXTRA_DEFINES=" + " ".join(proto["defines"])]
+	if not run_cmd(cmd, pdir, "build.log"):
+		return None
+	return os.path.join(pdir, proto["firmware"] + ".sky")
+
+
+def write_csc(args, template, firmware, seed, path):
+	# Topology and radio medium of the template, one mote type running the
+	# protocol's firmware, the benchmark test script
+	with open(template) as f:
+		csc = f.read()
+	csc = re.sub(r"<randomseed>[^<]*</randomseed>",
+		"<randomseed>{}</randomseed>".format(seed), csc)
+	csc = re.sub(r"<source EXPORT=\"discard\">[^<]*</source>\s*", "", csc)
+	csc = re.sub(r"<commands EXPORT=\"discard\">[^<]*</commands>\s*", "", csc)
+	csc = re.sub(r"<firmware EXPORT=\"copy\">[^<]*</firmware>",
+		"<firmware EXPORT=\"copy\">{}</firmware>".format(firmware), csc)
+	script = script_template.format(timeout=args.duration * 1000,
+		log="bench.log", dc_log="bench_dc.log")
+	csc = re.sub(r"<script>.*?</script>",
+		lambda m: "<script>{}</script>".format(escape(script)), csc, flags=re.S)
+	with open(path, "w") as f:
+		f.write(csc)
+
+
+def percentile(values, p):
+	if not values:
+		return float("nan")
+	values = sorted(values)
+	rank = max(1, min(len(values), int(-(-p * len(values) // 100))))
+	return values[rank - 1]
+
+
+def parse_run(rdir, duration):
+	# PDR and latency from the log, duty cycle and frames from the dc log
+	record = re.compile(r"^(?P<time>\d+)\s+ID:(?P<id>\d+)\s+(?P<msg>.*)$")
+	recv = re.compile(r"App: Recv from (\w+):(\w+) seqn (\d+) hops (\d+)")
+	sent = re.compile(r"App: Send seqn (\d+)")
+	sent_us = {}
+	recv_us = {}
+	with open(os.path.join(rdir, "bench.log")) as f:
+		for line in f:
+			m = record.match(line.rstrip("\n"))
+			if not m:
+				continue
+			t = int(m.group("time"))
+			r = recv.match(m.group("msg"))
+			if r:
+				src = int(r.group(1), 16) | int(r.group(2), 16) << 8
+				recv_us.setdefault((src, int(r.group(3))), t)
+				continue
+			s = sent.match(m.group("msg"))
+			if s and t < (duration - TAIL) * 1000000:
+				sent_us.setdefault((int(m.group("id")), int(s.group(1))), t)
+
+	delivered = [k for k in sent_us if k in recv_us]
+	latency = [(recv_us[k] - sent_us[k]) / 1000.0 for k in delivered]
+	res = {
+		"sent": len(sent_us), "recv": len(delivered),
+		"pdr": 100.0 * len(delivered) / len(sent_us) if sent_us else float("nan"),
+		"lat_mean": sum(latency) / len(latency) if latency else float("nan"),
+		"lat_p95": percentile(latency, 95),
+		"dc": float("nan"), "bc": 0, "bc_bytes": 0, "uc": 0, "uc_bytes": 0,
+		"ack": 0,
+	}
+
+	on = re.compile(r"^\D*(\d+) ON \d+ us ([\d.]+) %")
+	dcs = []
+	with open(os.path.join(rdir, "bench_dc.log")) as f:
+		for line in f:
+			m = on.match(line)
+			if m and not line.startswith("AVG") and int(m.group(1)) != SINK_ID:
+				dcs.append(float(m.group(2)))
+			elif line.startswith("FRAMES "):
+				bc, bc_bytes, uc, uc_bytes, ack = map(int, line.split()[1:6])
+				res.update(bc=bc, bc_bytes=bc_bytes, uc=uc, uc_bytes=uc_bytes,
+					ack=ack)
+	if dcs:
+		res["dc"] = sum(dcs) / len(dcs)
+	return res
+
+
+def run_point(args, firmware, template, seed, rdir):
+	# One Cooja run of a protocol on a topology with a given seed
+	os.makedirs(rdir, exist_ok=True)
+	csc = os.path.join(rdir, "bench.csc")
+	write_csc(args, template, firmware, seed, csc)
+	cmd = ["java", "-mx512m", "-jar",
+		os.path.join(args.contiki, "tools", "cooja", "dist", "cooja.jar"),
+		"-nogui=" + csc, "-contiki=" + args.contiki]
+	if not run_cmd(cmd, rdir, "run.log") or \
+			not os.path.exists(os.path.join(rdir, "bench_dc.log")):
+		return None
+	return parse_run(rdir, args.duration)
+
+
+def average(runs, key):
+	values = [r[key] for r in runs if r[key] == r[key]]
+	return sum(values) / len(values) if values else float("nan")
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__,
+		formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument("--csc", action="append", default=[],
+		help="topology template, can be repeated (default: "
+		"sched-collect-template/test_nogui_udgm.csc)")
+	parser.add_argument("-P", "--protocol", action="append", default=[],
+		choices=sorted(protocols), help="protocol to run (default: all)")
+	parser.add_argument("--seeds", type=int, default=3,
+		help="runs per protocol and topology, with seeds 1..N")
+	parser.add_argument("-d", "--duration", type=int, default=1800,
+		help="simulated seconds")
+	parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+		help="parallel builds/runs (default: all cores)")
+	parser.add_argument("--contiki", default=os.path.join(repo_dir, "..",
+		"contiki"), help="Contiki tree")
+	parser.add_argument("-w", "--workdir", default="bench",
+		help="directory for builds, logs and results")
+	parser.add_argument("-o", "--output", default=None,
+		help="results table (default: WORKDIR/benchmark-results.csv)")
+	args = parser.parse_args()
+
+	if args.duration <= TAIL:
+		parser.error("the duration must be longer than {} s".format(TAIL))
+	args.contiki = os.path.abspath(args.contiki)
+	args.workdir = os.path.abspath(args.workdir)
+	templates = [os.path.abspath(c) for c in args.csc] or \
+		[os.path.join(repo_dir, "sched-collect-template", "test_nogui_udgm.csc")]
+	names = args.protocol or list(protocols)
+	output = args.output or os.path.join(args.workdir,
+		"benchmark-results.csv")
+	os.makedirs(args.workdir, exist_ok=True)
+	print("{} protocols x {} topologies x {} seeds, {} jobs".format(
+		len(names), len(templates), args.seeds, args.jobs))
+
+	with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+		built = dict(zip(names, pool.map(lambda n: build_protocol(args, n),
+			names)))
+		for name, firmware in built.items():
+			if firmware is None:
+				print("Warning: build of {} failed, see {}/build/{}/build.log"
+					.format(name, args.workdir, name))
+		points = [(name, t, s) for t in templates for name in names
+			if built[name] for s in range(1, args.seeds + 1)]
+		results = list(pool.map(lambda p: run_point(args, built[p[0]], p[1],
+			p[2], os.path.join(args.workdir, "runs", p[0],
+			os.path.splitext(os.path.basename(p[1]))[0],
+			"seed-{}".format(p[2]))), points))
+
+	keys = ["sent", "recv", "pdr", "dc", "lat_mean", "lat_p95", "bc",
+		"bc_bytes", "uc", "uc_bytes", "ack"]
+	with open(output, "w") as f:
+		f.write("protocol\ttopology\tseed\t{}\n".format("\t".join(keys)))
+		for (name, t, seed), res in zip(points, results):
+			if res is None:
+				continue
+			f.write("{}\t{}\t{}\t{}\n".format(name,
+				os.path.basename(t), seed,
+				"\t".join("{:.3f}".format(res[k]) if isinstance(res[k], float)
+					else str(res[k]) for k in keys)))
+
+	# Side by side, per topology: averages over the seeds
+	failed = 0
+	for t in templates:
+		print("\n{}".format(os.path.basename(t)))
+		print("{:22s} {:>7s} {:>7s} {:>9s} {:>9s} {:>8s} {:>8s} {:>7s} {:>4s}"
+			.format("protocol", "PDR(%)", "DC(%)", "lat(ms)", "p95(ms)",
+			"ctrl", "data", "ctrl(%)", "runs"))
+		for name in names:
+			runs = [r for (n, tt, s), r in zip(points, results)
+				if n == name and tt == t and r is not None]
+			failed += sum(1 for (n, tt, s), r in zip(points, results)
+				if n == name and tt == t and r is None)
+			if not runs:
+				print("{:22s} {:>7s}".format(name, "-"))
+				continue
+			bc_bytes = average(runs, "bc_bytes")
+			uc_bytes = average(runs, "uc_bytes")
+			total = bc_bytes + uc_bytes
+			print("{:22s} {:7.2f} {:7.3f} {:9.1f} {:9.1f} {:8.0f} {:8.0f} "
+				"{:7.1f} {:4d}".format(name, average(runs, "pdr"),
+				average(runs, "dc"), average(runs, "lat_mean"),
+				average(runs, "lat_p95"), average(runs, "bc"),
+				average(runs, "uc"),
+				100.0 * bc_bytes / total if total else float("nan"), len(runs)))
+	if failed:
+		print("\nWarning: {} runs failed, see run.log in {}/runs".format(failed,
+			args.workdir))
+	print("Saving benchmark results in: {}".format(output))
+	return 0 if not failed and any(results) else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -7,17 +7,64 @@
 #include <stdio.h>
 #include "core/net/linkaddr.h"
 #include "my_collect.h"
+#if STORE_SEGMENTS > 0
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#endif
 /*---------------------------------------------------------------------------*/
-#define BEACON_INTERVAL (CLOCK_SECOND * 60)
-//#define BEACON_INTERVAL (CLOCK_SECOND * 5)
-#define BEACON_FORWARD_DELAY (random_rand() % CLOCK_SECOND)
+/* Beacons follow a Trickle timer (RFC 6206): the interval I starts at
+ * TRICKLE_IMIN and doubles up to TRICKLE_IMIN << TRICKLE_IMAX while the
+ * neighbourhood is consistent. A beacon is sent at a random point of the
+ * second half of I, unless TRICKLE_K consistent beacons were already heard
+ * in the interval. Any inconsistency brings I back to TRICKLE_IMIN.
+ * The sink starts a new seqn every SEQN_REFRESH_INTERVAL to flush stale
+ * routes (clock_time_t is 16 bits on Sky: keep both below 512 s). */
+#ifndef TRICKLE_IMIN
+#define TRICKLE_IMIN (CLOCK_SECOND)
+#endif
+#ifndef TRICKLE_IMAX
+#define TRICKLE_IMAX 7  /* doublings: I up to 128 s */
+#endif
+#ifndef TRICKLE_K
+#define TRICKLE_K 1
+#endif
+#ifndef SEQN_REFRESH_INTERVAL
+#define SEQN_REFRESH_INTERVAL (CLOCK_SECOND * 480)
+#endif
 /*---------------------------------------------------------------------------*/
 #define RSSI_THRESHOLD -95
 /*---------------------------------------------------------------------------*/
+/* ContikiMAC wake-up period, to predict when a forwarder is listening */
+#define ANYCAST_CYCLE (CLOCK_SECOND / NETSTACK_RDC_CHANNEL_CHECK_RATE)
+/*---------------------------------------------------------------------------*/
+/* Forwarding queue: a packet is tried on up to FWD_MAX_TX next hops. With
+ * CONGESTION_ON packets queued the node flags its beacons as congested,
+ * down to CONGESTION_OFF it clears the flag. While all the next hops are
+ * congested the queue is held for CONGESTION_BACKOFF */
+#ifndef FWD_MAX_TX
+#define FWD_MAX_TX 3
+#endif
+#ifndef CONGESTION_ON
+#define CONGESTION_ON (FWD_QUEUE_SIZE * 3 / 4)
+#endif
+#ifndef CONGESTION_OFF
+#define CONGESTION_OFF (FWD_QUEUE_SIZE / 4)
+#endif
+#define CONGESTION_BACKOFF (CLOCK_SECOND / 2 + random_rand() % (CLOCK_SECOND / 2))
+/*---------------------------------------------------------------------------*/
 /* Callback function declarations */
 void bc_recv(struct broadcast_conn *conn, const linkaddr_t *sender);
 void uc_recv(struct unicast_conn *c, const linkaddr_t *from);
+void uc_sent(struct unicast_conn *c, int status, int num_tx);
 void beacon_timer_cb(void* ptr);
+void trickle_interval_cb(void* ptr);
+void seqn_refresh_cb(void* ptr);
+void trickle_reset(struct my_collect_conn* conn);
+void send_beacon(struct my_collect_conn* conn);
+void queue_timer_cb(void* ptr);
+#if STORE_SEGMENTS > 0
+static void store_init(void);
+#endif
 /*---------------------------------------------------------------------------*/
 /* Rime Callback structures */
 struct broadcast_callbacks bc_cb = {
@@ -26,7 +73,7 @@ struct broadcast_callbacks bc_cb = {
 };
 struct unicast_callbacks uc_cb = {
   .recv = uc_recv,
-  .sent = NULL
+  .sent = uc_sent
 };
 /*---------------------------------------------------------------------------*/
 /*---------------------------------------------------------------------------*/
@@ -43,19 +90,431 @@ my_collect_open(struct my_collect_conn* conn, uint16_t channels,
   /* Initialize the connector structure */
   linkaddr_copy(&conn->parent, &linkaddr_null);
   conn->metric = 65535; /* The MAX metric (the node is not connected yet) */
-  conn->beacon_seqn = 1; //initial value from 1, when overflow occurs (0) we force flush everything
+  conn->beacon_seqn = 1; // seqns are compared modulo 2^16, see bc_recv
+  conn->trickle_i = 0; /* Trickle starts with the first route */
+  conn->fwd_count = 0;
+  conn->data_seqn = 0;
+  memset(conn->seen, 0, sizeof(conn->seen));
+  conn->seen_next = 0;
+  conn->queue_head = 0;
+  conn->queue_count = 0;
+  conn->queue_busy = 0;
+  conn->congested = 0;
+  conn->parent_congested = 0;
   conn->callbacks = callbacks;
+#if STORE_SEGMENTS > 0
+  if(!is_sink)
+    store_init();
+#endif
 
   /* Open the underlying Rime primitives */
   broadcast_open(&conn->bc, channels,     &bc_cb);
   unicast_open  (&conn->uc, channels + 1, &uc_cb);
 
-  /* TO DO 1: SINK
-   * 1. Make the sink send beacons periodically (BEACON_INTERVAL)
-   */
-  if(is_sink)
-    //ctimer_set(&conn->beacon_timer, BEACON_INTERVAL, beacon_timer_cb, (void*)conn);
-    ctimer_set(&conn->beacon_timer, CLOCK_SECOND* 5, beacon_timer_cb, (void*)conn);
+  /* The sink is the root of the tree: it runs Trickle from the start and
+   * periodically floods a new seqn */
+  if(is_sink) {
+    conn->metric = 0; // metric always 0 for sink
+    trickle_reset(conn);
+    ctimer_set(&conn->refresh_timer, SEQN_REFRESH_INTERVAL, seqn_refresh_cb, (void*)conn);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*                             Anycast Forwarders                            */
+/*---------------------------------------------------------------------------*/
+/* ContikiMAC strobes a unicast until the receiver wakes up and acks it.
+ * Instead of always waiting for the parent, a packet goes to the neighbour
+ * with a lower metric expected to wake up first: the forwarders are learned
+ * from the beacons, their phase from the time of the ack */
+/*---------------------------------------------------------------------------*/
+/* Remove a forwarder, e.g. after a missing ack */
+static void
+fwd_remove(struct my_collect_conn* conn, const linkaddr_t *addr)
+{
+  uint8_t i;
+
+  for (i = 0; i < conn->fwd_count; i++)
+  {
+    if (linkaddr_cmp (&conn->fwd[i].addr, addr))
+    {
+      conn->fwd[i] = conn->fwd[--conn->fwd_count];
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Drop the forwarders that are not closer to the sink than we are */
+static void
+fwd_prune(struct my_collect_conn* conn)
+{
+  uint8_t i = 0;
+
+  while (i < conn->fwd_count)
+  {
+    if (conn->fwd[i].metric >= conn->metric)
+      conn->fwd[i] = conn->fwd[--conn->fwd_count];
+    else
+      i++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Learn or refresh a forwarder from its beacon. When the table is full it
+ * replaces the one with the highest metric, if worse */
+static void
+fwd_update(struct my_collect_conn* conn, const linkaddr_t *addr, uint16_t metric,
+           bool congested)
+{
+  uint8_t i, worst = 0;
+
+  if (ANYCAST_CANDIDATES == 0)
+    return;
+  for (i = 0; i < conn->fwd_count; i++)
+  {
+    if (linkaddr_cmp (&conn->fwd[i].addr, addr))
+    {
+      conn->fwd[i].metric = metric;
+      conn->fwd[i].congested = congested;
+      return;
+    }
+    if (conn->fwd[i].metric > conn->fwd[worst].metric)
+      worst = i;
+  }
+  if (conn->fwd_count < ANYCAST_CANDIDATES)
+    i = conn->fwd_count++;
+  else if (metric < conn->fwd[worst].metric)
+    i = worst;
+  else
+    return;
+  linkaddr_copy (&conn->fwd[i].addr, addr);
+  conn->fwd[i].metric = metric;
+  conn->fwd[i].phase_known = 0;
+  conn->fwd[i].congested = congested;
+}
+/*---------------------------------------------------------------------------*/
+/* The ack of a forwarder was received now, right after it woke up */
+static void
+fwd_learn_phase(struct my_collect_conn* conn, const linkaddr_t *addr)
+{
+  uint8_t i;
+
+  for (i = 0; i < conn->fwd_count; i++)
+  {
+    if (linkaddr_cmp (&conn->fwd[i].addr, addr))
+    {
+      conn->fwd[i].phase = clock_time() % ANYCAST_CYCLE;
+      conn->fwd[i].phase_known = 1;
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Next hop for a data packet: the forwarder expected to wake up first,
+ * the parent if no forwarder is known. A forwarder with an unknown phase
+ * is expected half a cycle away, so it is tried and learned as well.
+ * Congested next hops are skipped: NULL if there is none left */
+static const linkaddr_t *
+fwd_next(struct my_collect_conn* conn)
+{
+  clock_time_t now = clock_time() % ANYCAST_CYCLE;
+  clock_time_t wait, best_wait = ANYCAST_CYCLE;
+  const linkaddr_t *next = &conn->parent;
+  uint8_t i;
+
+  if (conn->parent_congested || linkaddr_cmp (&conn->parent, &linkaddr_null))
+    next = NULL;
+  for (i = 0; i < conn->fwd_count; i++)
+  {
+    if (conn->fwd[i].congested)
+      continue;
+    if (conn->fwd[i].phase_known)
+      wait = (conn->fwd[i].phase + ANYCAST_CYCLE - now) % ANYCAST_CYCLE;
+    else
+      wait = ANYCAST_CYCLE / 2;
+    if (wait < best_wait)
+    {
+      best_wait = wait;
+      next = &conn->fwd[i].addr;
+    }
+  }
+  return next;
+}
+/*---------------------------------------------------------------------------*/
+/* Duplicate suppression: returns 1 if the packet was already received,
+ * otherwise remembers it */
+static bool
+dup_seen(struct my_collect_conn* conn, linkaddr_t source, uint8_t seqn)
+{
+  uint8_t i;
+
+  for (i = 0; i < DUP_CACHE; i++)
+  {
+    if (linkaddr_cmp (&conn->seen[i].source, &source) && conn->seen[i].seqn == seqn)
+      return 1;
+  }
+  linkaddr_copy (&conn->seen[conn->seen_next].source, &source);
+  conn->seen[conn->seen_next].seqn = seqn;
+  conn->seen_next = (conn->seen_next + 1) % DUP_CACHE;
+  return 0;
+}
+#if STORE_SEGMENTS > 0
+/*---------------------------------------------------------------------------*/
+/*                                Flash Store                                */
+/*---------------------------------------------------------------------------*/
+/* Own packets that cannot leave are appended to log segments on flash, in
+ * store_used segments from store_head on. Each record is a length byte and
+ * the packet (collect header included); reading resumes at store_rd_off of
+ * the head segment, writing at store_wr_off of the last one. Offsets are
+ * kept in RAM rather than using CFS_APPEND, as Coffee finds the end of a
+ * file by its last non-zero byte. The store is cleared at boot */
+static uint8_t store_head, store_used;
+static uint8_t store_records[STORE_SEGMENTS];
+static uint16_t store_rd_off, store_wr_off;
+static uint16_t store_count;
+/*---------------------------------------------------------------------------*/
+/* File name of a segment, valid until the next call */
+static const char *
+store_name(uint8_t seg)
+{
+  static char name[] = "mc_0";
+
+  name[3] = '0' + seg;
+  return name;
+}
+/*---------------------------------------------------------------------------*/
+/* Empty the store, removing the segments left by a previous run */
+static void
+store_init(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < STORE_SEGMENTS; i++)
+  {
+    cfs_remove (store_name (i));
+    store_records[i] = 0;
+  }
+  store_head = 0;
+  store_used = 0;
+  store_rd_off = 0;
+  store_wr_off = 0;
+  store_count = 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Drop the head segment, with the records still in it */
+static void
+store_drop_head(void)
+{
+  cfs_remove (store_name (store_head));
+  store_count -= store_records[store_head];
+  store_records[store_head] = 0;
+  store_head = (store_head + 1) % STORE_SEGMENTS;
+  store_used--;
+  store_rd_off = 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Append the packet in the packetbuf to the store. Returns zero if the
+ * store is full, the packet too long or the flash fails */
+static int
+store_append(void)
+{
+  uint8_t data[FWD_PACKET_SIZE];
+  uint8_t len, tail;
+  int fd, ok;
+
+  if (packetbuf_totlen() > FWD_PACKET_SIZE)
+    return 0;
+  len = packetbuf_copyto (data);
+  if (store_used == 0 || store_wr_off + 1 + len > STORE_SEGMENT_SIZE)
+  {
+    if (store_used == STORE_SEGMENTS)
+    {
+      printf ("my_collect: store full, packet dropped\n");
+      return 0;
+    }
+    /* Start a new segment, reserved at once so that it is contiguous */
+    tail = (store_head + store_used) % STORE_SEGMENTS;
+    cfs_remove (store_name (tail));
+    if (cfs_coffee_reserve (store_name (tail), STORE_SEGMENT_SIZE) < 0)
+    {
+      printf ("my_collect: store segment %u not reserved\n", tail);
+      return 0;
+    }
+    store_used++;
+    store_wr_off = 0;
+  }
+  tail = (store_head + store_used - 1) % STORE_SEGMENTS;
+  fd = cfs_open (store_name (tail), CFS_WRITE);
+  if (fd < 0)
+    return 0;
+  ok = cfs_seek (fd, store_wr_off, CFS_SEEK_SET) == store_wr_off &&
+       cfs_write (fd, &len, 1) == 1 && cfs_write (fd, data, len) == len;
+  cfs_close (fd);
+  if (!ok)
+  {
+    /* Close the segment: the records before the failed one stay readable */
+    store_wr_off = STORE_SEGMENT_SIZE;
+    return 0;
+  }
+  store_wr_off += 1 + len;
+  store_records[tail]++;
+  store_count++;
+  printf ("my_collect: stored, %u packets in store\n", store_count);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Take the oldest packet out of the store into data (FWD_PACKET_SIZE
+ * bytes). Returns its length, zero if none could be read: a segment that
+ * cannot be read is dropped as a whole */
+static uint8_t
+store_read(uint8_t *data)
+{
+  uint8_t len = 0;
+  int fd;
+
+  while (store_used > 0 && store_records[store_head] == 0)
+    store_drop_head ();
+  if (store_used == 0)
+    return 0;
+  fd = cfs_open (store_name (store_head), CFS_READ);
+  if (fd < 0 || cfs_seek (fd, store_rd_off, CFS_SEEK_SET) != store_rd_off ||
+      cfs_read (fd, &len, 1) != 1 || len == 0 || len > FWD_PACKET_SIZE ||
+      cfs_read (fd, data, len) != len)
+  {
+    printf ("my_collect: store segment %u unreadable, dropping %u packets\n",
+            store_head, store_records[store_head]);
+    if (fd >= 0)
+      cfs_close (fd);
+    store_drop_head ();
+    return 0;
+  }
+  cfs_close (fd);
+  store_rd_off += 1 + len;
+  store_records[store_head]--;
+  store_count--;
+  if (store_records[store_head] == 0)
+    store_drop_head ();
+  return len;
+}
+#endif /* STORE_SEGMENTS > 0 */
+/*---------------------------------------------------------------------------*/
+/*                              Forwarding Queue                             */
+/*---------------------------------------------------------------------------*/
+/* Own and forwarded packets are sent one at a time: the next one leaves
+ * from the unicast sent callback, so nothing is lost while the MAC is busy
+ * with a strobe. A full queue drops new packets, a long one is advertised
+ * in the beacons to make the children hold theirs (backpressure) */
+/*---------------------------------------------------------------------------*/
+/* Update the congestion flag, with hysteresis. A change is new information
+ * for the neighbours: beacon at once and reset Trickle */
+static void
+congestion_update(struct my_collect_conn* conn)
+{
+  bool congested = conn->congested ? conn->queue_count > CONGESTION_OFF :
+                                     conn->queue_count >= CONGESTION_ON;
+
+  if (congested == conn->congested)
+    return;
+  conn->congested = congested;
+  printf ("my_collect: %s (queue %u)\n",
+          congested ? "congested" : "congestion cleared", conn->queue_count);
+  send_beacon (conn);
+  trickle_reset (conn);
+}
+/*---------------------------------------------------------------------------*/
+/* Drop the head of the queue, sent or not */
+static void
+queue_pop(struct my_collect_conn* conn)
+{
+  conn->queue_head = (conn->queue_head + 1) % FWD_QUEUE_SIZE;
+  conn->queue_count--;
+  congestion_update (conn);
+}
+/*---------------------------------------------------------------------------*/
+#if STORE_SEGMENTS > 0
+/* With a route, move stored packets to the queue while it is short: the
+ * backlog drains behind the forwarded traffic, without congesting us */
+static void
+queue_refill(struct my_collect_conn* conn)
+{
+  struct my_collect_queued *q;
+  uint8_t len;
+
+  if (fwd_next (conn) == NULL)
+    return;
+  while (store_count && conn->queue_count < CONGESTION_OFF)
+  {
+    q = &conn->queue[(conn->queue_head + conn->queue_count) % FWD_QUEUE_SIZE];
+    len = store_read (q->data);
+    if (len == 0)
+      continue; /* unreadable segment dropped, try the next one */
+    q->len = len;
+    q->tx = 0;
+    conn->queue_count++;
+  }
+}
+#endif
+/*---------------------------------------------------------------------------*/
+/* Hand the head of the queue to the MAC, unless it is busy with the
+ * previous one. Without a parent, the beacon that brings a route calls
+ * this again; while the next hops are all congested, retry later */
+static void
+queue_send(struct my_collect_conn* conn)
+{
+  struct my_collect_queued *q;
+  const linkaddr_t *next;
+
+#if STORE_SEGMENTS > 0
+  queue_refill (conn);
+#endif
+  while (!conn->queue_busy && conn->queue_count)
+  {
+    next = fwd_next (conn);
+    if (next == NULL)
+    {
+      if (linkaddr_cmp (&conn->parent, &linkaddr_null))
+        return;
+      if (ctimer_expired (&conn->queue_timer))
+        ctimer_set (&conn->queue_timer, CONGESTION_BACKOFF, queue_timer_cb, (void*)conn);
+      return;
+    }
+    q = &conn->queue[conn->queue_head];
+    packetbuf_clear ();
+    packetbuf_copyfrom (q->data, q->len);
+    q->tx++;
+    /* Busy before the send: the MAC may report a failure from inside it */
+    conn->queue_busy = 1;
+    if (unicast_send (&conn->uc, next))
+      return;
+    conn->queue_busy = 0;
+    printf ("my_collect: unicast failed, packet dropped\n");
+    queue_pop (conn);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+queue_timer_cb(void* ptr)
+{
+  queue_send ((struct my_collect_conn*) ptr);
+}
+/*---------------------------------------------------------------------------*/
+/* Append the packet in the packetbuf (collect header included) to the
+ * queue. Returns zero if the queue is full or the packet too long */
+static int
+queue_push(struct my_collect_conn* conn)
+{
+  struct my_collect_queued *q;
+
+  if (conn->queue_count == FWD_QUEUE_SIZE || packetbuf_totlen() > FWD_PACKET_SIZE)
+  {
+    printf ("my_collect: queue full, packet dropped\n");
+    return 0;
+  }
+  q = &conn->queue[(conn->queue_head + conn->queue_count) % FWD_QUEUE_SIZE];
+  q->len = packetbuf_copyto (q->data);
+  q->tx = 0;
+  conn->queue_count++;
+  congestion_update (conn);
+  queue_send (conn);
+  return 1;
 }
 /*---------------------------------------------------------------------------*/
 /*                              Beacon Handling                              */
@@ -64,42 +523,87 @@ my_collect_open(struct my_collect_conn* conn, uint16_t channels,
 struct beacon_msg {
   uint16_t seqn;
   uint16_t metric;
+  uint8_t flags;
 } __attribute__((packed));
+#define BEACON_FLAG_CONGESTED 0x01
 /*---------------------------------------------------------------------------*/
-/* Send beacon using the current seqn and metric */
+/* Send beacon using the current seqn and metric. A node that lost its
+ * parent advertises the MAX metric, so that its children look for another
+ * route and its neighbours answer with their own beacon */
 void
 send_beacon(struct my_collect_conn* conn)
 {
   struct beacon_msg beacon = {
-    .seqn = conn->beacon_seqn, .metric = conn->metric};
+    .seqn = conn->beacon_seqn, .metric = conn->metric,
+    .flags = conn->congested ? BEACON_FLAG_CONGESTED : 0};
+
+  if (conn->metric && linkaddr_cmp (&conn->parent, &linkaddr_null))
+    beacon.metric = 65535;
 
   packetbuf_clear();
   packetbuf_copyfrom(&beacon, sizeof(beacon));
-  printf("my_collect: sending beacon: seqn %d metric %d\n",
-    conn->beacon_seqn, conn->metric);
+  printf("my_collect: sending beacon: seqn %u metric %u I %u\n",
+    beacon.seqn, beacon.metric, (unsigned)conn->trickle_i);
   broadcast_send(&conn->bc);
 }
 
-void beacon_forward_timer_cb (void* ptr)
+/*---------------------------------------------------------------------------*/
+/* Start a new Trickle interval of length conn->trickle_i: pick the
+ * transmission point t in [I/2, I) and clear the consistency counter */
+static void
+trickle_start_interval(struct my_collect_conn* conn)
 {
-  struct my_collect_conn* conn = (struct my_collect_conn* ) ptr;
-  send_beacon (conn);
+  clock_time_t half = conn->trickle_i / 2;
+
+  conn->trickle_c = 0;
+  ctimer_set(&conn->beacon_timer, half + random_rand() % half, beacon_timer_cb, (void*)conn);
+  ctimer_set(&conn->interval_timer, conn->trickle_i, trickle_interval_cb, (void*)conn);
 }
 /*---------------------------------------------------------------------------*/
-/* Beacon timer callback */
+/* Inconsistency: restart Trickle from TRICKLE_IMIN, unless it is already
+ * running with the minimum interval */
+void
+trickle_reset(struct my_collect_conn* conn)
+{
+  if (conn->trickle_i != TRICKLE_IMIN)
+  {
+    conn->trickle_i = TRICKLE_IMIN;
+    trickle_start_interval (conn);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Beacon timer callback: Trickle transmission point */
 void
 beacon_timer_cb(void* ptr)
 {
-  /* TO DO 2: Implement the beacon callback
-   * 1. Send beacon
-   * 2. Should the sink do anything else?
-   */
   struct my_collect_conn* conn = (struct my_collect_conn* ) ptr;
-  conn->metric = 0; // metric always 0 for sink
-  send_beacon (conn);
+
+  if (conn->trickle_c < TRICKLE_K)
+    send_beacon (conn);
+  else
+    printf ("my_collect: beacon suppressed (heard %u)\n", conn->trickle_c);
+}
+/*---------------------------------------------------------------------------*/
+/* End of the Trickle interval: double it up to the maximum */
+void
+trickle_interval_cb(void* ptr)
+{
+  struct my_collect_conn* conn = (struct my_collect_conn* ) ptr;
+
+  if (conn->trickle_i < (TRICKLE_IMIN << TRICKLE_IMAX))
+    conn->trickle_i *= 2;
+  trickle_start_interval (conn);
+}
+/*---------------------------------------------------------------------------*/
+/* Sink: flood a new seqn so that every node recomputes its route */
+void
+seqn_refresh_cb(void* ptr)
+{
+  struct my_collect_conn* conn = (struct my_collect_conn* ) ptr;
+
   conn->beacon_seqn++;
-  //ctimer_reset(&conn->beacon_timer);
-  ctimer_set(&conn->beacon_timer, BEACON_INTERVAL, beacon_timer_cb, (void*)conn);
+  trickle_reset (conn);
+  ctimer_reset (&conn->refresh_timer);
 }
 /*---------------------------------------------------------------------------*/
 /* Beacon receive callback */
@@ -109,15 +613,12 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
   struct beacon_msg beacon;
   int16_t rssi;
   bool flag_propogate = 0;
+  bool consistent = 0;
+  bool new_seqn;
   /* Get the pointer to the overall structure my_collect_conn from its field bc */
   struct my_collect_conn* conn = (struct my_collect_conn*)(((uint8_t*)bc_conn) - 
     offsetof(struct my_collect_conn, bc));
 
-  if(linkaddr_cmp(&sink_node, &linkaddr_node_addr)) {
-    /* No need to service broadcast receive for sink node!*/
-    return;
-  }
-
   if (packetbuf_datalen() != sizeof(struct beacon_msg)) {
     printf("my_collect: broadcast of wrong size\n");
     return;
@@ -128,25 +629,60 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
       sender->u8[0], sender->u8[1], 
       beacon.seqn, beacon.metric, rssi);
 
+  if (rssi < RSSI_THRESHOLD)
+    return;
+
+  if(linkaddr_cmp(&sink_node, &linkaddr_node_addr)) {
+    /* After a reboot the network is ahead of the sink: jump past its seqn,
+     * or the nodes ignore the sink's floods as stale */
+    if ((int16_t)(beacon.seqn - conn->beacon_seqn) > 0)
+    {
+      printf ("my_collect: sink seqn %u behind the network, now %u\n",
+        conn->beacon_seqn, (uint16_t)(beacon.seqn + 1));
+      conn->beacon_seqn = beacon.seqn + 1;
+      trickle_reset (conn);
+      return;
+    }
+    /* The sink only keeps its Trickle timer going: a neighbour with an old
+     * seqn or without a route needs to hear from it soon */
+    if ((beacon.seqn == conn->beacon_seqn) && (beacon.metric <= 1))
+      conn->trickle_c++;
+    else
+      trickle_reset (conn);
+    return;
+  }
+
+  new_seqn = (int16_t)(beacon.seqn - conn->beacon_seqn) > 0;
+
   /* TO DO 3:
    * 1. Analyze the received beacon based on RSSI, seqn, and metric.
    * 2. Update (if needed) the local/node current routing info (parent, metric).
+   * Seqns are compared modulo 2^16, so the flush also works across a wrap.
    */
-  if (rssi >= RSSI_THRESHOLD)
   {
-    if (((0 == beacon.seqn) && (0 != conn->beacon_seqn)) ||
-             (beacon.seqn > conn->beacon_seqn) )
+    if (new_seqn)
     {
       //flush everything right away! data needs to be refreshed!
       flag_propogate = 1;
       printf ("Sequence number flush happened! \n");
       
     }
+    else if ((beacon.seqn == conn->beacon_seqn) &&
+             linkaddr_cmp (&conn->parent, sender) &&
+             (beacon.metric + 1 != conn->metric))
+    {
+      /* Our parent changed its route (or lost it): follow it */
+      flag_propogate = 1;
+      printf ("Parent metric changed! (%02x:%02x metric %u )\n",
+      sender->u8[0], sender->u8[1], 
+      beacon.metric);
+    }
     else if ((beacon.seqn == conn->beacon_seqn) && (beacon.metric < conn->metric))
     {
       if ((beacon.metric == conn->metric - 1) && !(linkaddr_cmp (&conn->parent, &linkaddr_null)))
       {
         flag_propogate = 0;
+        consistent = 1;
         printf ("SAME METRIC DIFFERENT PARENT ALERT!! nothing happened! (%02x:%02x metric %u )\n",
         sender->u8[0], sender->u8[1], 
         beacon.metric);
@@ -164,26 +700,59 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
     else
     {
       flag_propogate = 0;
+      /* Siblings and children agree with us; a neighbour with an old seqn or
+       * that would be better off through us does not */
+      consistent = (beacon.seqn == conn->beacon_seqn) &&
+                   (beacon.metric <= conn->metric + 1);
       printf ("same metric (sibblings) or lower metric (parent) or lower seqn .. nothing happened! \n");
     }
 
   }
 
   /* TO DO 4:
-   * If the metric or the seqn has been updated, retransmit the beacon to update
-   * the node neighbors about the changes
+   * If the metric or the seqn has been updated, reset Trickle to tell the
+   * node neighbors about the changes. A parent with the MAX metric has no
+   * route: keep our metric as a bound, so that only a node closer to the
+   * sink than we were (not one of our children) becomes the new parent
    */
 
   if (flag_propogate)
   {
-    ctimer_set(&conn->beacon_timer, BEACON_FORWARD_DELAY, beacon_forward_timer_cb, (void*) conn);
-    conn->metric = beacon.metric + 1;
+    if (beacon.metric == 65535)
+    {
+      if (beacon.seqn != conn->beacon_seqn)
+        conn->metric = 65535; /* no bound from an older seqn */
+      linkaddr_copy (&conn->parent, &linkaddr_null);
+      printf ("my_collect: parent lost its route\n");
+    }
+    else
+    {
+      conn->metric = beacon.metric + 1;
+      conn->parent.u8[0] = sender->u8[0];
+      conn->parent.u8[1] = sender->u8[1]; 
+    }
     conn->beacon_seqn = beacon.seqn;
-    conn->parent.u8[0] = sender->u8[0];
-    conn->parent.u8[1] = sender->u8[1]; 
+    trickle_reset (conn);
   }
+  else if (consistent)
+    conn->trickle_c++;
+  else if (conn->trickle_i)
+    trickle_reset (conn);
+
+  /* Keep the anycast forwarders in line with the beacons heard */
+  if (new_seqn)
+    conn->fwd_count = 0;
+  if ((beacon.seqn == conn->beacon_seqn) && (beacon.metric < conn->metric))
+    fwd_update (conn, sender, beacon.metric,
+                beacon.flags & BEACON_FLAG_CONGESTED);
+  else
+    fwd_remove (conn, sender);
+  fwd_prune (conn);
 
-  
+  /* Backpressure: hold the queue while the parent is congested */
+  if (linkaddr_cmp (&conn->parent, sender))
+    conn->parent_congested = beacon.flags & BEACON_FLAG_CONGESTED;
+  queue_send (conn);
 }
 /*---------------------------------------------------------------------------*/
 /*                               Data Handling                               */
@@ -192,17 +761,20 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
 struct collect_header {
   linkaddr_t source;
   uint8_t hops;
+  uint8_t seqn;   /* per source, for duplicate suppression */
 } __attribute__((packed));
 /*---------------------------------------------------------------------------*/
 /* Data Collection: send function */
 int
 my_collect_send(struct my_collect_conn *conn)
 {
-  struct collect_header hdr = {.source=linkaddr_node_addr, .hops=0};
+  struct collect_header hdr = {.source=linkaddr_node_addr, .hops=0,
+    .seqn=conn->data_seqn++};
   int ret;
 
-  if (linkaddr_cmp(&conn->parent, &linkaddr_null))
-    return 0; // no parent
+  /* Without a parent the packet waits in the queue (see queue_send()),
+   * or on flash with STORE_SEGMENTS, until a beacon gives the node a route
+   * again */
 
   /* TO DO 5:
    * 1. Allocate space for the data collection header 
@@ -217,7 +789,18 @@ my_collect_send(struct my_collect_conn *conn)
     return ret;
   }
   memcpy(packetbuf_hdrptr(), &hdr, sizeof(struct collect_header));
-  ret = unicast_send (&conn->uc, &conn->parent);
+#if STORE_SEGMENTS > 0
+  /* Behind older stored packets, without a route or with a long queue,
+   * the packet goes to flash and leaves in order from queue_refill() */
+  if (store_count || linkaddr_cmp (&conn->parent, &linkaddr_null) ||
+      conn->queue_count >= CONGESTION_ON)
+  {
+    ret = store_append ();
+    queue_send (conn);
+    return ret;
+  }
+#endif
+  ret = queue_push (conn);
   return ret;
 }
 
@@ -245,6 +828,14 @@ uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
   memcpy(&hdr, packetbuf_dataptr(), sizeof(struct collect_header));
   printf ("my_collect source|%02x:%02x hop|%d\n", hdr.source.u8[0],
                    hdr.source.u8[1], hdr.hops);
+
+  /* A forwarder may get a packet twice, e.g. when its ack was lost */
+  if (dup_seen (conn, hdr.source, hdr.seqn))
+  {
+    printf ("my_collect: duplicate from %02x:%02x seqn %u dropped\n",
+            hdr.source.u8[0], hdr.source.u8[1], hdr.seqn);
+    return;
+  }
  
   if (linkaddr_cmp (&sink_node, &linkaddr_node_addr))
   {
@@ -254,10 +845,73 @@ uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
   }
   else
   {
+    if (linkaddr_cmp(&conn->parent, &linkaddr_null))
+      return; // no parent, the route is being repaired
     hdr.hops += 1;
     memcpy(packetbuf_dataptr(), &hdr, sizeof(struct collect_header));
-    unicast_send (&conn->uc, &conn->parent);
+    queue_push (conn);
   }
 }
 /*---------------------------------------------------------------------------*/
+/* A forwarder that does not ack any more is forgotten. If it was the
+ * parent, the best remaining forwarder takes its place; without one the
+ * parent is lost: the node keeps its metric as a bound for the next parent
+ * and resets Trickle, so that the MAX metric it now advertises triggers
+ * the repair */
+static void
+fwd_lost(struct my_collect_conn* conn, const linkaddr_t *to, int num_tx)
+{
+  uint8_t i, best = 0;
+
+  fwd_remove (conn, to);
+  if (!linkaddr_cmp(&conn->parent, to))
+    return;
+  if (conn->fwd_count)
+  {
+    for (i = 1; i < conn->fwd_count; i++)
+    {
+      if (conn->fwd[i].metric < conn->fwd[best].metric)
+        best = i;
+    }
+    printf ("my_collect: parent %02x:%02x lost, switching to %02x:%02x\n",
+            to->u8[0], to->u8[1],
+            conn->fwd[best].addr.u8[0], conn->fwd[best].addr.u8[1]);
+    linkaddr_copy (&conn->parent, &conn->fwd[best].addr);
+    conn->metric = conn->fwd[best].metric + 1;
+    conn->parent_congested = conn->fwd[best].congested;
+    fwd_prune (conn);
+    trickle_reset (conn);
+    return;
+  }
+  printf ("my_collect: lost parent %02x:%02x after %d tx\n",
+          conn->parent.u8[0], conn->parent.u8[1], num_tx);
+  linkaddr_copy (&conn->parent, &linkaddr_null);
+  trickle_reset (conn);
+}
+/*---------------------------------------------------------------------------*/
+/* Data sent callback: an ack gives the wake-up phase of the forwarder.
+ * The head of the queue is released once acked or tried FWD_MAX_TX times,
+ * otherwise it is retried on the next hop now expected first, and the next
+ * packet is handed to the MAC */
+void
+uc_sent(struct unicast_conn *uc_conn, int status, int num_tx)
+{
+  struct my_collect_conn* conn = (struct my_collect_conn*)(((uint8_t*)uc_conn) - 
+    offsetof(struct my_collect_conn, uc));
+  linkaddr_t to;
+
+  linkaddr_copy (&to, packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
+  if (status == MAC_TX_OK)
+    fwd_learn_phase (conn, &to);
+  else if (status == MAC_TX_NOACK)
+    fwd_lost (conn, &to, num_tx);
+
+  if (!conn->queue_busy)
+    return;
+  conn->queue_busy = 0;
+  if (status == MAC_TX_OK || conn->queue[conn->queue_head].tx >= FWD_MAX_TX)
+    queue_pop (conn);
+  queue_send (conn);
+}
+/*---------------------------------------------------------------------------*/
 
@@ -7,20 +7,83 @@
 #include "net/netstack.h"
 #include "core/net/linkaddr.h"
 /*---------------------------------------------------------------------------*/
+/* Anycast forwarding: up to ANYCAST_CANDIDATES neighbours with a lower
+ * metric are kept as next hops, 0 always sends to the parent.
+ * DUP_CACHE packets are remembered to drop duplicates */
+#ifndef ANYCAST_CANDIDATES
+#define ANYCAST_CANDIDATES 3
+#endif
+#ifndef DUP_CACHE
+#define DUP_CACHE 8
+#endif
+/* Forwarding queue: own and forwarded packets of up to FWD_PACKET_SIZE
+ * bytes (collect header included) wait here for their turn */
+#ifndef FWD_QUEUE_SIZE
+#define FWD_QUEUE_SIZE 8
+#endif
+#ifndef FWD_PACKET_SIZE
+#define FWD_PACKET_SIZE 32
+#endif
+/* Store and forward: with STORE_SEGMENTS > 0 (up to 10; it also enables
+ * Coffee, see project-conf.h) the node's own packets that find no parent or
+ * a congested queue are appended to log segments of STORE_SEGMENT_SIZE
+ * bytes on flash, and drained oldest first once a route is back */
+#ifndef STORE_SEGMENTS
+#define STORE_SEGMENTS 0
+#endif
+#ifndef STORE_SEGMENT_SIZE
+#define STORE_SEGMENT_SIZE 1024
+#endif
+/*---------------------------------------------------------------------------*/
 /* Callback structure */
 struct my_collect_callbacks {
   void (* recv)(const linkaddr_t *originator, uint8_t hops);
 };
 /*---------------------------------------------------------------------------*/
+/* Anycast next hop and its ContikiMAC wake-up phase */
+struct my_collect_fwd {
+  linkaddr_t addr;
+  uint16_t metric;
+  clock_time_t phase;
+  bool phase_known;
+  bool congested;
+};
+/*---------------------------------------------------------------------------*/
+/* Packet in the forwarding queue */
+struct my_collect_queued {
+  uint8_t len;
+  uint8_t tx;                   /* transmissions so far */
+  uint8_t data[FWD_PACKET_SIZE];
+};
+/*---------------------------------------------------------------------------*/
 /* Connection object */
 struct my_collect_conn {
   struct broadcast_conn bc;
   struct unicast_conn uc;
   const struct my_collect_callbacks* callbacks;
   linkaddr_t parent;
-  struct ctimer beacon_timer;
+  struct ctimer beacon_timer;   /* Trickle: transmission point of the interval */
+  struct ctimer interval_timer; /* Trickle: end of the interval */
+  struct ctimer refresh_timer;  /* sink: new seqn every SEQN_REFRESH_INTERVAL */
+  clock_time_t trickle_i;       /* current interval, 0 until the first route */
+  uint8_t trickle_c;            /* consistent beacons heard in the interval */
   uint16_t metric;
-  uint16_t beacon_seqn : 3;
+  uint16_t beacon_seqn;
+  struct my_collect_fwd fwd[ANYCAST_CANDIDATES + 1];
+  uint8_t fwd_count;
+  uint8_t data_seqn;            /* seqn of the packets generated here */
+  struct {
+    linkaddr_t source;
+    uint8_t seqn;
+  } seen[DUP_CACHE];            /* last packets received, for duplicates */
+  uint8_t seen_next;
+  struct my_collect_queued queue[FWD_QUEUE_SIZE];
+  uint8_t queue_head;
+  uint8_t queue_count;
+  bool queue_busy;              /* head handed to the MAC */
+  struct ctimer queue_timer;    /* backoff while no next hop can take it */
+  bool congested;               /* advertised in our beacons */
+  bool parent_congested;
 };
 /*---------------------------------------------------------------------------*/
 /* Initialize a collect connection 
@@ -35,7 +98,9 @@ void my_collect_open(
     bool is_sink,
     const struct my_collect_callbacks *callbacks);
 /*---------------------------------------------------------------------------*/
-/* Send packet to the sink */
+/* Send packet to the sink. Returns zero if the forwarding queue (or the
+ * store, with STORE_SEGMENTS) is full; while the node has no parent,
+ * packets are kept until a beacon gives it a route again */
 int  my_collect_send(struct my_collect_conn *c);
 /*---------------------------------------------------------------------------*/
 #endif /* __MY_COLLECT_H__ */
@@ -18,13 +18,23 @@
 
 #define CC2538_RF_CONF_CHANNEL        26
 
+/* Coffee is only needed by the store-and-forward queue of my_collect.c
+ * (make EXTRA_DEFINES="STORE_SEGMENTS=4"), on the platform's flash size */
+#if !defined(STORE_SEGMENTS) || STORE_SEGMENTS == 0
 #define COFFEE_CONF_SIZE              0
+#endif
 
 #define LPM_CONF_MAX_PM               LPM_PM0
 /*---------------------------------------------------------------------------*/
 #undef NETSTACK_CONF_RDC
+/* The RDC can be chosen from the build, e.g.
+ * make EXTRA_DEFINES=COLLECT_CONF_RDC=nullrdc_driver */
+#ifdef COLLECT_CONF_RDC
+#define NETSTACK_CONF_RDC		COLLECT_CONF_RDC
+#else
 //#define NETSTACK_CONF_RDC		nullrdc_driver
 #define NETSTACK_CONF_RDC		contikimac_driver
+#endif
 /*---------------------------------------------------------------------------*/
 #endif /* PROJECT_CONF_H_ */
 /*---------------------------------------------------------------------------*/
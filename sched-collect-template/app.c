@@ -23,19 +23,41 @@ typedef struct {
 }
 __attribute__((packed))
 test_msg_t;
+/* Urgent alarms, on average every APP_ALARM_PERIOD ticks (0: none), are
+ * told apart by APP_ALARM_FLAG in their seqn */
+#ifndef APP_ALARM_PERIOD
+#define APP_ALARM_PERIOD 0
+#endif
+#define APP_ALARM_FLAG 0x8000
+/* Size of the periodic records, written in place into the slot buffer:
+ * the seqn and then padding, standing for larger sensor readings */
+#ifndef APP_PAYLOAD
+#define APP_PAYLOAD sizeof(test_msg_t)
+#endif
+/* Periodic records are queued when sched_collect wakes up for the epoch
+ * (active callback); the epoch timer, longer by APP_ACTIVE_GUARD, is only a
+ * fallback for a node that is not synchronised */
+#define APP_ACTIVE_GUARD CLOCK_SECOND
 /*---------------------------------------------------------------------------*/
 PROCESS(app_process, "App process");
 AUTOSTART_PROCESSES(&app_process);
 /*---------------------------------------------------------------------------*/
 static struct sched_collect_conn sched_collect;
 static void recv_cb(const linkaddr_t *originator, uint8_t hops);
-struct sched_collect_callbacks cb = {.recv = recv_cb};
+static void active_cb(void);
+struct sched_collect_callbacks cb = {.recv = recv_cb, .active = active_cb};
+static bool active;
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(app_process, ev, data)
 {
   static struct etimer et;
   static test_msg_t msg = {.seqn=0};
   static int ret = 0;
+  static uint8_t *buf;
+#if APP_ALARM_PERIOD
+  static struct etimer alarm;
+  static test_msg_t alarm_msg = {.seqn=0};
+#endif
 
   PROCESS_BEGIN();
   printf("CLOCK_SECOND: %lu\n", CLOCK_SECOND);
@@ -56,21 +78,61 @@ PROCESS_THREAD(app_process, ev, data)
   else {
     printf("App: I am normal node %02x:%02x with node_id %u\n",
       linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], node_id);
-    sched_collect_open(&sched_collect, COLLECT_CHANNEL, false, NULL);
+    sched_collect_open(&sched_collect, COLLECT_CHANNEL, false, &cb);
 
-    etimer_set(&et, EPOCH_DURATION);
+#if APP_ALARM_PERIOD
+    etimer_set(&alarm, random_rand() % APP_ALARM_PERIOD);
+#endif
     while(1) {
       /* Set data packet to be sent in the data collection time window */
-      ret = sched_collect_send(&sched_collect, (uint8_t *) &msg, sizeof(msg));
+      buf = sched_collect_reserve(&sched_collect, APP_PAYLOAD);
+      ret = 0;
+      if (buf != NULL) {
+        memcpy(buf, &msg, sizeof(msg));
+        memset(buf + sizeof(msg), 0, APP_PAYLOAD - sizeof(msg));
+        ret = sched_collect_commit(&sched_collect, APP_PAYLOAD);
+      }
       if (ret != 0)
         printf("App: Send seqn %d\n", msg.seqn);
       else
         printf("App: packet with seqn %d could not be scheduled.\n",
           msg.seqn);
       msg.seqn++;
-      /* Reset timer */
-      PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-      etimer_reset(&et);
+      /* Once synchronised, the timer is re-armed by every active callback */
+      if (active) {
+        etimer_set(&et, EPOCH_DURATION + APP_ACTIVE_GUARD);
+      }
+      else {
+        etimer_set(&et, EPOCH_DURATION);
+      }
+      active = false;
+#if APP_ALARM_PERIOD
+      /* Raise alarms with urgent priority until the next periodic packet */
+      while(1) {
+        PROCESS_WAIT_EVENT_UNTIL(active || etimer_expired(&et) ||
+          etimer_expired(&alarm));
+        if(!etimer_expired(&alarm)) {
+          break;
+        }
+        alarm_msg.seqn |= APP_ALARM_FLAG;
+        ret = sched_collect_send_prio(&sched_collect, (uint8_t *) &alarm_msg,
+          sizeof(alarm_msg), SCHED_COLLECT_PRIO_URGENT);
+        alarm_msg.seqn &= ~APP_ALARM_FLAG;
+        if (ret != 0)
+          printf("App: Alarm seqn %d\n", alarm_msg.seqn);
+        else
+          printf("App: alarm with seqn %d could not be scheduled.\n",
+            alarm_msg.seqn);
+        alarm_msg.seqn = (alarm_msg.seqn + 1) & ~APP_ALARM_FLAG;
+        etimer_set(&alarm, APP_ALARM_PERIOD / 2 + random_rand() % APP_ALARM_PERIOD);
+        if(active || etimer_expired(&et)) {
+          break;
+        }
+      }
+#else
+      /* Wait for the next epoch */
+      PROCESS_WAIT_EVENT_UNTIL(active || etimer_expired(&et));
+#endif
     }
   }
   PROCESS_END();
@@ -80,12 +142,24 @@ static void
 recv_cb(const linkaddr_t *originator, uint8_t hops)
 {
   test_msg_t msg;
-  if (packetbuf_datalen() != sizeof(msg)) {
+  if (packetbuf_datalen() < sizeof(msg)) {
     printf("App: wrong length: %d\n", packetbuf_datalen());
     return;
   }
   memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+  if (msg.seqn & APP_ALARM_FLAG) {
+    printf("App: Recv alarm from %02x:%02x seqn %d hops %d\n",
+      originator->u8[0], originator->u8[1], msg.seqn & ~APP_ALARM_FLAG, hops);
+    return;
+  }
   printf("App: Recv from %02x:%02x seqn %d hops %d\n",
     originator->u8[0], originator->u8[1], msg.seqn, hops);
 }
 /*---------------------------------------------------------------------------*/
+static void
+active_cb(void)
+{
+  active = true;
+  process_poll(&app_process);
+}
+/*---------------------------------------------------------------------------*/
@@ -3,6 +3,7 @@ from __future__ import division
 
 import re
 import sys
+import bisect
 import os.path
 import argparse
 import numpy as np
@@ -26,6 +27,41 @@ addr_id_map = {
 	"f2:48": 73, "f3:db": 74, "f3:fa": 75, "f3:83": 76, "f2:b4": 77
 }
 
+# Phases of the sched_collect epoch (SCHED_COLLECT_PHASE_* in sched_collect.h)
+phase_names = {0: "idle", 1: "sync", 2: "collect", 3: "off"}
+
+# EPOCH_DURATION of sched_collect, epoch length when the log has no beacons
+epoch_ms = 30000
+
+
+def time_to_ms(ts):
+	# Testbed: POSIX seconds; Cooja: "[H:]MM:SS.mmm" or plain microseconds
+	if isinstance(ts, float):
+		return int(round(ts * 1000))
+	ts = str(ts)
+	if ':' not in ts and '.' not in ts:
+		return int(ts) // 1000
+	parts = ts.split(':')
+	secs = 0
+	for p in parts[:-1]:
+		secs = (secs + int(p)) * 60
+	return int(round((secs + float(parts[-1])) * 1000))
+
+
+def addr_to_id(addr, testbed):
+	if testbed:
+		return addr_id_map.get(addr, 0)
+	# Cooja node N has address N & 0xff : N >> 8
+	a, b = addr.split(':')
+	return int(a, 16) | (int(b, 16) << 8)
+
+
+def correlation(x, y):
+	# Pearson correlation, nan with fewer than three points or no variance
+	if len(x) < 3 or np.std(x) == 0 or np.std(y) == 0:
+		return np.nan
+	return np.corrcoef(x, y)[0, 1]
+
 
 def compute_node_pdr(fsent, frecv):
 	# Read CSV files with dataframes
@@ -127,6 +163,207 @@ def compute_node_duty_cycle(fenergest):
 		float_format='%.3f', na_rep='nan')
 
 
+def compute_phase_duty_cycle(fphase):
+	# Read CSV file with dataframe
+	df = pd.read_csv(fphase, sep='\t')
+	if df.empty:
+		return
+
+	# Discard first two Energest reports and the sink (always on)
+	df = df[(df.cnt >= 2) & (df.node > 1)].copy()
+	df['time'] = df.cpu + df.lpm
+	df['radio'] = df.tx + df.rx
+
+	# Create new df to store the results
+	resdf = pd.DataFrame(columns=['node', 'phase', 'time', 'dc', 'contrib',
+		'radio_share'])
+
+	# Share of every phase in the node time and radio-on time
+	print("\n----- Per-phase Duty Cycle -----")
+	for node in sorted(df.node.unique()):
+		ndf = df[df.node == node]
+		node_time = ndf.time.sum()
+		node_radio = ndf.radio.sum()
+		for phase in sorted(ndf.phase.unique()):
+			pdf = ndf[ndf.phase == phase]
+			time = pdf.time.sum()
+			radio = pdf.radio.sum()
+			row = [node, phase_names.get(phase, str(phase)),
+				100 * time / node_time,
+				100 * radio / time if time else np.nan,
+				100 * radio / node_time,
+				100 * radio / node_radio if node_radio else np.nan]
+			print("Node: {} Phase: {:8s} Time: {:.3f}% Duty Cycle: {:.3f}% "
+				"Contribution: {:.3f}%".format(*row[:5]))
+			resdf.loc[len(resdf.index)] = row
+
+	print("\n----- Per-phase Duty Cycle Stats -----")
+	for phase, pdf in resdf.groupby('phase', sort=False):
+		print("Phase: {:8s} Time: {:.3f}% Duty Cycle: {:.3f}% "
+			"Contribution: {:.3f}% Radio-on share: {:.3f}%".format(phase,
+			pdf.time.mean(), pdf.dc.mean(), pdf.contrib.mean(),
+			pdf.radio_share.mean()))
+
+	# Save per-phase dataframe to a CSV file
+	fpath = os.path.dirname(fphase)
+	fname_common = os.path.splitext(os.path.basename(fphase))[0]
+	fname_common = fname_common.replace('-energest-phase', '')
+	fdc_name = os.path.join(fpath, "{}-phase-dc.csv".format(fname_common))
+	print("Saving per-phase Duty Cycle CSV file in: {}".format(fdc_name))
+	resdf.to_csv(fdc_name, sep='\t', index=False,
+		float_format='%.3f', na_rep='nan')
+
+
+def compute_relay_load(froute, fsent, frecv, fdc):
+	# Read CSV files with dataframes
+	rdf = pd.read_csv(froute, sep='\t')
+	if rdf[rdf.kind != 'beacon'].empty:
+		return
+	sdf = pd.read_csv(fsent, sep='\t')
+	vdf = pd.read_csv(frecv, sep='\t')
+	dcdf = pd.read_csv(fdc, sep='\t')
+	dc = dict(zip(dcdf.node, dcdf.dc))
+	rdf['ms'] = [time_to_ms(t) for t in rdf.time]
+	sdf['ms'] = [time_to_ms(t) for t in sdf.time_sent]
+	vdf['ms'] = [time_to_ms(t) for t in vdf.time_recv]
+
+	# Epochs start at the sink's beacons, or every epoch_ms without them
+	starts = sorted(rdf[(rdf.kind == 'beacon') & (rdf.node == sink_id)].ms)
+	obs = rdf[rdf.kind != 'beacon'].sort_values('ms', kind='mergesort')
+	t0 = min(obs.ms.min(), sdf.ms.min() if not sdf.empty else obs.ms.min())
+
+	def epoch_of(t):
+		if not starts:
+			return max(0, (t - t0) // epoch_ms)
+		return max(0, bisect.bisect_right(starts, t) - 1)
+
+	# With Route: records a node without one in the epoch is out of the
+	# tree, with parent switches only the parents persist
+	expire = (obs.kind == 'route').any()
+
+	# A packet belongs to the epoch of the first Route: record of its
+	# source after it was sent (the collection phase it was sent in)
+	route_at = {}
+	for r in obs[obs.kind == 'route'].itertuples():
+		route_at.setdefault(r.node, []).append(r.ms)
+
+	def packet_epoch(src, t):
+		times = route_at.get(src, [])
+		i = bisect.bisect_left(times, t)
+		return epoch_of(times[i] if i < len(times) else t)
+
+	# Unique packets: [src, received, sent, hops, epoch]
+	packets = {}
+	for r in vdf.itertuples():
+		key = (r.src, r.dest, r.seqn)
+		if key not in packets:
+			packets[key] = [r.src, True, False, r.hops, packet_epoch(r.src, r.ms)]
+	for r in sdf[sdf.status != 0].itertuples():
+		p = packets.setdefault((r.src, r.dest, r.seqn), [r.src, False, False, 0, 0])
+		if not p[2]:
+			p[2] = True
+			p[4] = packet_epoch(r.src, r.ms)
+	by_epoch = {}
+	for p in packets.values():
+		by_epoch.setdefault(p[4], []).append(p)
+	epochs = max(max(by_epoch.keys()) + 1, epoch_of(obs.ms.max()) + 1)
+
+	def ancestors(parent, n):
+		# Ancestors of n below the sink, None if the chain does not reach it
+		path = []
+		a = parent.get(n, 0)
+		while a != sink_id:
+			if a == 0 or a == n or len(path) > len(parent):
+				return None
+			path.append(a)
+			a = parent.get(a, 0)
+		return path
+
+	# Per node: epochs, subtree sum and max, forwarded, sent, lost
+	tot = {}
+	parent = {}
+	npackets = attributed = hops_match = 0
+	obs_list = list(obs.itertuples())
+	nxt = 0
+	for e in range(epochs):
+		if expire:
+			parent = {}
+		while nxt < len(obs_list) and epoch_of(obs_list[nxt].ms) <= e:
+			parent[obs_list[nxt].node] = obs_list[nxt].parent
+			nxt += 1
+		subtree = {}
+		for n in parent:
+			path = ancestors(parent, n) if n != sink_id and parent[n] else None
+			if path is None:
+				continue
+			tot.setdefault(n, [0, 0, 0, 0, 0, 0])[0] += 1
+			for a in path:
+				subtree[a] = subtree.get(a, 0) + 1
+		for n, t in tot.items():
+			t[1] += subtree.get(n, 0)
+			t[2] = max(t[2], subtree.get(n, 0))
+		for src, received, sent, hops, _ in by_epoch.get(e, []):
+			path = ancestors(parent, src) if src != sink_id else None
+			if received:
+				npackets += 1
+				if path is not None:
+					attributed += 1
+					hops_match += hops == len(path)
+			if path is None:
+				continue
+			for a in path:
+				t = tot.setdefault(a, [0, 0, 0, 0, 0, 0])
+				t[3] += received
+				t[4] += sent
+				t[5] += sent and not received
+
+	# Create new df to store the results
+	resdf = pd.DataFrame(columns=['node', 'epochs', 'subtree', 'subtree_max',
+		'forwarded', 'fwd_per_epoch', 'subtree_sent', 'subtree_lost',
+		'subtree_pdr', 'dc'])
+	for n in sorted(tot):
+		t = tot[n]
+		if t[0] == 0:
+			continue
+		resdf.loc[len(resdf.index)] = [n, t[0], t[1] / t[0], t[2], t[3],
+			t[3] / t[0], t[4], t[5],
+			100 * (t[4] - t[5]) / t[4] if t[4] else np.nan, dc.get(n, np.nan)]
+
+	print("\n----- Relay Load -----")
+	print("Epochs: {} Packets routed through the tree: {}/{} "
+		"Hop counts matching the tree: {:.1f}%".format(epochs, attributed,
+		npackets, 100 * hops_match / attributed if attributed else np.nan))
+	relays = resdf[resdf.subtree_max > 0]
+	for r in relays.itertuples():
+		print("Node: {} Epochs: {} Subtree: {:.2f} (max {}) Forwarded: {} "
+			"Forwarded/epoch: {:.2f} Subtree PDR: {:.3f}% Duty Cycle: {:.3f}%".format(
+			int(r.node), int(r.epochs), r.subtree, int(r.subtree_max),
+			int(r.forwarded), r.fwd_per_epoch, r.subtree_pdr, r.dc))
+	withdc = resdf[resdf.dc.notna()]
+	loaded = relays[relays.subtree_sent > 0]
+	print("Correlation of forwarded load with duty cycle (all nodes): {:.3f}".format(
+		correlation(list(withdc.fwd_per_epoch), list(withdc.dc))))
+	print("Correlation of forwarded load with subtree loss (relays): {:.3f}".format(
+		correlation(list(loaded.fwd_per_epoch), list(100 - loaded.subtree_pdr))))
+
+	# Most loaded relays, then highest duty cycle
+	print("\n----- Hotspot Relays -----")
+	hot = relays.sort_values(['fwd_per_epoch', 'dc'], ascending=False)
+	for r in hot.head(5).itertuples():
+		print("Node: {} Forwarded/epoch: {:.2f} Subtree: {:.2f} (max {}) "
+			"Subtree PDR: {:.3f}% Duty Cycle: {:.3f}%".format(int(r.node),
+			r.fwd_per_epoch, r.subtree, int(r.subtree_max), r.subtree_pdr, r.dc))
+
+	# Save relay load dataframe to a CSV file
+	fpath = os.path.dirname(froute)
+	fname_common = os.path.splitext(os.path.basename(froute))[0]
+	fname_common = fname_common.replace('-route', '')
+	frelay_name = os.path.join(fpath, "{}-relay.csv".format(fname_common))
+	print("Saving relay load CSV file in: {}".format(frelay_name))
+	resdf.to_csv(frelay_name, sep='\t', index=False,
+		float_format='%.3f', na_rep='nan')
+
+
 def parse_file(log_file, testbed=False):
 	# Print some basic information for the user
 	print(f"Logfile: {log_file}")
@@ -138,14 +375,21 @@ def parse_file(log_file, testbed=False):
 	frecv_name = os.path.join(fpath, f"{fname_common}-recv.csv")
 	fsent_name = os.path.join(fpath, f"{fname_common}-sent.csv")
 	fenergest_name = os.path.join(fpath, f"{fname_common}-energest.csv")
+	fphase_name = os.path.join(fpath, f"{fname_common}-energest-phase.csv")
+	froute_name = os.path.join(fpath, f"{fname_common}-route.csv")
+	fdc_name = os.path.join(fpath, f"{fname_common}-dc.csv")
 	frecv = open(frecv_name, 'w')
 	fsent = open(fsent_name, 'w')
 	fenergest = open(fenergest_name, 'w')
+	fphase = open(fphase_name, 'w')
+	froute = open(froute_name, 'w')
 
 	# Write CSV headers
 	frecv.write("time_recv\tdest\tsrc\tseqn\thops\n")
 	fsent.write("time_sent\tdest\tsrc\tseqn\tstatus\n")
 	fenergest.write("time\tnode\tcnt\tcpu\tlpm\ttx\trx\n")
+	fphase.write("time\tnode\tcnt\tphase\tcpu\tlpm\ttx\trx\n")
+	froute.write("time\tnode\tparent\tkind\n")
 
 	if testbed:
 		# Regex for testbed experiments
@@ -160,6 +404,17 @@ def parse_file(log_file, testbed=False):
 			r"be scheduled\.'".format(testbed_record_pattern))
 		regex_dc = re.compile(r"{}'Energest: (?P<cnt>\d+) (?P<cpu>\d+) "
 			r"(?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)'".format(testbed_record_pattern))
+		regex_phase = re.compile(r"{}'Energest-phase: (?P<cnt>\d+) (?P<phase>\d+) "
+			r"(?P<cpu>\d+) (?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)'".format(
+			testbed_record_pattern))
+		regex_beacon = re.compile(r"{}'Sync: B \d+'".format(
+			testbed_record_pattern))
+		regex_route = re.compile(r"{}'Route: \d+ (?P<parent>\w+:\w+)'".format(
+			testbed_record_pattern))
+		regex_switch = re.compile(r"{}'(?:(?:sched|my)_collect: parent \w+:\w+ "
+			r"(?:failed|lost), switching to |Metric number flush happened!, "
+			r"new parent selection \()(?P<parent>\w+:\w+)".format(
+			testbed_record_pattern))
 	else:
 		# Regular expressions --- different for COOJA w/o GUI
 		record_pattern = r"(?P<time>[\w:.]+)\s+ID:(?P<self_id>\d+)\s+"
@@ -173,6 +428,16 @@ def parse_file(log_file, testbed=False):
 			r"be scheduled\.".format(record_pattern))
 		regex_dc = re.compile(r"{}Energest: (?P<cnt>\d+) (?P<cpu>\d+) "
 			r"(?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)".format(record_pattern))
+		regex_phase = re.compile(r"{}Energest-phase: (?P<cnt>\d+) (?P<phase>\d+) "
+			r"(?P<cpu>\d+) (?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)".format(
+			record_pattern))
+		regex_beacon = re.compile(r"{}Sync: B \d+".format(record_pattern))
+		regex_route = re.compile(r"{}Route: \d+ (?P<parent>\w+:\w+)".format(
+			record_pattern))
+		regex_switch = re.compile(r"{}(?:(?:sched_collect: )?Metric number flush "
+			r"happened!, new parent selection \(|(?:sched|my)_collect: parent "
+			r"\w+:\w+ (?:failed|lost), switching to )(?P<parent>\w+:\w+)".format(
+			record_pattern))
 
 	# Node list and dictionaries for later processing
 	nodes = []
@@ -271,11 +536,46 @@ def parse_file(log_file, testbed=False):
 				# Write to CSV file
 				fenergest.write("{}\t{}\t{}\t{}\t{}\t{}\t{}\n".format(ts, 
 					d['self_id'], d['cnt'], d['cpu'], d['lpm'], d['tx'], d['rx']))
+				continue
+
+			# Energest per epoch phase
+			m = regex_phase.match(line)
+			if m:
+				d = m.groupdict()
+				if testbed:
+					ts = datetime.strptime(d["time"], '%Y-%m-%d %H:%M:%S,%f')
+					ts = ts.timestamp()
+				else:
+					ts = d["time"]
+				# Write to CSV file
+				fphase.write("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n".format(ts,
+					d['self_id'], d['cnt'], d['phase'], d['cpu'], d['lpm'],
+					d['tx'], d['rx']))
+				continue
+
+			# Routing: epoch starts, parents and parent switches
+			for regex, kind in ((regex_beacon, 'beacon'), (regex_route, 'route'),
+					(regex_switch, 'switch')):
+				m = regex.match(line)
+				if m:
+					break
+			if m:
+				d = m.groupdict()
+				if testbed:
+					ts = datetime.strptime(d["time"], '%Y-%m-%d %H:%M:%S,%f')
+					ts = ts.timestamp()
+				else:
+					ts = d["time"]
+				parent = addr_to_id(d["parent"], testbed) if "parent" in d else 0
+				froute.write("{}\t{}\t{}\t{}\n".format(ts, d['self_id'], parent,
+					kind))
 
 	# Close files
 	frecv.close()
 	fsent.close()
 	fenergest.close()
+	fphase.close()
+	froute.close()
 
 	# Nodes that did not manage to send data
 	fails = []
@@ -297,6 +597,12 @@ def parse_file(log_file, testbed=False):
 	# Compute node duty cycle
 	compute_node_duty_cycle(fenergest_name)
 
+	# Compute per-phase duty cycle (sched_collect epoch phases)
+	compute_phase_duty_cycle(fphase_name)
+
+	# Rebuild the routing tree per epoch and compute the relay load
+	compute_relay_load(froute_name, fsent_name, frecv_name, fdc_name)
+
 
 def parse_args():
 	parser = argparse.ArgumentParser()
@@ -18,9 +18,19 @@
 
 #define CC2538_RF_CONF_CHANNEL        26
 
+/* Coffee is only needed by the store-and-forward queue of sched_collect.c
+ * (make EXTRA_DEFINES="STORE_SEGMENTS=4"), on the platform's flash size */
+#if !defined(STORE_SEGMENTS) || STORE_SEGMENTS == 0
 #define COFFEE_CONF_SIZE              0
+#endif
 
-#define LPM_CONF_MAX_PM               LPM_PM0
+/* Security (SCHED_COLLECT_CONF_SEC_MIC_LEN > 0) needs the network key, shared
+ * by all nodes and kept out of the repository, e.g.
+ * #define SCHED_COLLECT_SEC_KEY { 0x.., ... } (16 bytes) */
+
+/* Firefly: sleep in PM2 (32 kHz sleep timer, RAM retained) when idle; the
+ * radio and UART hold the CPU in PM0 while in use */
+#define LPM_CONF_MAX_PM               LPM_PM2
 /*---------------------------------------------------------------------------*/
 #undef NETSTACK_CONF_RDC
 #define NETSTACK_CONF_RDC nullrdc_driver
@@ -26,82 +26,453 @@
 #include <stdlib.h>
 #include "core/net/linkaddr.h"
 #include "node-id.h"
+#include "simple-energest.h"
 #include "sched_collect.h"
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#include "lib/ccm-star.h"
 /*---------------------------------------------------------------------------*/
+/* The timing constants below can be overridden from the build
+ * (make EXTRA_DEFINES="DELAY_CEIL=300 GUARD_TIME=-40"), see sweep.py */
+#ifndef RSSI_THRESHOLD
 #define RSSI_THRESHOLD -91 // filter bad links
+#endif
 /*---------------------------------------------------------------------------*/
 
 /*
  * DELAY_CEIL is the maximum delay allowed before propogating a beacon. and 
  * BEACON_FORWARD_DELAY is the random delay within the DELAY_CEIL
  */
+#ifndef DELAY_CEIL
 #define DELAY_CEIL 350
+#endif
 #define BEACON_FORWARD_DELAY (random_rand() % DELAY_CEIL)
 
 /*
+ * The processing and transmission delays below are measured at runtime by
+ * timestamping the node's own receive and send paths, and smoothed (see
+ * delay_est_update()), so that they follow the platform, the clock settings
+ * and the amount of logging:
+ *
  * PREPROCESSING_DELAY is the delay caused by pre-processing steps in bc_recv()
  * before arming the beacon_timer and POSTPROCESSING_DELAY is the time taken
- * after the beacon_forward_timer_cb() is called (and before broadcast send)
+ * after the beacon_forward_timer_cb() is called (and before broadcast send).
+ *
+ * BEACON_HOP_DELAY is the time from stamping the delay of a beacon to the end
+ * of its transmission (broadcast sent callback). Each node adds its own to the
+ * delay it sends, so that the receivers' epoch start accounts for every hop.
  */
-#define POSTPROCESSING_DELAY 10
-#define PREPROCESSING_DELAY 16
+#define POSTPROCESSING_DELAY DELAY_EST(est_post)
+#define PREPROCESSING_DELAY DELAY_EST(est_pre)
+#define BEACON_HOP_DELAY DELAY_EST(est_bc_hop)
 
 /*
  * MAX_UNICST_PROCESSING_DELAY is the maximum time required for a unicast 
  * packet from the farthest end (max. hop count) to reach the sink node,
- * after all the processing and transmisions. '6' is the time spend in
- * the uc_recv() callback.
+ * after all the processing and transmisions. uc_hop_delay is the time per
+ * hop: every node measures its own, from the reception (or the hand-off of
+ * its own packet) to the MAC ack. Data headers carry the largest one along
+ * the path, the sink smooths them and announces the result in its beacons,
+ * so that all nodes size the slots alike. Until then UNICAST_HOP_DELAY,
+ * measured on Cooja Sky, is used.
+ */
+#ifndef UNICAST_HOP_DELAY
+#define UNICAST_HOP_DELAY 6
+#endif
+#define MAX_UNICST_PROCESSING_DELAY ((MAX_HOPS)*uc_hop_delay)
+
+/*
+ * Delay estimates are kept in 1/16 ticks and smoothed with weight
+ * 1/DELAY_EST_WEIGHT; samples above DELAY_CEIL (e.g. a delayed timer) are
+ * discarded.
+ */
+#define DELAY_EST_WEIGHT 8
+#define DELAY_EST(est) (((est) + 8) / 16)
+
+/*
+ * Slots of the collection window are handed out by the sink at runtime, in
+ * the order it first hears the nodes: slot_count slots are assigned (cells
+ * with SLOT_REUSE, see below), a node without a slot (SLOT_NONE) joins by
+ * sending in one of the JOIN_SLOTS contention slots that follow them. Each beacon announces at most
+ * SLOT_ASSIGN_MAX assignments not yet used by their nodes.
+ */
+#define SLOT_NONE 0xffff
+#ifndef JOIN_SLOTS
+#define JOIN_SLOTS 8
+#endif
+#ifndef SLOT_ASSIGN_MAX
+#define SLOT_ASSIGN_MAX 16
+#endif
+
+/*
+ * Selective retransmission: nodes keep their last RTX_BUF packets, the
+ * sink advertises the missing ones of up to NACK_MAX sources per beacon
+ * (a bitmap of the NACK_WINDOW sequence numbers before the last one
+ * received) and a node resends at most RTX_PER_SLOT of them in its slot.
+ * The slot has room for them: SLOT_HOPS hop delays, and the frames queued
+ * after the node's packet reach the sink one hop delay apart, so a node
+ * metric hops away sends at most SLOT_HOPS - metric of them and none spills
+ * into the next slot.
+ */
+#ifndef RTX_BUF
+#define RTX_BUF 4
+#endif
+#ifndef NACK_MAX
+#define NACK_MAX 6
+#endif
+#ifndef RTX_PER_SLOT
+#define RTX_PER_SLOT 1
+#endif
+#define NACK_WINDOW 8
+
+/*
+ * Urgent packets (SCHED_COLLECT_PRIO_URGENT) skip the regular buffer: they
+ * go out in the node's slot, in one of the URGENT_SLOTS contention slots
+ * closing the collection window, or between epochs. After the radio is
+ * turned off, all nodes listen for URGENT_WAKEUP_LISTEN ticks every
+ * URGENT_WAKEUP_PERIOD (0 disables the wake-ups); the windows are aligned
+ * by the time-sync, and a node sends its urgent packet URGENT_WAKEUP_GUARD
+ * ticks into the window so that its parent is already listening. Relays
+ * forward it right away, within the same window.
+ */
+#ifndef URGENT_SLOTS
+#define URGENT_SLOTS 4
+#endif
+#ifndef URGENT_WAKEUP_PERIOD
+#define URGENT_WAKEUP_PERIOD CLOCK_SECOND
+#endif
+#ifndef URGENT_WAKEUP_GUARD
+#define URGENT_WAKEUP_GUARD 8
+#endif
+#ifndef URGENT_WAKEUP_LISTEN
+#define URGENT_WAKEUP_LISTEN (2 * URGENT_WAKEUP_GUARD + MAX_UNICST_PROCESSING_DELAY)
+#endif
+
+/*
+ * Failover: besides the parent, a node ranks up to PARENTS_MAX alternate
+ * parents heard in the beacons of the current epoch, lower metric first and
+ * then stronger RSSI. Only neighbours closer to the sink are used, so that
+ * failovers cannot create loops. A copy of the last TX_INFLIGHT unicasts is kept until
+ * the MAC reports their outcome: a packet not acknowledged by the parent
+ * is resent to the best alternate, which becomes the parent until the next
+ * beacon.
  */
-#define MAX_UNICST_PROCESSING_DELAY ((MAX_HOPS)*6)
+#ifndef PARENTS_MAX
+#define PARENTS_MAX 3
+#endif
+#ifndef TX_INFLIGHT
+#define TX_INFLIGHT 6
+#endif
+/* Room for a full frame: collect header, telemetry, record and security */
+#define TX_COPY_SIZE (6 + 15 + SCHED_COLLECT_MAX_PAYLOAD + SCHED_COLLECT_SEC_OVERHEAD)
+
+/*
+ * Security (SCHED_COLLECT_SEC_MIC_LEN > 0, see sched_collect.h): beacons
+ * are sealed hop by hop, their seqn authenticated and the rest encrypted;
+ * data is sealed end to end by the source, its source, flags and seqn
+ * authenticated (relays change the other header fields) and the payload
+ * encrypted, and only the sink opens it. The nonce is made of the sender,
+ * the epoch (beacon_seqn), a counter of the frames it sealed in the epoch
+ * and the frame kind. Sealing and opening run inside the intervals the
+ * delay estimates measure, so they are part of the beacon and data hop
+ * delays; the sink also adds its own opening time to the slot hop delay.
+ * The sink drops data sealed more than SEC_EPOCH_WINDOW epochs ago.
+ */
+#if SCHED_COLLECT_SEC_MIC_LEN && !defined(SCHED_COLLECT_SEC_KEY)
+#error "SCHED_COLLECT_SEC_KEY (16 bytes) must be set with security, e.g. in project-conf.h"
+#endif
+#ifndef SEC_EPOCH_WINDOW
+#define SEC_EPOCH_WINDOW 8
+#endif
+#define SEC_KIND_BEACON 1
+#define SEC_KIND_DATA   2
+
+/*
+ * Deep idle: with DEEP_IDLE, nothing of the node wakes the CPU between the
+ * radio turned off and on again but the urgent wake-up windows. The energest
+ * report is deferred to the next wake-up (simple_energest_quiet()) and the
+ * application is told to queue its packet when the radio is turned on
+ * (the active callback) instead of using a timer of its own.
+ */
+#ifndef DEEP_IDLE
+#define DEEP_IDLE 1
+#endif
+
+/*
+ * Store and forward: with STORE_SEGMENTS > 0 (up to 10; it also enables
+ * Coffee, see project-conf.h), a packet still waiting for its slot when the
+ * next one is queued, because the node missed the beacon or has no parent,
+ * is appended to a log segment on flash instead of being rejected. Segments
+ * of STORE_SEGMENT_SIZE bytes are filled in order, drained oldest first and
+ * removed once empty. Stored packets use the slot room left by the NACKed
+ * retransmissions (RTX_PER_SLOT), so the backlog drains at a bounded rate
+ * over the epochs after the outage. The store is cleared at boot.
+ */
+#ifndef STORE_SEGMENTS
+#define STORE_SEGMENTS 0
+#endif
+#ifndef STORE_SEGMENT_SIZE
+#define STORE_SEGMENT_SIZE 1024
+#endif
+
+/*
+ * Spatial slot reuse: with SLOT_REUSE, the assigned part of the window is
+ * made of cells of one hop (SLOT_LENGTH) instead of slots of MAX_HOPS hops,
+ * and a packet takes the cells of its own hops only. Nodes report their
+ * cell, parents and the beacon senders heard in the last NBR_AGE epochs (up
+ * to NBR_MAX) when they gain one, and every NBR_REFRESH_EPOCHS epochs. From
+ * them the sink knows which nodes may relay the packet of a source at each
+ * hop, whatever parent they pick in the epoch, and places the sources, deepest
+ * first, at the earliest cell where each hop is more than two hops away
+ * from the hops already placed within SLOT_REUSE_SPREAD cells. The window
+ * then grows with the depth and the density of the network, bounded by one
+ * cell per packet at the sink, instead of MAX_HOPS cells per node. Sources
+ * not reported yet get MAX_HOPS cells of their own. A cell carries a single
+ * packet: the sources NACKed in the beacon resend in the RTX_SLOTS slots of
+ * MAX_HOPS hops that follow the cells, in the order of the NACKs, and
+ * stored packets go in the join slots. The cells are never more than the
+ * exclusive slots, which the sink falls back to. It pays off on deep
+ * networks with reliable links: on lossy ones the retries of concurrent
+ * cells inflate the hop delay the window is sized with.
+ */
+#ifndef SLOT_REUSE
+#define SLOT_REUSE 0
+#endif
+#ifndef SLOT_CELL_GUARD
+#define SLOT_CELL_GUARD 1
+#endif
+#ifndef SLOT_REUSE_SPREAD
+#define SLOT_REUSE_SPREAD 1
+#endif
+#ifndef NBR_MAX
+#define NBR_MAX 12
+#endif
+#if NBR_MAX > 16
+#error "NBR_MAX must be at most 16 (the parents of a report are a 16-bit mask)"
+#endif
+#ifndef NBR_AGE
+#define NBR_AGE 8
+#endif
+#ifndef NBR_REFRESH_EPOCHS
+#define NBR_REFRESH_EPOCHS 20
+#endif
+/* SLOT_HOPS: the hop delays of the slots the NACKed packets are resent in,
+ * after the node's own packet without SLOT_REUSE */
+#if SLOT_REUSE
+#define SLOT_LENGTH (uc_hop_delay + SLOT_CELL_GUARD)
+#define SLOT_HOPS MAX_HOPS
+#else
+#define SLOT_HOPS (MAX_HOPS + RTX_PER_SLOT)
+#define SLOT_LENGTH (SLOT_HOPS * uc_hop_delay)
+#endif
 
 /*
  * COLLECTION_SEQUENCE_DELAY is the time each non-sink node have to wait
  * (after the time-sync phase) before sendin the scheduled unicast packet .
  */
-#define COLLECTION_SEQUENCE_DELAY (node_id-2)* MAX_UNICST_PROCESSING_DELAY
+#if SLOT_REUSE
+#define RTX_SLOTS fwd_nnack
+#else
+#define RTX_SLOTS 0
+#endif
+#define RTX_SLOTS_START (slot_count * SLOT_LENGTH)
+#define JOIN_SLOTS_START (RTX_SLOTS_START + RTX_SLOTS * MAX_UNICST_PROCESSING_DELAY)
+#define COLLECTION_SEQUENCE_DELAY ((my_slot != SLOT_NONE) ? my_slot * SLOT_LENGTH : \
+  JOIN_SLOTS_START + (random_rand() % JOIN_SLOTS) * MAX_UNICST_PROCESSING_DELAY)
 
 
 /*
  * RADIO_TURN_OFF_DELAY is the time each non-sink node have to wait
  * (after the time-sync phase) before turning the radio-off .
  */
+#ifndef GREEN_LED_GUARD
 #define GREEN_LED_GUARD 200
-#define RADIO_TURN_OFF_DELAY (MAX_NODES * MAX_UNICST_PROCESSING_DELAY + GREEN_LED_GUARD)
+#endif
+#define URGENT_SLOTS_START (JOIN_SLOTS_START + JOIN_SLOTS * MAX_UNICST_PROCESSING_DELAY)
+#define RADIO_TURN_OFF_DELAY (URGENT_SLOTS_START + URGENT_SLOTS * MAX_UNICST_PROCESSING_DELAY + GREEN_LED_GUARD)
 
 /*
  * DATACOLLECTION_COMMON_GREEN_START_DELAY is the time each non-sink node have to wait
  * (after forwarding a beacon) before entering into the data-collection phase .
  */
+#ifndef BLUE_LED_GUARD
 #define BLUE_LED_GUARD 200
-#define DATACOLLECTION_COMMON_GREEN_START_DELAY  (((MAX_HOPS-1)*DELAY_CEIL + BLUE_LED_GUARD) - bc_recv_delay) - bc_recv_metric
+#endif
+#define DATACOLLECTION_COMMON_GREEN_START_DELAY  (((MAX_HOPS-1)*DELAY_CEIL + BLUE_LED_GUARD) - bc_recv_delay)
 
 
 /*
  * RADIO_TURN_ON_DELAY is the time each non-sink node have to wait
  * (after the RADIO_OFF phase) before turning the radio-on again .
  */
+#ifndef GUARD_TIME
 #ifdef CONTIKI_TARGET_SKY
 #define GUARD_TIME -50 //cooja
 #else
 #define GUARD_TIME 0 // This value needs to be optimised for testbed
 #endif
-#define RADIO_TURN_ON_DELAY (EPOCH_DURATION - (RADIO_TURN_OFF_DELAY + DATACOLLECTION_COMMON_GREEN_START_DELAY + (bc_recv_delay+bc_recv_metric))) + GUARD_TIME
+#endif
+#define RADIO_TURN_ON_DELAY (EPOCH_DURATION - (RADIO_TURN_OFF_DELAY + DATACOLLECTION_COMMON_GREEN_START_DELAY + bc_recv_delay)) + GUARD_TIME
+
+/*
+ * TELEMETRY_EPOCHS is the number of epochs between two telemetry reports
+ * appended by a node to its data packet (0 disables telemetry).
+ */
+#ifndef TELEMETRY_EPOCHS
+#define TELEMETRY_EPOCHS 10
+#endif
 
 /*---------------------------------------------------------------------------*/
 /* Callback function declarations */
 void bc_recv(struct broadcast_conn *conn, const linkaddr_t *sender);
 void uc_recv(struct unicast_conn *c, const linkaddr_t *from);
+void uc_sent(struct unicast_conn *c, int status, int num_tx);
+void bc_sent(struct broadcast_conn *c, int status, int num_tx);
 void beacon_timer_cb(void* ptr);
+static void urgent_send(struct sched_collect_conn *conn);
+static void rtx_send_more(struct sched_collect_conn *conn, uint8_t queued);
+#if SLOT_REUSE
+static bool rtx_pending(void);
+static void rtx_send_cb(void *ptr);
+static void slot_schedule(void);
+#endif
+static void urgent_send_cb(void *ptr);
+static void urgent_wakeup_cb(void *ptr);
 /*---------------------------------------------------------------------------*/
 /* The static variabes  used for time-stamp, calculating delay, rssi etc.*/
 static linkaddr_t sink_node;
 static clock_time_t bc_recv_ts_t1, bc_recv_ts_t2,
  bc_recv_ts_tforward, bc_recv_delay, bc_recv_ts_t1_temp, temp;
-static uint8_t *buffer;
+/* Node: the packet for the next slot is written in place into
+ * rtx[rtx_next]; reserved_len bytes of it are handed out to the app until
+ * the commit, buffer_length are queued once flag_buffer_full is set */
+static uint8_t reserved_len;
 static int buffer_length;
 static bool flag_buffer_full;
 static int16_t rssi;
-static uint16_t bc_recv_metric;
+/* Smoothed delays in 1/16 ticks, 0 until the first sample: pre- and
+ * post-processing of a forwarded beacon, beacon and data transmission per
+ * hop, and on the sink the per-hop data delay reported by the nodes */
+static uint16_t est_pre, est_post, est_bc_hop, est_uc_hop, est_uc_net;
+#if SCHED_COLLECT_SEC_MIC_LEN
+/* Sink: smoothed time to open a data frame, 1/16 ticks. All nodes: the
+ * epoch of the last sealed frame and the frames sealed in it */
+static uint16_t est_sec;
+static uint16_t sec_epoch;
+static uint16_t sec_counter;
+#endif
+static clock_time_t bc_tx_stamp, bc_fwd_stamp;
+/* Per-hop data delay announced by the sink, sizing the slots */
+static uint8_t uc_hop_delay;
+/* Telemetry counters since the last report */
+static uint16_t tm_epochs;
+static uint8_t tm_retries, tm_drops;
+static unsigned long tm_radio_last, tm_time_last;
+/* Slots: the node's own slot and the number of slots in the window */
+static uint16_t my_slot;
+static uint16_t slot_count;
+/* Sink: slot i belongs to slot_owner[i] (of owner_count), slot_used[i]
+ * once the node sent in it; assignments are announced round-robin from
+ * slot_announce */
+static linkaddr_t slot_owner[MAX_NODES];
+static bool slot_used[MAX_NODES];
+static uint16_t slot_announce;
+static uint16_t owner_count;
+#if SLOT_REUSE
+/* Sink: slot_owner[i] sends in cell slot_cell[i] and heard slot_owner[j]
+ * if bit j of nbr_bits[i] is set, the sink if bit MAX_NODES is, and had
+ * them as parents if the bits of nbr_parents[i] are; its hop count in the
+ * graph of neighbours is nbr_depth[i] (0: not reached). The cells are
+ * recomputed at the next beacon once slot_dirty is set */
+#define NBR_BITS_SIZE ((MAX_NODES + 8) / 8)
+#define NBR_SINK MAX_NODES
+static uint16_t slot_cell[MAX_NODES];
+static uint8_t nbr_depth[MAX_NODES];
+static uint8_t nbr_bits[MAX_NODES][NBR_BITS_SIZE];
+static uint8_t nbr_parents[MAX_NODES][NBR_BITS_SIZE];
+static bool slot_dirty;
+/* Sink, while scheduling: nodes within one hop of the hops placed in
+ * each cell */
+#define SLOT_CELLS_MAX (MAX_NODES * (MAX_HOPS + SLOT_REUSE_SPREAD))
+static uint8_t cell_busy[SLOT_CELLS_MAX][NBR_BITS_SIZE];
+/* Node: beacon senders heard, the epoch they were last heard in and, if
+ * they were our parent, the last epoch they were. The report is due when nbr_changed
+ * or after NBR_REFRESH_EPOCHS epochs; the parents and slot reported are
+ * kept */
+static struct {
+  linkaddr_t addr;
+  uint16_t epoch;
+  uint16_t parent_epoch;
+  bool parent;
+} nbr[NBR_MAX];
+static uint8_t nbr_count;
+static bool nbr_changed;
+static uint16_t nbr_epochs;
+static uint16_t nbr_slot_sent;
+/* Node: our entry in the NACKs of the epoch, the retransmission slot
+ * (NACK_MAX: none) */
+static uint8_t my_nack;
+#endif
+/* Sink: per-slot reception window, bit i of rx_mask is set if sequence
+ * number rx_last - i was received; NACKs are sent round-robin */
+static uint8_t rx_last[MAX_NODES];
+static uint16_t rx_mask[MAX_NODES];
+static bool rx_valid[MAX_NODES];
+static uint16_t nack_next;
+/* Node: sequence number of the next packet and the packets kept for
+ * retransmission */
+static uint8_t collect_seqn;
+static struct {
+  uint8_t seqn;
+  uint8_t len;
+  bool valid;
+  bool nacked;
+  uint8_t data[SCHED_COLLECT_MAX_PAYLOAD];
+} rtx[RTX_BUF];
+static uint8_t rtx_next;
+/* Node: urgent packet waiting for a contention slot or a wake-up window,
+ * in flight until the MAC reports its outcome */
+static uint8_t urgent_buf[SCHED_COLLECT_MAX_PAYLOAD];
+static uint8_t urgent_len;
+static bool urgent_pending, urgent_inflight;
+/* Node: beacon received and collection window not started yet, collection
+ * window running since collect_start, wake-up windows left before the next
+ * epoch and whether one is running */
+static bool sync_on;
+static bool collect_on;
+static clock_time_t collect_start;
+static uint16_t wakeup_left;
+static clock_time_t wakeup_at;
+static bool wakeup_on;
+/* Node: alternate parents, best first */
+static struct {
+  linkaddr_t addr;
+  uint16_t metric;
+  int16_t rssi;
+} alt_parent[PARENTS_MAX];
+static uint8_t alt_count;
+/* Node: copies of the unicasts waiting for their MAC outcome. The MAC
+ * queues per neighbour, so a sent callback is for the oldest copy (lowest
+ * order, counted from tx_order) sent to the receiver it reports */
+static struct {
+  bool used;
+  uint8_t order;
+  linkaddr_t to;
+  uint8_t len;
+  bool urgent;
+  clock_time_t t0;      /* received or handed off, for uc_hop_delay */
+  uint8_t data[TX_COPY_SIZE];
+} tx_copy[TX_INFLIGHT];
+static uint8_t tx_order, tx_count;
+#if STORE_SEGMENTS > 0
+/* Node: stored packets, in store_used segments from store_head on. Each
+ * record is a length byte and the packet; reading resumes at store_rd_off
+ * of the head segment, writing at store_wr_off of the last one */
+static uint8_t store_head, store_used;
+static uint8_t store_records[STORE_SEGMENTS];
+static uint16_t store_rd_off, store_wr_off;
+static uint16_t store_count;
+#endif
 /*---------------------------------------------------------------------------*/
 /* This struture from App is used for debug pupose */
 typedef struct {
@@ -115,16 +486,56 @@ test_msg_t;
 struct collect_header {
   linkaddr_t source;
   uint8_t hops;
+  uint8_t flags;
+  uint8_t seqn;         /* per-source sequence number, for NACKs */
+  uint8_t hop_delay;    /* largest per-hop delay along the path, ticks */
+} __attribute__((packed));
+#define COLLECT_FLAG_TELEMETRY 0x01 /* collect_telemetry follows the header */
+#define COLLECT_FLAG_SLOTTED   0x02 /* sent in the source's assigned slot */
+#define COLLECT_FLAG_URGENT    0x04 /* urgent packet, outside the NACK window */
+#define COLLECT_FLAG_NEIGHBOURS 0x08 /* collect_neighbours follows telemetry */
+
+/* Health of the source node since its previous report */
+struct collect_telemetry {
+  uint16_t epoch;        /* beacon seqn */
+  uint32_t radio_on;     /* energest TRANSMIT + LISTEN ticks */
+  uint32_t time;         /* energest CPU + LPM ticks */
+  uint8_t retries;       /* extra MAC transmissions of unicast packets */
+  uint8_t drops;         /* packets not queued or not acked by the parent */
+  linkaddr_t parent;
+  int8_t rssi;           /* of the parent's beacon */
+} __attribute__((packed));
+
+/* Neighbourhood of the source for the slot schedule: the slot it sends in
+ * and the addresses of count beacon senders it heard, which follow; bit i
+ * of parents is set if the i-th was its parent in the last NBR_AGE epochs */
+struct collect_neighbours {
+  uint16_t slot;
+  uint16_t parents;
+  uint8_t count;
+} __attribute__((packed));
+
+/* Nonce fields of a secured frame, before the MIC at its end */
+struct sec_trailer {
+  uint16_t epoch;
+  uint8_t counter;
+} __attribute__((packed));
+
+/* Fields of a data header sealed by the source */
+struct sec_data_auth {
+  linkaddr_t source;
+  uint8_t flags;
+  uint8_t seqn;
 } __attribute__((packed));
 /*---------------------------------------------------------------------------*/
 /* Rime Callback structures */
 struct broadcast_callbacks bc_cb = {
   .recv = bc_recv,
-  .sent = NULL
+  .sent = bc_sent
 };
 struct unicast_callbacks uc_cb = {
   .recv = uc_recv,
-  .sent = NULL
+  .sent = uc_sent
 };
 /*---------------------------------------------------------------------------*/
 /* Routing and synchronization beacons */
@@ -132,11 +543,324 @@ struct beacon_msg { // Beacon message structure
   uint16_t seqn;
   uint16_t metric;
   clock_time_t delay; // embed the transmission delay to help nodes synchronize
+  uint16_t slots;     // number of slots assigned by the sink
+  uint8_t nassign;    // slot_assign entries following the beacon
+  uint8_t nnack;      // nack entries following the slot assignments
+  uint8_t hop_delay;  // per-hop data delay for the slots, from the sink
+} __attribute__((packed));
+
+/* Slot assignment carried in beacons */
+struct slot_assign {
+  linkaddr_t addr;
+  uint16_t slot;
 } __attribute__((packed));
+
+/* Packets of a source missing at the sink: bit i of missing stands for
+ * sequence number last - 1 - i */
+struct nack {
+  linkaddr_t addr;
+  uint8_t last;
+  uint8_t missing;
+} __attribute__((packed));
+
+/* Assignments and NACKs of the last accepted beacon, forwarded with it */
+static struct slot_assign fwd_assign[SLOT_ASSIGN_MAX];
+static uint8_t fwd_nassign;
+static struct nack fwd_nack[NACK_MAX];
+static uint8_t fwd_nnack;
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Add a sample to a smoothed delay estimate
+ * \param est     The pointer to the estimate, in 1/16 ticks (0: no sample yet)
+ * \param sample  The measured delay in ticks
+ * 
+ * \return     No retun value
+ * 
+ *             The first sample initialises the estimate, the next ones are
+ *             averaged in with weight 1/DELAY_EST_WEIGHT. Samples longer than
+ *             DELAY_CEIL are outliers (e.g. a timer served late) and skipped.
+ */
+static void
+delay_est_update(uint16_t *est, clock_time_t sample)
+{
+  if (sample > DELAY_CEIL) {
+    return;
+  }
+  if (*est == 0) {
+    *est = sample * 16;
+  }
+  else {
+    *est = *est - *est / DELAY_EST_WEIGHT + sample * 16 / DELAY_EST_WEIGHT;
+  }
+}
+
+#if SCHED_COLLECT_SEC_MIC_LEN
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to build the CCM* nonce of a frame
+ * \param nonce   The CCM_STAR_NONCE_LENGTH bytes to fill
+ * \param sender  The node that sealed the frame
+ * \param tr      The epoch and counter carried by the frame
+ * \param kind    SEC_KIND_BEACON or SEC_KIND_DATA
+ * 
+ * \return     No retun value
+ */
+static void
+sec_nonce(uint8_t *nonce, const linkaddr_t *sender,
+  const struct sec_trailer *tr, uint8_t kind)
+{
+  memset(nonce, 0, CCM_STAR_NONCE_LENGTH);
+  memcpy(nonce, sender, LINKADDR_SIZE < 8 ? LINKADDR_SIZE : 8);
+  nonce[8] = tr->epoch >> 8;
+  nonce[9] = tr->epoch & 0xff;
+  nonce[10] = tr->counter;
+  nonce[12] = kind;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to seal the packetbuf data
+ * \param epoch   The current epoch (beacon_seqn)
+ * \param kind    SEC_KIND_BEACON or SEC_KIND_DATA
+ * \param a       The authenticated fields
+ * \param a_len   Their length in bytes
+ * \param m_off   Where the encrypted part of the data starts
+ * 
+ * \return     Returns 0 if the frame cannot be sealed, otherwise sucess
+ * 
+ *             The data from m_off on is encrypted in place and the trailer
+ *             and MIC are appended. The counter restarts in every epoch.
+ */
+static int
+sec_seal(uint16_t epoch, uint8_t kind, const uint8_t *a, uint8_t a_len,
+  uint8_t m_off)
+{
+  uint8_t nonce[CCM_STAR_NONCE_LENGTH];
+  struct sec_trailer tr;
+  uint8_t *p = (uint8_t *)packetbuf_dataptr();
+  uint16_t len = packetbuf_datalen();
+
+  if (epoch != sec_epoch) {
+    sec_epoch = epoch;
+    sec_counter = 0;
+  }
+  if (sec_counter > 255 ||
+      len + SCHED_COLLECT_SEC_OVERHEAD > PACKETBUF_SIZE - packetbuf_hdrlen()) {
+    printf ("sched_collect: frame not sealed\n");
+    return 0;
+  }
+  tr.epoch = epoch;
+  tr.counter = sec_counter++;
+  sec_nonce(nonce, &linkaddr_node_addr, &tr, kind);
+  CCM_STAR.aead(nonce, p + m_off, len - m_off, a, a_len,
+    p + len + sizeof(tr), SCHED_COLLECT_SEC_MIC_LEN, 1);
+  memcpy(p + len, &tr, sizeof(tr));
+  packetbuf_set_datalen(len + SCHED_COLLECT_SEC_OVERHEAD);
+  return 1;
+}
+
 /*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to open the packetbuf data sealed by sec_seal()
+ * \param sender  The node that sealed the frame
+ * \param kind    SEC_KIND_BEACON or SEC_KIND_DATA
+ * \param a       The authenticated fields
+ * \param a_len   Their length in bytes
+ * \param m_off   Where the encrypted part of the data starts
+ * \param epoch   Filled with the epoch the frame was sealed in
+ * 
+ * \return     Returns 0 if the frame is not authentic, otherwise sucess
+ * 
+ *             On success the data is decrypted in place and the trailer and
+ *             MIC are removed.
+ */
+static int
+sec_open(const linkaddr_t *sender, uint8_t kind, const uint8_t *a,
+  uint8_t a_len, uint8_t m_off, uint16_t *epoch)
+{
+  uint8_t nonce[CCM_STAR_NONCE_LENGTH];
+  uint8_t mic[SCHED_COLLECT_SEC_MIC_LEN];
+  struct sec_trailer tr;
+  uint8_t *p = (uint8_t *)packetbuf_dataptr();
+  uint16_t len = packetbuf_datalen();
+  uint8_t i, diff = 0;
 
+  if (len < m_off + SCHED_COLLECT_SEC_OVERHEAD) {
+    return 0;
+  }
+  len -= SCHED_COLLECT_SEC_OVERHEAD;
+  memcpy(&tr, p + len, sizeof(tr));
+  sec_nonce(nonce, sender, &tr, kind);
+  CCM_STAR.aead(nonce, p + m_off, len - m_off, a, a_len, mic,
+    SCHED_COLLECT_SEC_MIC_LEN, 0);
+  for (i = 0; i < SCHED_COLLECT_SEC_MIC_LEN; i++) {
+    diff |= mic[i] ^ p[len + sizeof(tr) + i];
+  }
+  if (diff) {
+    return 0;
+  }
+  packetbuf_set_datalen(len);
+  *epoch = tr.epoch;
+  return 1;
+}
+#endif /* SCHED_COLLECT_SEC_MIC_LEN */
+
+#if STORE_SEGMENTS > 0
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Name of a store segment
+ * \param seg     The segment number, below STORE_SEGMENTS
+ * \return     The file name, valid until the next call
+ */
+static const char *
+store_name(uint8_t seg)
+{
+  static char name[] = "sc_0";
+  name[3] = '0' + seg;
+  return name;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to empty the store, removing the segments left
+ *                on flash by a previous run
+ * 
+ * \return     No retun value
+ */
+static void
+store_init(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < STORE_SEGMENTS; i++) {
+    cfs_remove(store_name(i));
+    store_records[i] = 0;
+  }
+  store_head = 0;
+  store_used = 0;
+  store_rd_off = 0;
+  store_wr_off = 0;
+  store_count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to drop the head segment of the store
+ * 
+ * \return     No retun value
+ */
+static void
+store_drop_head(void)
+{
+  cfs_remove(store_name(store_head));
+  store_count -= store_records[store_head];
+  store_records[store_head] = 0;
+  store_head = (store_head + 1) % STORE_SEGMENTS;
+  store_used--;
+  store_rd_off = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to append a packet to the store
+ * \param data    The packet
+ * \param len     The length of the packet in bytes
+ * 
+ * \return     Returns 0 if the store is full or flash fails, otherwise sucess
+ * 
+ *             Offsets are kept in RAM rather than using CFS_APPEND, as Coffee
+ *             finds the end of a file by its last non-zero byte.
+ */
+static int
+store_append(const uint8_t *data, uint8_t len)
+{
+  uint8_t tail;
+  int fd, ok;
+
+  if (store_used == 0 || store_wr_off + 1 + len > STORE_SEGMENT_SIZE) {
+    if (store_used == STORE_SEGMENTS) {
+      printf ("sched_collect: store full\n");
+      return 0;
+    }
+    /* Start a new segment, reserved at once so that it is contiguous */
+    tail = (store_head + store_used) % STORE_SEGMENTS;
+    cfs_remove(store_name(tail));
+    if (cfs_coffee_reserve(store_name(tail), STORE_SEGMENT_SIZE) < 0) {
+      printf ("sched_collect: store segment %u not reserved\n", tail);
+      return 0;
+    }
+    store_used++;
+    store_wr_off = 0;
+  }
+  tail = (store_head + store_used - 1) % STORE_SEGMENTS;
+  fd = cfs_open(store_name(tail), CFS_WRITE);
+  if (fd < 0) {
+    return 0;
+  }
+  ok = cfs_seek(fd, store_wr_off, CFS_SEEK_SET) == store_wr_off &&
+    cfs_write(fd, &len, 1) == 1 && cfs_write(fd, data, len) == len;
+  cfs_close(fd);
+  if (!ok) {
+    /* Close the segment: the records before the failed one stay readable */
+    store_wr_off = STORE_SEGMENT_SIZE;
+    return 0;
+  }
+  store_wr_off += 1 + len;
+  store_records[tail]++;
+  store_count++;
+  printf ("sched_collect: stored length:%d, %u packets in store\n", len,
+    store_count);
+  return 1;
+}
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to take the oldest packet out of the store
+ * \param data    The buffer for the packet, SCHED_COLLECT_MAX_PAYLOAD bytes
+ * 
+ * \return     Returns the length of the packet, 0 if it could not be read
+ * 
+ *             A segment that cannot be read is dropped as a whole.
+ */
+static uint8_t
+store_read(uint8_t *data)
+{
+  uint8_t len = 0;
+  int fd;
 
+  while (store_used > 0 && store_records[store_head] == 0) {
+    store_drop_head();
+  }
+  if (store_used == 0) {
+    return 0;
+  }
+  fd = cfs_open(store_name(store_head), CFS_READ);
+  if (fd < 0 || cfs_seek(fd, store_rd_off, CFS_SEEK_SET) != store_rd_off ||
+      cfs_read(fd, &len, 1) != 1 || 0 == len ||
+      SCHED_COLLECT_MAX_PAYLOAD < len || cfs_read(fd, data, len) != len) {
+    printf ("sched_collect: store segment %u unreadable, dropping %u packets\n",
+      store_head, store_records[store_head]);
+    if (fd >= 0) {
+      cfs_close(fd);
+    }
+    store_drop_head();
+    return 0;
+  }
+  cfs_close(fd);
+  store_rd_off += 1 + len;
+  store_records[store_head]--;
+  store_count--;
+  if (store_records[store_head] == 0) {
+    store_drop_head();
+  }
+  return len;
+}
+#endif /* STORE_SEGMENTS > 0 */
 
 /*---------------------------------------------------------------------------*/
 /**
@@ -162,7 +886,19 @@ sched_collect_open(struct sched_collect_conn* conn, uint16_t channels,
   conn->beacon_seqn = 1; /*initial value from 1, when overflow occurs (0) we force flush everything*/
   conn->callbacks = callbacks; /*assign broadcast and unicast callbacks*/
   flag_buffer_full = false;
-  buffer = (uint8_t*) malloc (20); /*Allocate data buffer for each node*/
+  reserved_len = 0;
+#if STORE_SEGMENTS > 0
+  store_init();
+#endif
+  my_slot = SLOT_NONE;
+  slot_count = 0;
+  uc_hop_delay = UNICAST_HOP_DELAY;
+#if SCHED_COLLECT_SEC_MIC_LEN
+  {
+    static const uint8_t key[16] = SCHED_COLLECT_SEC_KEY;
+    CCM_STAR.set_key(key);
+  }
+#endif
 
   /* Open the underlying Rime primitives for broadcast and unicast*/
   broadcast_open(&conn->bc, channels,     &bc_cb);
@@ -192,29 +928,147 @@ sched_collect_open(struct sched_collect_conn* conn, uint16_t channels,
 int
 sched_collect_send(struct sched_collect_conn *conn, uint8_t *data, uint8_t len)
 {
-  /* Store packet in a local buffer to be send during the data collection 
+  return sched_collect_send_prio(conn, data, len, SCHED_COLLECT_PRIO_NORMAL);
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to send a packet with a given priority
+ * \param conn    The pointer to connection instance of type sched_collect_conn
+ * \param data    This pointer to an unsigned 8-bit integer, holds address to data
+ * \param len     The length of the data to be send in bytes
+ * \param prio    SCHED_COLLECT_PRIO_NORMAL or SCHED_COLLECT_PRIO_URGENT
+ * 
+ * \return     Returns 0 if not able to schedule, otherwise sucess
+ * 
+ *             A normal packet is buffered for the node's slot. An urgent packet
+ *             has its own buffer: it is sent right away inside a wake-up window
+ *             or during the beacon propagation (the parent is listening),
+ *             in the node's slot if that is still ahead, in a random contention
+ *             slot if the collection window is running, otherwise at the next
+ *             wake-up window or collection window, whichever comes first.
+ */
+int
+sched_collect_send_prio(struct sched_collect_conn *conn, uint8_t *data,
+  uint8_t len, uint8_t prio)
+{
+  clock_time_t elapsed;
+  uint16_t first;
+  uint8_t *buf;
+
+  if (prio == SCHED_COLLECT_PRIO_URGENT) {
+    if (urgent_pending) {
+      printf ("sched_collect: urgent packet pending!!\n");
+      if (tm_drops < 255) {
+        tm_drops++;
+      }
+      return 0;
+    }
+    if (NULL == data || 0 >= len || SCHED_COLLECT_MAX_PAYLOAD < len) {
+      printf ("sched_collect: Error in data!!\n");
+      return 0;
+    }
+    memcpy(urgent_buf, data, len);
+    urgent_len = len;
+    urgent_pending = true;
+    printf ("sched_collect: urgent packet queued, length:%d\n", len);
+
+    if (wakeup_on || sync_on) {
+      urgent_send(conn);
+    }
+    else if (collect_on && ctimer_expired(&conn->sync_timer)) {
+      /* Our slot is gone: pick a contention slot still ahead */
+      elapsed = clock_time() - collect_start;
+      first = (elapsed < URGENT_SLOTS_START) ? 0 :
+        (elapsed - URGENT_SLOTS_START) / MAX_UNICST_PROCESSING_DELAY + 1;
+      if (first < URGENT_SLOTS) {
+        first += random_rand() % (URGENT_SLOTS - first);
+        ctimer_set(&conn->urgent_timer, URGENT_SLOTS_START +
+          first * MAX_UNICST_PROCESSING_DELAY - elapsed, urgent_send_cb,
+          (void*)conn);
+      }
+    }
+    return 1;
+  }
+
+  /* Store packet in the slot buffer to be send during the data collection
    * time window. If the packet cannot be stored, e.g., because there is
    * a pending packet to be sent, return zero. Otherwise, return non-zero
    * to report operation success. */
+  if (NULL == data) {
+    printf ("sched_collect: Error in data!!\n");
+    return 0;
+  }
+  buf = sched_collect_reserve(conn, len);
+  if (NULL == buf) {
+    return 0;
+  }
+  memcpy(buf, data, len);
+  return sched_collect_commit(conn, len);
+}
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to reserve the slot buffer for a packet
+ * \param conn    The pointer to connection instance of type sched_collect_conn
+ * \param len     The largest length of the packet in bytes
+ * 
+ * \return     Returns a pointer to len bytes, or NULL if not able to schedule
+ * 
+ *             The buffer is the retransmission entry the packet will be kept
+ *             in, so the record is copied only once more, into the packetbuf
+ *             when the slot comes. The oldest copy kept for retransmission is
+ *             dropped at the reservation rather than when the slot comes.
+ */
+uint8_t *
+sched_collect_reserve(struct sched_collect_conn *conn, uint8_t len)
+{
+#if STORE_SEGMENTS > 0
+  /* The waiting packet missed its slot: keep it on flash */
+  if (flag_buffer_full && 0 < len && SCHED_COLLECT_MAX_PAYLOAD >= len &&
+      store_append(rtx[rtx_next].data, buffer_length)) {
+    flag_buffer_full = false;
+  }
+#endif
   if (flag_buffer_full) {
     printf ("sched_collect: BUFFER FULL!!!\n");
-    return 0;
+    if (tm_drops < 255) {
+      tm_drops++;
+    }
+    return NULL;
   }
-  if (NULL == data || 0 >= len || 20 <= len) {
+  if (0 >= len || SCHED_COLLECT_MAX_PAYLOAD < len) {
+    printf ("sched_collect: Error in data!!\n");
+    return NULL;
+  }
+  rtx[rtx_next].valid = false;
+  reserved_len = len;
+  return rtx[rtx_next].data;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Function to queue the reserved packet for the node's slot
+ * \param conn    The pointer to connection instance of type sched_collect_conn
+ * \param len     The length written into the reserved buffer, in bytes
+ * 
+ * \return     Returns 0 if nothing is reserved or len is too long, otherwise sucess
+ */
+int
+sched_collect_commit(struct sched_collect_conn *conn, uint8_t len)
+{
+  if (0 >= len || reserved_len < len) {
     printf ("sched_collect: Error in data!!\n");
     return 0;
   }
-  
   flag_buffer_full = true;
-  /* Store data into buffer, to be send later*/
-  memcpy((void*)buffer, (void*)data, len);
   buffer_length = len;
+  reserved_len = 0;
 
-  printf ("sched_collect: Buffer queued: %u %u length:%d\n",
-   ((test_msg_t*)buffer)->seqn, ((test_msg_t*)data)->seqn,buffer_length);
-  
-  return 1; 
+  printf ("sched_collect: Buffer queued: %u length:%d\n",
+   ((test_msg_t*)rtx[rtx_next].data)->seqn, buffer_length);
+
+  return 1;
 }
 
 
@@ -237,24 +1091,107 @@ send_beacon(struct sched_collect_conn* conn)
 {
   /*Pack the beacon message with valid data stored in conn*/
   struct beacon_msg beacon = {
-    .seqn = conn->beacon_seqn, .metric = conn->metric};
+    .seqn = conn->beacon_seqn, .metric = conn->metric, .slots = slot_count};
+  struct slot_assign assign[SLOT_ASSIGN_MAX];
+  struct nack nacks[NACK_MAX];
+  uint16_t i, slot, missing;
+  uint8_t *p;
 
   if(linkaddr_cmp(&sink_node, &linkaddr_node_addr)) {
-    beacon.delay = 0;
+    /* Only the transmission of this beacon is still to come */
+    bc_tx_stamp = clock_time();
+    beacon.delay = BEACON_HOP_DELAY;
+    /* Per-hop data delay reported by the nodes, for the slots */
+    if (est_uc_net) {
+      uc_hop_delay = DELAY_EST(est_uc_net) ? DELAY_EST(est_uc_net) : 1;
+#if SCHED_COLLECT_SEC_MIC_LEN
+      /* A packet is opened before the next slot's one arrives */
+      uc_hop_delay += DELAY_EST(est_sec);
+      printf("sched_collect: slot hop %u, opening %u\n", uc_hop_delay,
+        DELAY_EST(est_sec));
+#endif
+    }
+    beacon.hop_delay = uc_hop_delay;
+#if SLOT_REUSE
+    if (slot_dirty) {
+      slot_schedule();
+    }
+    beacon.slots = slot_count;
+#endif
+    /* Announce the assignments not used yet, round-robin */
+    beacon.nassign = 0;
+    for (i = 0; i < owner_count && beacon.nassign < SLOT_ASSIGN_MAX; i++) {
+      slot = (slot_announce + i) % owner_count;
+      if (!slot_used[slot]) {
+        assign[beacon.nassign].addr = slot_owner[slot];
+#if SLOT_REUSE
+        assign[beacon.nassign].slot = slot_cell[slot];
+#else
+        assign[beacon.nassign].slot = slot;
+#endif
+        beacon.nassign++;
+      }
+    }
+    slot_announce = owner_count ? (slot_announce + i) % owner_count : 0;
+    /* NACK the sources with holes in their reception window */
+    beacon.nnack = 0;
+    for (i = 0; i < owner_count && beacon.nnack < NACK_MAX; i++) {
+      slot = (nack_next + i) % owner_count;
+      missing = (uint8_t)~(rx_mask[slot] >> 1);
+      if (rx_valid[slot] && missing) {
+        nacks[beacon.nnack].addr = slot_owner[slot];
+        nacks[beacon.nnack].last = rx_last[slot];
+        nacks[beacon.nnack].missing = missing;
+        beacon.nnack++;
+      }
+    }
+    nack_next = owner_count ? (nack_next + i) % owner_count : 0;
+    /* Sync record: reference start of the epoch */
+    printf("Sync: B %u\n", conn->beacon_seqn);
   }
   else {
     printf ("sched_collect: EPOCH START: %u\n", (uint16_t)(bc_recv_ts_t1 - conn->received_packet_from_parent_delay));
     bc_recv_ts_t2 = clock_time();
     printf("sched_collect:bc_recv_ts_t1:%u\n", (uint16_t)bc_recv_ts_t1);
     printf ("sched_collect:bc_recv_ts_t2:%u\n", (uint16_t)bc_recv_ts_t2);
+    /* Sync record: epoch seqn, hops, how long ago (ms) the epoch started */
+    printf("Sync: E %u %u %lu\n", conn->beacon_seqn, conn->metric,
+      (unsigned long)(clock_time_t)(bc_recv_ts_t2 - (bc_recv_ts_t1 -
+      conn->received_packet_from_parent_delay)) * 1000 / CLOCK_SECOND);
 
-    /* The total delay to be embedded into the sending packet*/
-    beacon.delay=(bc_recv_ts_t2 - bc_recv_ts_t1) + conn->received_packet_from_parent_delay ;
+    /* The total delay to be embedded into the sending packet, including
+     * the transmission still to come */
+    bc_tx_stamp = bc_recv_ts_t2;
+    beacon.delay=(bc_recv_ts_t2 - bc_recv_ts_t1) + conn->received_packet_from_parent_delay +
+      BEACON_HOP_DELAY;
+    beacon.hop_delay = uc_hop_delay;
+    printf("sched_collect: delays pre %u post %u beacon hop %u data hop %u slot hop %u\n",
+      PREPROCESSING_DELAY, POSTPROCESSING_DELAY, BEACON_HOP_DELAY,
+      DELAY_EST(est_uc_hop), uc_hop_delay);
+    /* Forward the sink's slot assignments */
+    beacon.nassign = fwd_nassign;
+    memcpy(assign, fwd_assign, fwd_nassign * sizeof(struct slot_assign));
+    beacon.nnack = fwd_nnack;
+    memcpy(nacks, fwd_nack, fwd_nnack * sizeof(struct nack));
   }
   
 
   packetbuf_clear();
-  packetbuf_copyfrom(&beacon, sizeof(beacon));
+  p = (uint8_t *)packetbuf_dataptr();
+  memcpy(p, &beacon, sizeof(beacon));
+  p += sizeof(beacon);
+  memcpy(p, assign, beacon.nassign * sizeof(struct slot_assign));
+  p += beacon.nassign * sizeof(struct slot_assign);
+  memcpy(p, nacks, beacon.nnack * sizeof(struct nack));
+  p += beacon.nnack * sizeof(struct nack);
+  packetbuf_set_datalen(p - (uint8_t *)packetbuf_dataptr());
+#if SCHED_COLLECT_SEC_MIC_LEN
+  /* Sealed after the time stamps: the time is part of the beacon hop */
+  if (!sec_seal(conn->beacon_seqn, SEC_KIND_BEACON, (uint8_t *)&beacon.seqn,
+      sizeof(beacon.seqn), sizeof(beacon.seqn))) {
+    return;
+  }
+#endif
   printf("sched_collect: sending beacon: seqn %d metric %d delay:%u\n",
     conn->beacon_seqn, conn->metric, (uint16_t)beacon.delay);
   /* Debug prints
@@ -263,6 +1200,9 @@ send_beacon(struct sched_collect_conn* conn)
    * printf ("my_parent: %d --> %d\n", node_id, conn->parent);
    * printf ("my_parent: RSSI: %d\n", rssi);
    */
+  if(!linkaddr_cmp(&sink_node, &linkaddr_node_addr)) {
+    delay_est_update(&est_post, clock_time() - bc_fwd_stamp);
+  }
   broadcast_send(&conn->bc);
   
   
@@ -286,6 +1226,7 @@ void
 beacon_forward_timer_cb(void* ptr)
 {
   struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  bc_fwd_stamp = clock_time();
   printf ("sched_collect: Inside  beacon_forward_timer_cb()\n");
   send_beacon (conn);
   leds_on(LEDS_BLUE);
@@ -301,7 +1242,8 @@ beacon_forward_timer_cb(void* ptr)
  * 
  *             This function will be called internally by the non-sink to turn-on,
  *             the radio node when the radio_timer (in struct sched_collect_conn)
- *             expires (immediately before each time synchronisation phase). 
+ *             expires (immediately before each time synchronisation phase).
+ *             It ends the quiet period and calls the active callback.
  * 
  */
 
@@ -310,8 +1252,19 @@ turn_radio_on_cb(void *ptr)
 {
   struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
   NETSTACK_MAC.on ();
+  simple_energest_phase(SCHED_COLLECT_PHASE_IDLE);
+  ctimer_stop (&conn->urgent_timer);
+  wakeup_on = false;
+  /* Sync record: radio on for the next epoch, hops */
+  printf("Sync: R %u %u\n", (uint16_t)(conn->beacon_seqn + 1), conn->metric);
   printf ("sched_collect: Radio turned back on!!\n");
   ctimer_stop (&conn->radio_timer);
+#if DEEP_IDLE
+  simple_energest_quiet(0);
+  if (conn->callbacks != NULL && conn->callbacks->active != NULL) {
+    conn->callbacks->active();
+  }
+#endif
 }
  
 /*---------------------------------------------------------------------------*/
@@ -323,7 +1276,8 @@ turn_radio_on_cb(void *ptr)
  * 
  *             This function will be called internally by the non-sink node to
  *             turn-off the radio,  when the radio_timer (in struct sched_collect_conn)
- *             expires (immediately after data collection phase). 
+ *             expires (immediately after data collection phase). The wake-up
+ *             windows for urgent packets are armed until the next epoch.
  * 
  */
 
@@ -331,11 +1285,417 @@ void
 turn_radio_off_cb(void *ptr)
 {
   struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  clock_time_t on_delay = RADIO_TURN_ON_DELAY;
   NETSTACK_MAC.off (false);
+  simple_energest_phase(SCHED_COLLECT_PHASE_OFF);
   printf ("sched_collect: Radio turned OFF!\n");
   leds_off(LEDS_GREEN);
-  ctimer_set(&conn->radio_timer, RADIO_TURN_ON_DELAY,
-    turn_radio_on_cb, (void*)conn);
+  collect_on = false;
+#if DEEP_IDLE
+  simple_energest_quiet(1);
+#endif
+  ctimer_set(&conn->radio_timer, on_delay, turn_radio_on_cb, (void*)conn);
+#if URGENT_WAKEUP_PERIOD
+  /* The collection window starts at the same time at every hop, so are the
+   * wake-ups aligned */
+  wakeup_left = (on_delay > URGENT_WAKEUP_LISTEN) ?
+    (on_delay - URGENT_WAKEUP_LISTEN) / URGENT_WAKEUP_PERIOD : 0;
+  if (wakeup_left > 0) {
+    wakeup_at = clock_time() + URGENT_WAKEUP_PERIOD;
+    ctimer_set(&conn->urgent_timer, URGENT_WAKEUP_PERIOD,
+      urgent_wakeup_cb, (void*)conn);
+  }
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Fill a telemetry report and restart the counters
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param tm     The report to be filled
+ * 
+ * \return     No return value
+ * 
+ *             The radio-on and total times are the energest ticks elapsed since
+ *             the previous report, so that the sink can compute the duty cycle
+ *             of the node over the last TELEMETRY_EPOCHS epochs.
+ */
+static void
+telemetry_fill(struct sched_collect_conn *conn, struct collect_telemetry *tm)
+{
+  unsigned long radio, time;
+
+  energest_flush();
+  radio = energest_type_time(ENERGEST_TYPE_TRANSMIT) +
+    energest_type_time(ENERGEST_TYPE_LISTEN);
+  time = energest_type_time(ENERGEST_TYPE_CPU) +
+    energest_type_time(ENERGEST_TYPE_LPM);
+
+  tm->epoch = conn->beacon_seqn;
+  tm->radio_on = radio - tm_radio_last;
+  tm->time = time - tm_time_last;
+  tm->retries = tm_retries;
+  tm->drops = tm_drops;
+  tm->parent = conn->parent;
+  tm->rssi = rssi;
+
+  tm_radio_last = radio;
+  tm_time_last = time;
+  tm_retries = 0;
+  tm_drops = 0;
+  tm_epochs = 0;
+}
+
+#if SLOT_REUSE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief         Note the sender of a beacon in the neighbour table
+ * \param sender  The sender of the beacon
+ * \param epoch   The seqn of the beacon
+ *
+ * \return     No retun value
+ *
+ *             A sender not in the table takes a free entry, or the one heard
+ *             least recently, and makes the neighbour report due.
+ */
+static void
+nbr_note(const linkaddr_t *sender, uint16_t epoch)
+{
+  uint8_t i, oldest = 0;
+
+  for (i = 0; i < nbr_count; i++) {
+    if (linkaddr_cmp(&nbr[i].addr, sender)) {
+      nbr[i].epoch = epoch;
+      return;
+    }
+    if ((int16_t)(nbr[i].epoch - nbr[oldest].epoch) < 0) {
+      oldest = i;
+    }
+  }
+  if (nbr_count < NBR_MAX) {
+    oldest = nbr_count++;
+  }
+  linkaddr_copy(&nbr[oldest].addr, sender);
+  nbr[oldest].epoch = epoch;
+  nbr[oldest].parent = false;
+  nbr_changed = true;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      The parents in the neighbour table
+ *
+ * \return     A mask with bit i set if nbr[i] is a parent
+ */
+static uint16_t
+nbr_parents_mask(void)
+{
+  uint16_t mask = 0;
+  uint8_t i;
+
+  for (i = 0; i < nbr_count; i++) {
+    if (nbr[i].parent) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Age the neighbour table, once per epoch
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ *
+ * \return     No retun value
+ *
+ *             Senders not heard in the last NBR_AGE epochs are removed, and
+ *             so are parents not used in them from the parents. A new parent
+ *             or a new slot make the neighbour report due, the removals wait
+ *             for the next one: the schedule only has to change at once for
+ *             the routes it does not cover.
+ */
+static void
+nbr_age(struct sched_collect_conn *conn)
+{
+  uint8_t i;
+
+  for (i = 0; i < nbr_count; ) {
+    if ((uint16_t)(conn->beacon_seqn - nbr[i].epoch) >= NBR_AGE) {
+      nbr[i] = nbr[--nbr_count];
+      continue;
+    }
+    if (linkaddr_cmp(&nbr[i].addr, &conn->parent)) {
+      nbr_changed |= !nbr[i].parent;
+      nbr[i].parent = true;
+      nbr[i].parent_epoch = conn->beacon_seqn;
+    }
+    else if ((uint16_t)(conn->beacon_seqn - nbr[i].parent_epoch) >= NBR_AGE) {
+      nbr[i].parent = false;
+    }
+    i++;
+  }
+  if (my_slot != nbr_slot_sent) {
+    nbr_changed = true;
+  }
+  nbr_epochs++;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Send the packetbuf to the parent, keeping a copy
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param urgent Whether the packet is this node's urgent packet
+ * \param t0     When the packet was received, or created by this node
+ * 
+ * \return     Returns 0 if too many packets are in flight or the send
+ *             fails, otherwise sucess
+ * 
+ *             The copy is taken before unicast_send(), as the MAC may report
+ *             the outcome right away; see uc_sent() for the failover.
+ */
+static int
+collect_unicast(struct sched_collect_conn *conn, bool urgent, clock_time_t t0)
+{
+  uint8_t i;
+  bool was_inflight = urgent_inflight;
+
+  if (tx_count >= TX_INFLIGHT || packetbuf_totlen() > TX_COPY_SIZE) {
+    printf ("sched_collect: too many packets in flight, dropping\n");
+    if (tm_drops < 255) {
+      tm_drops++;
+    }
+    return 0;
+  }
+  for (i = 0; tx_copy[i].used; i++);
+  tx_copy[i].used = true;
+  tx_copy[i].order = tx_order++;
+  tx_copy[i].to = conn->parent;
+  tx_copy[i].len = packetbuf_copyto(tx_copy[i].data);
+  tx_copy[i].urgent = urgent;
+  tx_copy[i].t0 = t0;
+  tx_count++;
+  urgent_inflight = urgent_inflight || urgent;
+  if (!unicast_send (&conn->uc, &conn->parent)) {
+    /* No sent callback will come for it */
+    printf ("sched_collect: unicast failed, dropping\n");
+    tx_copy[i].used = false;
+    tx_count--;
+    urgent_inflight = was_inflight;
+    if (tm_drops < 255) {
+      tm_drops++;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Send a data packet of this node to the parent
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param seqn   The per-source sequence number of the packet
+ * \param data   The application data
+ * \param len    The length of the data in bytes
+ * \param flags  COLLECT_FLAG_TELEMETRY to insert a telemetry report,
+ *               COLLECT_FLAG_URGENT for an urgent packet
+ * 
+ * \return     No retun value
+ *
+ *             With SLOT_REUSE, a neighbour report due goes after the
+ *             telemetry of a regular packet, if the frame has room for it.
+ */
+static void
+collect_send(struct sched_collect_conn *conn, uint8_t seqn, const uint8_t *data,
+  uint8_t len, uint8_t flags)
+{
+  /* The header info to be send with the unicast data*/
+  struct collect_header hdr = {.source=linkaddr_node_addr, .hops=0,
+    .flags=flags, .seqn=seqn, .hop_delay=DELAY_EST(est_uc_hop)};
+  struct collect_telemetry tm;
+  uint8_t *p;
+  clock_time_t t0 = clock_time();
+#if SCHED_COLLECT_SEC_MIC_LEN
+  struct sec_data_auth auth;
+#endif
+#if SLOT_REUSE
+  struct collect_neighbours nr;
+  uint8_t i;
+#endif
+
+  if (my_slot != SLOT_NONE && !(flags & COLLECT_FLAG_URGENT)) {
+    hdr.flags |= COLLECT_FLAG_SLOTTED;
+  }
+#if SLOT_REUSE
+  if (!(flags & COLLECT_FLAG_URGENT) &&
+      (nbr_changed || nbr_epochs >= NBR_REFRESH_EPOCHS) &&
+      ((flags & COLLECT_FLAG_TELEMETRY) ? sizeof(struct collect_telemetry) : 0) +
+      sizeof(nr) + nbr_count * sizeof(linkaddr_t) + len <=
+      sizeof(struct collect_telemetry) + SCHED_COLLECT_MAX_PAYLOAD) {
+    hdr.flags |= COLLECT_FLAG_NEIGHBOURS;
+  }
+#endif
+  packetbuf_clear();
+  p = (uint8_t *)packetbuf_dataptr();
+  /* Every TELEMETRY_EPOCHS epochs, the telemetry goes between header and data */
+  if (flags & COLLECT_FLAG_TELEMETRY) {
+    telemetry_fill(conn, &tm);
+    memcpy(p, &tm, sizeof(struct collect_telemetry));
+    p += sizeof(struct collect_telemetry);
+  }
+#if SLOT_REUSE
+  if (hdr.flags & COLLECT_FLAG_NEIGHBOURS) {
+    nr.slot = my_slot;
+    nr.parents = nbr_parents_mask();
+    nr.count = nbr_count;
+    memcpy(p, &nr, sizeof(nr));
+    p += sizeof(nr);
+    for (i = 0; i < nbr_count; i++) {
+      memcpy(p, &nbr[i].addr, sizeof(linkaddr_t));
+      p += sizeof(linkaddr_t);
+    }
+    nbr_slot_sent = my_slot;
+    nbr_changed = false;
+    nbr_epochs = 0;
+  }
+#endif
+  memcpy(p, data, len);
+  packetbuf_set_datalen(p + len - (uint8_t *)packetbuf_dataptr());
+#if SCHED_COLLECT_SEC_MIC_LEN
+  /* Sealed after t0: the time is part of the first hop */
+  auth.source = hdr.source;
+  auth.flags = hdr.flags;
+  auth.seqn = hdr.seqn;
+  if (!sec_seal(conn->beacon_seqn, SEC_KIND_DATA, (uint8_t *)&auth,
+      sizeof(auth), 0)) {
+    return;
+  }
+#endif
+  if (!packetbuf_hdralloc (sizeof(struct collect_header))) {
+    printf ("sched_collect: Error in allocating packet collect header! returning..\n");
+    return;
+  }
+  memcpy(packetbuf_hdrptr(), &hdr, sizeof(struct collect_header));
+  /* Send unicast packet.*/
+  collect_unicast(conn, flags & COLLECT_FLAG_URGENT, t0);
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Send the pending urgent packet to the parent
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * 
+ * \return     No retun value
+ * 
+ *             The packet stays pending until the parent acknowledges it (see
+ *             uc_sent()), so that it is sent again at the next opportunity.
+ */
+static void
+urgent_send(struct sched_collect_conn *conn)
+{
+  if (!urgent_pending || urgent_inflight ||
+      linkaddr_cmp(&conn->parent, &linkaddr_null)) {
+    return;
+  }
+  printf ("sched_collect: sending urgent packet to_parent:%02x:%02x\n",
+    conn->parent.u8[0], conn->parent.u8[1]);
+  collect_send(conn, 0, urgent_buf, urgent_len, COLLECT_FLAG_URGENT);
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Callback timer function to end a wake-up window
+ * \param ptr    The pointer to void, the callback argument
+ * 
+ * \return     No retun value
+ * 
+ *             Turns the radio off and arms the next wake-up, if one still fits
+ *             before the radio is turned on for the next epoch.
+ */
+static void
+urgent_sleep_cb(void *ptr)
+{
+  struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  NETSTACK_MAC.off (false);
+  simple_energest_phase(SCHED_COLLECT_PHASE_OFF);
+  wakeup_on = false;
+  if (--wakeup_left > 0) {
+    /* Keep the windows aligned, even if this one was extended */
+    wakeup_at += URGENT_WAKEUP_PERIOD;
+    ctimer_set(&conn->urgent_timer, wakeup_at - clock_time(),
+      urgent_wakeup_cb, (void*)conn);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Callback timer function to send the urgent packet in a
+ *               contention slot or wake-up window
+ * \param ptr    The pointer to void, the callback argument
+ * 
+ * \return     No retun value
+ */
+static void
+urgent_send_cb(void *ptr)
+{
+  struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  urgent_send(conn);
+  if (wakeup_on) {
+    ctimer_set(&conn->urgent_timer, URGENT_WAKEUP_LISTEN - URGENT_WAKEUP_GUARD,
+      urgent_sleep_cb, (void*)conn);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Callback timer function to start a wake-up window
+ * \param ptr    The pointer to void, the callback argument
+ * 
+ * \return     No retun value
+ * 
+ *             All nodes turn the radio on at the same time between epochs, to
+ *             receive and forward urgent packets. A node with a pending urgent
+ *             packet sends it after URGENT_WAKEUP_GUARD ticks.
+ */
+static void
+urgent_wakeup_cb(void *ptr)
+{
+  struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  NETSTACK_MAC.on ();
+  simple_energest_phase(SCHED_COLLECT_PHASE_IDLE);
+  wakeup_on = true;
+  if (urgent_pending) {
+    ctimer_set(&conn->urgent_timer, URGENT_WAKEUP_GUARD, urgent_send_cb,
+      (void*)conn);
+  }
+  else {
+    ctimer_set(&conn->urgent_timer, URGENT_WAKEUP_LISTEN, urgent_sleep_cb,
+      (void*)conn);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Send the packet written in the next retransmission entry
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param len    The length of the packet in bytes
+ * \param flags  The collect header flags, see collect_send()
+ * 
+ * \return     No retun value
+ * 
+ *             The packet gets the next sequence number and is kept for
+ *             retransmission, overwriting the oldest copy.
+ */
+static void
+rtx_send_next(struct sched_collect_conn *conn, uint8_t len, uint8_t flags)
+{
+  collect_send(conn, collect_seqn, rtx[rtx_next].data, len, flags);
+  rtx[rtx_next].seqn = collect_seqn;
+  rtx[rtx_next].len = len;
+  rtx[rtx_next].valid = true;
+  rtx[rtx_next].nacked = false;
+  rtx_next = (rtx_next + 1) % RTX_BUF;
+  collect_seqn++;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -349,44 +1709,156 @@ turn_radio_off_cb(void *ptr)
  *             This function will be called internally by the non-sink node to
  *             send the unicast packet scheduled,  when the sync_timer (in struct
  *             sched_collect_conn) expires. This timer is armed inside function 
- *             datacollection_green_start_cb (). 
+ *             datacollection_green_start_cb (). A copy of the packet is kept
+ *             for selective retransmission, and up to RTX_PER_SLOT packets
+ *             NACKed by the sink are resent after it, or in a join slot with
+ *             SLOT_REUSE.
  * 
  */
 
 void 
 datacollection_send_unicast_cb(void* ptr)
 {
-  int ret;
+  struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  uint8_t queued = 0;
+#if SLOT_REUSE
+  clock_time_t elapsed, at;
+#endif
+
+  /* An urgent packet goes first */
+  urgent_send(conn);
+  if (flag_buffer_full) {
+    queued = 1;
+    /* Turn -ON green LEDS to indicate actual sending of unicast data*/
+    leds_on(LEDS_GREEN);
+    printf ("sched_collect: Buffer:%d length:%d to_parent:%d \n",
+    ((test_msg_t*)rtx[rtx_next].data)->seqn, buffer_length, conn->parent);
+    rtx_send_next(conn, buffer_length,
+      (TELEMETRY_EPOCHS > 0 && tm_epochs >= TELEMETRY_EPOCHS) ?
+      COLLECT_FLAG_TELEMETRY : 0);
+
+    /* Clear buffer, now ready to accept more messages*/
+    flag_buffer_full = false;
+    buffer_length = 0;
+  }
+  else {
+    printf ("sched_collect: Buffer empty, nothing to send!!\n");
+  }
+  ctimer_stop (&conn->sync_timer);
+#if SLOT_REUSE
+  /* A cell has room for one packet, the others go in our retransmission
+   * slot or a join slot */
+  if (my_slot != SLOT_NONE) {
+    if (my_nack < fwd_nnack) {
+      at = RTX_SLOTS_START + my_nack * MAX_UNICST_PROCESSING_DELAY;
+    }
+    else if (rtx_pending()) {
+      at = JOIN_SLOTS_START +
+        (random_rand() % JOIN_SLOTS) * MAX_UNICST_PROCESSING_DELAY;
+    }
+    else {
+      return;
+    }
+    elapsed = clock_time() - collect_start;
+    ctimer_set(&conn->sync_timer, (at > elapsed) ? at - elapsed : 0,
+      rtx_send_cb, (void*)conn);
+    return;
+  }
+#endif
+  rtx_send_more(conn, queued);
+}
+
+#if SLOT_REUSE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Whether packets are waiting for retransmission or in the store
+ *
+ * \return     true if rtx_send_more() has something to send
+ */
+static bool
+rtx_pending(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < RTX_BUF; i++) {
+    if (rtx[i].valid && rtx[i].nacked) {
+      return true;
+    }
+  }
+#if STORE_SEGMENTS > 0
+  return store_count > 0;
+#else
+  return false;
+#endif
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Resend NACKed packets and drain the store
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param queued The frames already sent in the slot
+ *
+ * \return     No retun value
+ *
+ *             Up to RTX_PER_SLOT packets NACKed by the sink are resent, the
+ *             room left drains the store. A frame is only sent if it still
+ *             reaches the sink within the slot, behind the queued ones.
+ */
+static void
+rtx_send_more(struct sched_collect_conn *conn, uint8_t queued)
+{
+  uint8_t i, sent = 0, room;
+#if STORE_SEGMENTS > 0
+  uint8_t len;
+#endif
 
-  if (!flag_buffer_full) {
-    printf ("sched_collect: Buffer empty, nothing to send!!\n");
-    return;
+  /* The k-th frame of the slot arrives metric + k hop delays after it
+   * starts, of SLOT_HOPS */
+  room = (conn->metric + queued <= SLOT_HOPS) ?
+    SLOT_HOPS + 1 - conn->metric - queued : 0;
+  if (room > RTX_PER_SLOT) {
+    room = RTX_PER_SLOT;
   }
-  /* The header info to be send with the unicast data*/
-  struct collect_header hdr = {.source=linkaddr_node_addr, .hops=0};
-  struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
-  /* Turn -ON green LEDS to indicate actual sending of unicast data*/
-  leds_on(LEDS_GREEN);
-  packetbuf_clear();
-  memcpy(packetbuf_dataptr(), buffer, buffer_length);
-  printf ("sched_collect: Buffer:%d length:%d to_parent:%d \n",
-  ((test_msg_t*)buffer)->seqn, buffer_length, conn->parent);
-
-  packetbuf_set_datalen(buffer_length);
-  ret = packetbuf_hdralloc (sizeof(struct collect_header));
-  if (!ret) {
-    printf ("sched_collect: Error in allocating packet collect header! returning..\n");
-    return ret;
+  for (i = 0; i < RTX_BUF && sent < room; i++) {
+    if (rtx[i].valid && rtx[i].nacked) {
+      printf ("sched_collect: retransmitting seqn %u\n", rtx[i].seqn);
+      collect_send(conn, rtx[i].seqn, rtx[i].data, rtx[i].len, 0);
+      rtx[i].nacked = false;
+      sent++;
+    }
   }
-  memcpy(packetbuf_hdrptr(), &hdr, sizeof(struct collect_header));
-  /* Send unicast packet.*/
-  ret = unicast_send (&conn->uc, &conn->parent);
+#if STORE_SEGMENTS > 0
+  /* The room left drains the store, unless the app is writing into the
+   * next retransmission entry or has committed a packet not sent yet in it
+   * (with SLOT_REUSE this runs after the node's slot) */
+  while (sent < room && store_count > 0 && reserved_len == 0 &&
+      !flag_buffer_full) {
+    len = store_read(rtx[rtx_next].data);
+    if (len == 0) {
+      break;
+    }
+    printf ("sched_collect: sending stored packet, %u left\n", store_count);
+    rtx_send_next(conn, len, 0);
+    sent++;
+  }
+#endif
+}
 
-  /* Clear buffer, now ready to accept more messages*/
-  flag_buffer_full = false;
-  buffer_length = 0;
-  ctimer_stop (&conn->sync_timer);
+#if SLOT_REUSE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Callback timer function to resend packets in a join slot
+ * \param ptr    The pointer to void, the callback argument
+ *
+ * \return     No retun value
+ */
+static void
+rtx_send_cb(void *ptr)
+{
+  rtx_send_more((struct sched_collect_conn *)ptr, 0);
 }
+#endif
 
 /*---------------------------------------------------------------------------*/
 /**
@@ -409,8 +1881,19 @@ datacollection_green_start_cb(void *ptr)
 {
   printf ("sched_collect: Inside  datacollection_green_start_cb, node_id:%d\n", node_id);
   struct sched_collect_conn* conn = (struct sched_collect_conn* ) ptr;
+  simple_energest_phase(SCHED_COLLECT_PHASE_COLLECT);
+  tm_epochs++;
+#if SLOT_REUSE
+  nbr_age(conn);
+#endif
+  sync_on = false;
+  collect_on = true;
+  collect_start = clock_time();
   leds_off(LEDS_BLUE);
-  /* Arm timer for actual sending of unicast packet according to node_id*/
+  /* Route record of the epoch: parent the packets of this epoch go to */
+  printf("Route: %u %02x:%02x\n", conn->beacon_seqn, conn->parent.u8[0],
+    conn->parent.u8[1]);
+  /* Arm timer for actual sending of unicast packet in the node's slot*/
   ctimer_set(&conn->sync_timer, COLLECTION_SEQUENCE_DELAY,
     datacollection_send_unicast_cb, (void*)conn);
   /* Arm timer for turning off radio, after complete data collection*/
@@ -442,6 +1925,57 @@ beacon_timer_cb(void* ptr)
   ctimer_set(&conn->beacon_timer, EPOCH_DURATION, beacon_timer_cb, (void*)conn);
 }
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Rank a neighbour as alternate parent
+ * \param conn   The pointer to connection instance of type sched_collect_conn
+ * \param addr   The address of the neighbour
+ * \param metric The hop count advertised in its beacon
+ * \param rssi_alt  The RSSI of its beacon
+ * 
+ * \return     No retun value
+ * 
+ *             Only neighbours closer to the sink than this node are kept, so
+ *             that a failover cannot create a loop. The worst one is dropped
+ *             when the table is full.
+ */
+static void
+alt_parent_update(struct sched_collect_conn *conn, const linkaddr_t *addr,
+  uint16_t metric, int16_t rssi_alt)
+{
+  uint8_t i, j;
+
+  if (metric >= conn->metric || linkaddr_cmp(addr, &conn->parent)) {
+    return;
+  }
+  /* Remove the old entry of the neighbour, if any */
+  for (i = 0; i < alt_count; i++) {
+    if (linkaddr_cmp(&alt_parent[i].addr, addr)) {
+      alt_count--;
+      memmove(&alt_parent[i], &alt_parent[i + 1],
+        (alt_count - i) * sizeof(alt_parent[0]));
+      break;
+    }
+  }
+  for (i = 0; i < alt_count; i++) {
+    if (metric < alt_parent[i].metric ||
+        (metric == alt_parent[i].metric && rssi_alt > alt_parent[i].rssi)) {
+      break;
+    }
+  }
+  if (i >= PARENTS_MAX) {
+    return;
+  }
+  j = (alt_count < PARENTS_MAX) ? alt_count : PARENTS_MAX - 1;
+  memmove(&alt_parent[i + 1], &alt_parent[i], (j - i) * sizeof(alt_parent[0]));
+  linkaddr_copy(&alt_parent[i].addr, addr);
+  alt_parent[i].metric = metric;
+  alt_parent[i].rssi = rssi_alt;
+  if (alt_count < PARENTS_MAX) {
+    alt_count++;
+  }
+}
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief        Broadcast recieve callback (to receive beacons by non-sink node)
@@ -467,8 +2001,16 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
   bc_recv_ts_t1_temp = clock_time ();
   printf("sched_collect:bc_recv_ts_t1_temp:%u\n", bc_recv_ts_t1_temp);
   struct beacon_msg beacon;
+  struct slot_assign assign[SLOT_ASSIGN_MAX];
+  struct nack nacks[NACK_MAX];
+  const uint8_t *p;
   int16_t rssi_temp;
+  uint8_t i, j, k;
   bool flag_propogate = 0;
+  linkaddr_t addr;
+#if SCHED_COLLECT_SEC_MIC_LEN
+  uint16_t sec_seqn;
+#endif
   /* Get the pointer to the overall structure sched_collect from its field bc */
   struct sched_collect_conn* conn = (struct sched_collect_conn*)(((uint8_t*)bc_conn) - 
     offsetof(struct sched_collect_conn, bc));
@@ -479,11 +2021,62 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
     return;
   }
 
-  if (packetbuf_datalen() != sizeof(struct beacon_msg)) {
+  if (packetbuf_datalen() < sizeof(struct beacon_msg)) {
     printf("sched_collect: broadcast of wrong size\n");
     return;
   }
+#if SCHED_COLLECT_SEC_MIC_LEN
+  /* Opened after the reception time stamp: the time is part of the
+   * forwarding delay */
+  if (!sec_open(sender, SEC_KIND_BEACON, (uint8_t *)packetbuf_dataptr(),
+      sizeof(beacon.seqn), sizeof(beacon.seqn), &sec_seqn)) {
+    printf("sched_collect: forged beacon from %02x:%02x\n",
+      sender->u8[0], sender->u8[1]);
+    return;
+  }
+#endif
   memcpy(&beacon, packetbuf_dataptr(), sizeof(struct beacon_msg));
+  if (beacon.nassign > SLOT_ASSIGN_MAX || beacon.nnack > NACK_MAX ||
+      packetbuf_datalen() != sizeof(struct beacon_msg) +
+      beacon.nassign * sizeof(struct slot_assign) +
+      beacon.nnack * sizeof(struct nack)) {
+    printf("sched_collect: broadcast of wrong size\n");
+    return;
+  }
+  p = (const uint8_t *)packetbuf_dataptr() + sizeof(struct beacon_msg);
+  memcpy(assign, p, beacon.nassign * sizeof(struct slot_assign));
+  p += beacon.nassign * sizeof(struct slot_assign);
+  memcpy(nacks, p, beacon.nnack * sizeof(struct nack));
+  /* Our slot may be announced in any beacon of the sink's flood */
+  for (i = 0; i < beacon.nassign; i++) {
+    addr = assign[i].addr;
+    if (linkaddr_cmp(&addr, &linkaddr_node_addr) &&
+        my_slot != assign[i].slot) {
+      my_slot = assign[i].slot;
+      printf("sched_collect: assigned slot %u\n", my_slot);
+    }
+  }
+  /* Mark our packets NACKed by the sink for retransmission */
+  for (i = 0; i < beacon.nnack; i++) {
+    addr = nacks[i].addr;
+    if (!linkaddr_cmp(&addr, &linkaddr_node_addr)) {
+      continue;
+    }
+    for (j = 0; j < NACK_WINDOW; j++) {
+      if (!(nacks[i].missing & (1 << j))) {
+        continue;
+      }
+      for (k = 0; k < RTX_BUF; k++) {
+        if (rtx[k].valid && rtx[k].seqn == (uint8_t)(nacks[i].last - 1 - j)) {
+          rtx[k].nacked = true;
+        }
+      }
+    }
+  }
+#if SLOT_REUSE
+  /* Any sender heard, weak links included, may interfere */
+  nbr_note(sender, beacon.seqn);
+#endif
   rssi_temp = packetbuf_attr(PACKETBUF_ATTR_RSSI);
   printf("sched_collect: recv beacon from %02x:%02x seqn %u metric %u delay :%u rssi_temp %d \n", 
       sender->u8[0], sender->u8[1], 
@@ -533,8 +2126,9 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
 
   if (flag_propogate) {
 
+    simple_energest_phase(SCHED_COLLECT_PHASE_SYNC);
     bc_recv_ts_tforward = BEACON_FORWARD_DELAY;
-    if (bc_recv_ts_tforward < (PREPROCESSING_DELAY + POSTPROCESSING_DELAY)) {
+    if (bc_recv_ts_tforward <= (PREPROCESSING_DELAY + POSTPROCESSING_DELAY)) {
       /* To avoid negative delay bc_recv_ts_tforward is assigned 0*/
       bc_recv_ts_tforward = 0;
     }
@@ -551,9 +2145,12 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
      */
     conn->received_packet_from_parent_delay =  beacon.delay;
     bc_recv_delay = beacon.delay;
-    /* bc_recv_metric is calculated to adjust the time-sync based on hop count */
-    bc_recv_metric = beacon.metric * 20;
+    /* The slots of this epoch follow the sink's per-hop data delay */
+    if (beacon.hop_delay) {
+      uc_hop_delay = beacon.hop_delay;
+    }
     /* Beacon propogate timer*/
+    delay_est_update(&est_pre, clock_time() - bc_recv_ts_t1_temp);
     ctimer_set(&conn->beacon_timer, bc_recv_ts_tforward, beacon_forward_timer_cb, (void*) conn);
    
     /*common data collection  timer*/
@@ -561,17 +2158,473 @@ bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
           datacollection_green_start_cb, (void*) conn);
       
     conn->metric = beacon.metric + 1;
-    conn->beacon_seqn = beacon.seqn;
+    slot_count = beacon.slots;
+    fwd_nassign = beacon.nassign;
+    memcpy(fwd_assign, assign, beacon.nassign * sizeof(struct slot_assign));
+    fwd_nnack = beacon.nnack;
+    memcpy(fwd_nack, nacks, beacon.nnack * sizeof(struct nack));
+#if SLOT_REUSE
+    for (my_nack = 0; my_nack < beacon.nnack; my_nack++) {
+      addr = nacks[my_nack].addr;
+      if (linkaddr_cmp(&addr, &linkaddr_node_addr)) {
+        break;
+      }
+    }
+    if (my_nack == beacon.nnack) {
+      my_nack = NACK_MAX;
+    }
+#endif
     conn->parent.u8[0] = sender->u8[0];
     conn->parent.u8[1] = sender->u8[1];
+    /* Alternate parents: start over in a new epoch, on a better parent
+     * keep those still closer to the sink. The old parent is not: it is no
+     * closer than the new one */
+    if (beacon.seqn != conn->beacon_seqn) {
+      alt_count = 0;
+    }
+    else {
+      for (i = 0; i < alt_count; ) {
+        if (alt_parent[i].metric >= conn->metric ||
+            linkaddr_cmp(&alt_parent[i].addr, &conn->parent)) {
+          alt_count--;
+          memmove(&alt_parent[i], &alt_parent[i + 1],
+            (alt_count - i) * sizeof(alt_parent[0]));
+        }
+        else {
+          i++;
+        }
+      }
+    }
+    conn->beacon_seqn = beacon.seqn;
     /* The time stamp when entering bc_recv()*/ 
     bc_recv_ts_t1 = bc_recv_ts_t1_temp;
     rssi = rssi_temp;
+    /* The parent is listening until the end of the collection window */
+    sync_on = true;
+    urgent_send(conn);
+  }
+  else if (rssi_temp >= RSSI_THRESHOLD && beacon.seqn == conn->beacon_seqn) {
+    /* Another neighbour synchronised in this epoch */
+    alt_parent_update(conn, sender, beacon.metric, rssi_temp);
   }
 
   
 }
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Update the sink's slot table with a received data packet
+ * \param source   The originator of the packet
+ * \param slotted  Whether the packet was sent in the source's assigned slot
+ * 
+ * \return     The slot of the source, SLOT_NONE if the table is full
+ * 
+ *            A source heard for the first time gets the next free slot, to be
+ *            announced in the following beacons; the announcements stop once
+ *            the source sends in its slot. The window grows with the number
+ *            of nodes actually heard, up to MAX_NODES slots.
+ */
+static uint16_t
+slot_update(const linkaddr_t *source, bool slotted)
+{
+  uint16_t i;
+
+  for (i = 0; i < owner_count; i++) {
+    if (linkaddr_cmp(&slot_owner[i], source)) {
+      slot_used[i] = slot_used[i] || slotted;
+      return i;
+    }
+  }
+  if (owner_count >= MAX_NODES) {
+    printf("sched_collect: slot table full, %02x:%02x keeps joining\n",
+      source->u8[0], source->u8[1]);
+    return SLOT_NONE;
+  }
+  linkaddr_copy(&slot_owner[owner_count], source);
+  slot_used[owner_count] = false;
+  rx_valid[owner_count] = false;
+#if SLOT_REUSE
+  /* Its cell comes with the next schedule */
+  slot_cell[owner_count] = SLOT_NONE;
+  nbr_depth[owner_count] = 0;
+  memset(nbr_bits[owner_count], 0, NBR_BITS_SIZE);
+  memset(nbr_parents[owner_count], 0, NBR_BITS_SIZE);
+  slot_dirty = true;
+#else
+  slot_count = owner_count + 1;
+#endif
+  printf("sched_collect: slot %u to %02x:%02x\n", owner_count,
+    source->u8[0], source->u8[1]);
+  return owner_count++;
+}
+
+#if SLOT_REUSE
+#define NBR_TEST(bits, i) ((bits)[(i) / 8] & (1 << ((i) % 8)))
+#define NBR_SET(bits, i) ((bits)[(i) / 8] |= 1 << ((i) % 8))
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Record the neighbourhood reported by a node
+ * \param slot     The slot table entry of the node
+ * \param nr       The report
+ * \param addrs    The nr->count addresses following the report
+ * 
+ * \return     No retun value
+ * 
+ *            Neighbours not in the slot table get an entry, as they forward
+ *            beacons and will send too. The schedule is recomputed if the
+ *            neighbours or the parents changed. The slot reported confirms the node's cell,
+ *            which is no longer announced.
+ */
+static void
+nbr_report(uint16_t slot, const struct collect_neighbours *nr,
+  const uint8_t *addrs)
+{
+  uint8_t bits[NBR_BITS_SIZE], parents[NBR_BITS_SIZE];
+  linkaddr_t addr;
+  uint16_t j;
+  uint8_t i;
+
+  memset(bits, 0, sizeof(bits));
+  memset(parents, 0, sizeof(parents));
+  for (i = 0; i < nr->count; i++) {
+    memcpy(&addr, addrs + i * sizeof(linkaddr_t), sizeof(linkaddr_t));
+    j = linkaddr_cmp(&addr, &sink_node) ? NBR_SINK : slot_update(&addr, false);
+    if (j != SLOT_NONE && j != slot) {
+      NBR_SET(bits, j);
+      if (nr->parents & (1 << i)) {
+        NBR_SET(parents, j);
+      }
+    }
+  }
+  if (memcmp(nbr_bits[slot], bits, NBR_BITS_SIZE) ||
+      memcmp(nbr_parents[slot], parents, NBR_BITS_SIZE)) {
+    memcpy(nbr_bits[slot], bits, NBR_BITS_SIZE);
+    memcpy(nbr_parents[slot], parents, NBR_BITS_SIZE);
+    slot_dirty = true;
+  }
+  slot_used[slot] = slot_used[slot] || nr->slot == slot_cell[slot];
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Closed neighbourhood of a set of nodes
+ * \param set      The nodes, bit NBR_SINK for the sink
+ * \param near     Filled with the nodes of set and those heard by or
+ *                 hearing one of them
+ * 
+ * \return     No retun value
+ */
+static void
+nbr_near(const uint8_t *set, uint8_t *near)
+{
+  uint16_t i;
+  uint8_t k;
+
+  memcpy(near, set, NBR_BITS_SIZE);
+  for (i = 0; i < owner_count; i++) {
+    if (NBR_TEST(set, i)) {
+      for (k = 0; k < NBR_BITS_SIZE; k++) {
+        near[k] |= nbr_bits[i][k];
+      }
+      continue;
+    }
+    for (k = 0; k < NBR_BITS_SIZE; k++) {
+      if (nbr_bits[i][k] & set[k]) {
+        NBR_SET(near, i);
+        break;
+      }
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Nodes involved in each hop of the packets of a source
+ * \param v        The slot table entry of the source
+ * \param hop      Filled with the nodes sending or receiving hop k
+ * \param near     Filled with those and their neighbours
+ * 
+ * \return     The number of hops, MAX_HOPS with every node in all of them
+ *             if the neighbourhood of the source is unknown or its packets
+ *             may take more than MAX_HOPS hops
+ * 
+ *            The nodes that may carry the packet at hop k + 1 are the
+ *            parents of those at hop k in the last epochs, or if a node did
+ *            not report them, its neighbours closer to the sink. The packet
+ *            has arrived once only the sink is left.
+ */
+static uint8_t
+slot_hops(uint16_t v, uint8_t hop[][NBR_BITS_SIZE], uint8_t near[][NBR_BITS_SIZE])
+{
+  uint8_t from[NBR_BITS_SIZE], reach[NBR_BITS_SIZE];
+  uint8_t hops = 0, k, b;
+  uint16_t i, j;
+  bool any = true;
+
+  memset(hop[0], 0, NBR_BITS_SIZE);
+  if (nbr_depth[v] > 0) {
+    NBR_SET(hop[0], v);
+  }
+  memcpy(from, hop[0], NBR_BITS_SIZE);
+  for (k = 0; k < MAX_HOPS && any; k++) {
+    memset(hop[k + 1], 0, NBR_BITS_SIZE);
+    for (i = 0; i < owner_count; i++) {
+      if (!NBR_TEST(from, i)) {
+        continue;
+      }
+      for (b = 0; b < NBR_BITS_SIZE && !nbr_parents[i][b]; b++);
+      if (b < NBR_BITS_SIZE) {
+        for (b = 0; b < NBR_BITS_SIZE; b++) {
+          hop[k + 1][b] |= nbr_parents[i][b];
+        }
+        continue;
+      }
+      memset(reach, 0, NBR_BITS_SIZE);
+      NBR_SET(reach, i);
+      nbr_near(reach, reach);
+      if (NBR_TEST(reach, NBR_SINK)) {
+        NBR_SET(hop[k + 1], NBR_SINK);
+      }
+      for (j = 0; j < owner_count; j++) {
+        if (NBR_TEST(reach, j) && nbr_depth[j] > 0 &&
+            nbr_depth[j] < nbr_depth[i]) {
+          NBR_SET(hop[k + 1], j);
+        }
+      }
+    }
+    /* The packets still on their way */
+    memcpy(from, hop[k + 1], NBR_BITS_SIZE);
+    from[NBR_SINK / 8] &= ~(1 << (NBR_SINK % 8));
+    for (b = 0, any = false; b < NBR_BITS_SIZE && !any; b++) {
+      any = from[b] != 0;
+    }
+    if (!any && NBR_TEST(hop[k + 1], NBR_SINK)) {
+      hops = k + 1;
+    }
+  }
+  if (hops == 0) {
+    memset(hop, 0xff, MAX_HOPS * NBR_BITS_SIZE);
+    memset(near, 0xff, MAX_HOPS * NBR_BITS_SIZE);
+    return MAX_HOPS;
+  }
+  for (k = 0; k < hops; k++) {
+    for (b = 0; b < NBR_BITS_SIZE; b++) {
+      hop[k][b] |= hop[k + 1][b];
+    }
+    nbr_near(hop[k], near[k]);
+  }
+  return hops;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Whether the hops of a source fit from a cell
+ * \param hop      The nodes sending or receiving each hop
+ * \param hops     The number of hops
+ * \param start    The cell of the first hop
+ * \param cells    The cells in use so far
+ * 
+ * \return     true if no node of hop k is within one hop of a node busy in
+ *             cell start + k or the SLOT_REUSE_SPREAD cells around it
+ */
+static bool
+slot_fits(uint8_t hop[][NBR_BITS_SIZE], uint8_t hops, uint16_t start,
+  uint16_t cells)
+{
+  uint16_t cell, j;
+  uint8_t k, b;
+
+  for (k = 0; k < hops; k++) {
+    cell = start + k;
+    j = (cell > SLOT_REUSE_SPREAD) ? cell - SLOT_REUSE_SPREAD : 0;
+    for (; j <= cell + SLOT_REUSE_SPREAD && j < cells; j++) {
+      for (b = 0; b < NBR_BITS_SIZE; b++) {
+        if (hop[k][b] & cell_busy[j][b]) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Place the sources in the cells
+ * \param cell     Filled with the first cell of each source
+ * \param keep     Whether a source keeps its cell (slot_cell) if it fits
+ * 
+ * \return     The number of cells used, more than SLOT_CELLS_MAX if the
+ *             cells kept leave no room
+ * 
+ *            Sources are placed deepest first, those kept before the others,
+ *            each of which takes the earliest cell all its hops fit from.
+ */
+static uint16_t
+slot_place(uint16_t *cell, bool keep)
+{
+  uint16_t order[MAX_NODES];
+  bool placed[MAX_NODES];
+  uint8_t hop[MAX_HOPS + 1][NBR_BITS_SIZE];
+  uint8_t near[MAX_HOPS][NBR_BITS_SIZE];
+  uint16_t i, j, v, start, cells = 0;
+  uint8_t hops, k, b, pass;
+
+  /* Deepest first, unreached ones last */
+  for (i = 0; i < owner_count; i++) {
+    for (j = i; j > 0 && nbr_depth[order[j - 1]] < nbr_depth[i]; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+    placed[i] = false;
+  }
+  memset(cell_busy, 0, sizeof(cell_busy));
+  for (pass = keep ? 0 : 1; pass < 2; pass++) {
+    for (i = 0; i < owner_count; i++) {
+      v = order[i];
+      if (placed[v] || (pass == 0 && slot_cell[v] == SLOT_NONE)) {
+        continue;
+      }
+      hops = slot_hops(v, hop, near);
+      if (pass == 0) {
+        start = slot_cell[v];
+        if (start + hops > SLOT_CELLS_MAX ||
+            !slot_fits(hop, hops, start, cells)) {
+          continue;
+        }
+      }
+      else {
+        /* Past the cells in use everything fits */
+        for (start = 0; !slot_fits(hop, hops, start, cells); start++);
+        if (start + hops > SLOT_CELLS_MAX) {
+          return SLOT_CELLS_MAX + 1;
+        }
+      }
+      for (k = 0; k < hops; k++) {
+        for (b = 0; b < NBR_BITS_SIZE; b++) {
+          cell_busy[start + k][b] |= near[k][b];
+        }
+      }
+      if (start + hops > cells) {
+        cells = start + hops;
+      }
+      cell[v] = start;
+      placed[v] = true;
+    }
+  }
+  return cells;
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief      Compute the cells of the slot table from the neighbourhoods
+ * 
+ * \return     No retun value
+ * 
+ *            The hop counts are those of the shortest paths to the sink in
+ *            the graph of the neighbours reported, which is stabler than the
+ *            routes of the single epochs. The sources keep their cells unless
+ *            the window would be much longer than with all of them placed
+ *            again, so that few assignments change with the network. A node
+ *            whose cell changes is announced again.
+ */
+static void
+slot_schedule(void)
+{
+  uint16_t fresh[MAX_NODES], kept[MAX_NODES], *cell;
+  uint16_t fresh_count, kept_count, i;
+  uint8_t reached[NBR_BITS_SIZE], next[NBR_BITS_SIZE], depth, b;
+  bool grown = true;
+
+  /* Hop counts, breadth first from the sink */
+  memset(reached, 0, NBR_BITS_SIZE);
+  NBR_SET(reached, NBR_SINK);
+  memset(nbr_depth, 0, sizeof(nbr_depth));
+  for (depth = 1; grown && depth < 255; depth++) {
+    nbr_near(reached, next);
+    grown = false;
+    for (i = 0; i < owner_count; i++) {
+      if (NBR_TEST(next, i) && !nbr_depth[i]) {
+        nbr_depth[i] = depth;
+        grown = true;
+      }
+    }
+    for (b = 0; b < NBR_BITS_SIZE; b++) {
+      reached[b] |= next[b];
+    }
+  }
+
+  /* Up to an eighth more cells are worth the assignments not changed */
+  fresh_count = slot_place(fresh, false);
+  kept_count = slot_place(kept, true);
+  if (kept_count <= fresh_count + fresh_count / 8) {
+    cell = kept;
+    slot_count = kept_count;
+  }
+  else {
+    cell = fresh;
+    slot_count = fresh_count;
+  }
+  /* Never longer than the exclusive slots, which it falls back to */
+  if ((uint32_t)slot_count * SLOT_LENGTH >
+      (uint32_t)owner_count * MAX_UNICST_PROCESSING_DELAY) {
+    fresh_count = (MAX_UNICST_PROCESSING_DELAY + SLOT_LENGTH - 1) / SLOT_LENGTH;
+    for (i = 0; i < owner_count; i++) {
+      fresh[i] = i * fresh_count;
+    }
+    cell = fresh;
+    slot_count = owner_count * fresh_count;
+  }
+  for (i = 0; i < owner_count; i++) {
+    if (slot_cell[i] != cell[i]) {
+      slot_cell[i] = cell[i];
+      slot_used[i] = false;
+    }
+  }
+  slot_dirty = false;
+  printf("sched_collect: %u cells for %u slots\n", slot_count, owner_count);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Record a packet in the reception window of its source
+ * \param slot     The slot of the source
+ * \param seqn     The per-source sequence number of the packet
+ * 
+ * \return     false if the packet was already received (duplicate)
+ * 
+ *            The window starts full at the first packet of a source, so that
+ *            only losses after it are NACKed. Packets older than the window
+ *            are accepted as they cannot be told apart from new ones.
+ */
+static bool
+rx_window_update(uint16_t slot, uint8_t seqn)
+{
+  uint8_t ahead = seqn - rx_last[slot];
+
+  if (!rx_valid[slot]) {
+    rx_valid[slot] = true;
+    rx_last[slot] = seqn;
+    rx_mask[slot] = 0xffff;
+    return true;
+  }
+  if (ahead > 0 && ahead < 128) {
+    /* Newer packet: slide the window */
+    rx_mask[slot] = (ahead < 16) ? (rx_mask[slot] << ahead) | 1 : 1;
+    rx_last[slot] = seqn;
+    return true;
+  }
+  ahead = rx_last[slot] - seqn;
+  if (ahead < 16) {
+    if (rx_mask[slot] & (1 << ahead)) {
+      return false;
+    }
+    rx_mask[slot] |= 1 << ahead;
+  }
+  return true;
+}
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief          Unicast recieve callback (to receive data send by non-sink nodes)
@@ -596,6 +2649,13 @@ uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
     offsetof(struct sched_collect_conn, uc));
 
   struct collect_header hdr;
+  linkaddr_t source;
+  uint16_t slot;
+  clock_time_t t_recv = clock_time();
+#if SCHED_COLLECT_SEC_MIC_LEN
+  struct sec_data_auth auth;
+  uint16_t epoch;
+#endif
 
   if (packetbuf_datalen() < sizeof(struct collect_header)) {
     printf("sched_collect: too short unicast packet %d\n", packetbuf_datalen());
@@ -613,14 +2673,182 @@ uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
  
   if (linkaddr_cmp (&sink_node, &linkaddr_node_addr)) {
     packetbuf_hdrreduce (sizeof(struct collect_header));
+    source = hdr.source;
+#if SCHED_COLLECT_SEC_MIC_LEN
+    /* Nothing of a forged or replayed packet is taken into account */
+    auth.source = hdr.source;
+    auth.flags = hdr.flags;
+    auth.seqn = hdr.seqn;
+    if (!sec_open(&source, SEC_KIND_DATA, (uint8_t *)&auth, sizeof(auth),
+        0, &epoch)) {
+      printf("sched_collect: forged packet from %02x:%02x\n",
+        hdr.source.u8[0], hdr.source.u8[1]);
+      return;
+    }
+    if ((int16_t)(conn->beacon_seqn - epoch) < 0 ||
+        (int16_t)(conn->beacon_seqn - epoch) > SEC_EPOCH_WINDOW) {
+      printf("sched_collect: stale packet from %02x:%02x epoch %u\n",
+        hdr.source.u8[0], hdr.source.u8[1], epoch);
+      return;
+    }
+    delay_est_update(&est_sec, clock_time() - t_recv);
+#endif
+    /* With SLOT_REUSE the neighbour report confirms the cell instead */
+    slot = slot_update(&source,
+      !SLOT_REUSE && (hdr.flags & COLLECT_FLAG_SLOTTED));
+    if (hdr.flags & COLLECT_FLAG_URGENT) {
+      printf("sched_collect: urgent packet from %02x:%02x\n",
+        hdr.source.u8[0], hdr.source.u8[1]);
+    }
+    else if (slot != SLOT_NONE && !rx_window_update(slot, hdr.seqn)) {
+      printf("sched_collect: duplicate seqn %u from %02x:%02x\n", hdr.seqn,
+        hdr.source.u8[0], hdr.source.u8[1]);
+      return;
+    }
+    if (hdr.hop_delay) {
+      delay_est_update(&est_uc_net, hdr.hop_delay);
+    }
+    if ((hdr.flags & COLLECT_FLAG_TELEMETRY) &&
+        packetbuf_datalen() >= sizeof(struct collect_telemetry)) {
+      struct collect_telemetry tm;
+      memcpy(&tm, packetbuf_dataptr(), sizeof(struct collect_telemetry));
+      packetbuf_hdrreduce (sizeof(struct collect_telemetry));
+      /* Telemetry record: source hops epoch radio_on time retries drops
+       * parent rssi */
+      printf("Telemetry: %02x:%02x %u %u %lu %lu %u %u %02x:%02x %d\n",
+        hdr.source.u8[0], hdr.source.u8[1], hdr.hops, tm.epoch,
+        (unsigned long)tm.radio_on, (unsigned long)tm.time, tm.retries,
+        tm.drops, tm.parent.u8[0], tm.parent.u8[1], tm.rssi);
+    }
+#if SLOT_REUSE
+    if ((hdr.flags & COLLECT_FLAG_NEIGHBOURS) &&
+        packetbuf_datalen() >= sizeof(struct collect_neighbours)) {
+      struct collect_neighbours nr;
+      memcpy(&nr, packetbuf_dataptr(), sizeof(struct collect_neighbours));
+      if (nr.count <= NBR_MAX && packetbuf_datalen() >=
+          sizeof(struct collect_neighbours) + nr.count * sizeof(linkaddr_t)) {
+        if (slot != SLOT_NONE) {
+          nbr_report(slot, &nr, (const uint8_t *)packetbuf_dataptr() +
+            sizeof(struct collect_neighbours));
+        }
+        packetbuf_hdrreduce(sizeof(struct collect_neighbours) +
+          nr.count * sizeof(linkaddr_t));
+      }
+    }
+#endif
     conn->callbacks->recv (&hdr.source, hdr.hops);
   }
   else {
     hdr.hops += 1;
+    if (DELAY_EST(est_uc_hop) > hdr.hop_delay) {
+      hdr.hop_delay = DELAY_EST(est_uc_hop);
+    }
     memcpy(packetbuf_dataptr(), &hdr, sizeof(struct collect_header));
-    unicast_send (&conn->uc, &conn->parent);
+    collect_unicast(conn, false, t_recv);
+    /* Forwarding in a wake-up window: listen for one more window, unless
+     * our own urgent packet is about to be sent (its timer ends it) */
+    if (wakeup_on && (hdr.flags & COLLECT_FLAG_URGENT) &&
+        !(urgent_pending && !urgent_inflight)) {
+      ctimer_set(&conn->urgent_timer, URGENT_WAKEUP_LISTEN, urgent_sleep_cb,
+        (void*)conn);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Unicast sent callback (MAC outcome of a data packet)
+ * \param uc_conn  The pointer to unicast_conn instance, which was used to send
+ * \param status   The MAC transmission status
+ * \param num_tx   The number of transmissions, including retransmissions
+ * 
+ * \return     No retun value
+ * 
+ *            Counts the retransmissions and the packets not acknowledged by
+ *            the parent, for both own and forwarded packets, for telemetry.
+ *            A packet not acknowledged by the parent is resent to the best
+ *            alternate parent, which replaces it; a packet sent to a parent
+ *            that was already replaced just follows the new one. The urgent
+ *            packet is released once a parent acknowledged it.
+ */
+
+void
+uc_sent(struct unicast_conn *uc_conn, int status, int num_tx)
+{
+  struct sched_collect_conn* conn = (struct sched_collect_conn*)(((uint8_t*)uc_conn) - 
+    offsetof(struct sched_collect_conn, uc));
+  const linkaddr_t *to = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
+  uint8_t i, j;
+  bool urgent;
+
+  if (num_tx > 1) {
+    tm_retries = (tm_retries + num_tx - 1 > 255) ? 255 : tm_retries + num_tx - 1;
+  }
+  /* The oldest copy sent to this receiver */
+  i = TX_INFLIGHT;
+  for (j = 0; j < TX_INFLIGHT; j++) {
+    if (tx_copy[j].used && linkaddr_cmp(&tx_copy[j].to, to) &&
+        (i == TX_INFLIGHT || (int8_t)(tx_copy[j].order - tx_copy[i].order) < 0)) {
+      i = j;
+    }
+  }
+  if (i == TX_INFLIGHT) {
+    return;
+  }
+  tx_copy[i].used = false;
+  tx_count--;
+  urgent = tx_copy[i].urgent;
+  if (urgent) {
+    urgent_inflight = false;
+  }
+  if (status == MAC_TX_OK) {
+    delay_est_update(&est_uc_hop, clock_time() - tx_copy[i].t0);
+    if (urgent) {
+      urgent_pending = false;
+    }
+    return;
+  }
+
+  if (linkaddr_cmp(&tx_copy[i].to, &conn->parent) && alt_count > 0) {
+    printf ("sched_collect: parent %02x:%02x failed, switching to %02x:%02x\n",
+      conn->parent.u8[0], conn->parent.u8[1],
+      alt_parent[0].addr.u8[0], alt_parent[0].addr.u8[1]);
+    conn->parent = alt_parent[0].addr;
+    printf("Route: %u %02x:%02x\n", conn->beacon_seqn, conn->parent.u8[0],
+      conn->parent.u8[1]);
+    alt_count--;
+    memmove(&alt_parent[0], &alt_parent[1], alt_count * sizeof(alt_parent[0]));
+  }
+  if (!linkaddr_cmp(&tx_copy[i].to, &conn->parent)) {
+    packetbuf_clear();
+    packetbuf_copyfrom(tx_copy[i].data, tx_copy[i].len);
+    collect_unicast(conn, urgent, clock_time());
+    return;
+  }
+  if (tm_drops < 255) {
+    tm_drops++;
   }
 }
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief          Broadcast sent callback (end of a beacon transmission)
+ * \param bc_conn  The pointer to broadcast_conn instance, which was used to send
+ * \param status   The MAC transmission status
+ * \param num_tx   The number of transmissions
+ * 
+ * \return     No retun value
+ * 
+ *            Measures BEACON_HOP_DELAY, from the moment the delay of the
+ *            beacon was stamped to the end of its transmission.
+ */
+
+void
+bc_sent(struct broadcast_conn *bc_conn, int status, int num_tx)
+{
+  if (status == MAC_TX_OK) {
+    delay_est_update(&est_bc_hop, clock_time() - bc_tx_stamp);
+  }
+}
 
-/** @} */
\ No newline at end of file
+/** @} */
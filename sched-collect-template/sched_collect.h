@@ -19,12 +19,69 @@
 #define MAX_HOPS 4
 #define MAX_NODES 9
 #endif
+/* MAX_NODES bounds the sink's slot table: slots are assigned at runtime to
+ * the nodes actually heard, so it is a capacity, not the window size.
+ * The network size can also be set from the build, e.g. by the simulator */
+#ifdef SCHED_COLLECT_CONF_MAX_HOPS
+#undef MAX_HOPS
+#define MAX_HOPS SCHED_COLLECT_CONF_MAX_HOPS
+#endif
+#ifdef SCHED_COLLECT_CONF_MAX_NODES
+#undef MAX_NODES
+#define MAX_NODES SCHED_COLLECT_CONF_MAX_NODES
+#endif
+/*---------------------------------------------------------------------------*/
+/* Phases of the epoch, accounted separately by simple-energest:
+ * listening for the beacon after the radio is turned on (and before the
+ * first beacon), beacon propagation, data collection and radio off.
+ * The sink keeps its radio on and stays in the first phase. */
+enum {
+  SCHED_COLLECT_PHASE_IDLE,
+  SCHED_COLLECT_PHASE_SYNC,
+  SCHED_COLLECT_PHASE_COLLECT,
+  SCHED_COLLECT_PHASE_OFF,
+};
+/*---------------------------------------------------------------------------*/
+/* Priority of a packet given to sched_collect_send_prio(): urgent packets
+ * skip the regular buffer and are sent at the first contention slot or
+ * wake-up window, also between epochs */
+enum {
+  SCHED_COLLECT_PRIO_NORMAL,
+  SCHED_COLLECT_PRIO_URGENT,
+};
+/*---------------------------------------------------------------------------*/
+/* Authentication and encryption of beacons and data with CCM*: length of
+ * the MIC (4, 8 or 16 bytes), 0 disables security. A secured frame also
+ * carries the epoch and a frame counter (3 bytes) for the nonce. All nodes
+ * share SCHED_COLLECT_SEC_KEY (16 bytes), which has no default */
+#ifdef SCHED_COLLECT_CONF_SEC_MIC_LEN
+#define SCHED_COLLECT_SEC_MIC_LEN SCHED_COLLECT_CONF_SEC_MIC_LEN
+#else
+#define SCHED_COLLECT_SEC_MIC_LEN 0
+#endif
+#if SCHED_COLLECT_SEC_MIC_LEN
+#define SCHED_COLLECT_SEC_OVERHEAD (3 + SCHED_COLLECT_SEC_MIC_LEN)
+#else
+#define SCHED_COLLECT_SEC_OVERHEAD 0
+#endif
+/*---------------------------------------------------------------------------*/
+/* Largest application record: an 802.15.4 frame (127 bytes) less the MAC
+ * header and FCS (11), the Rime unicast header (6), the collect header and
+ * telemetry report (21) and the security overhead */
+#ifdef SCHED_COLLECT_CONF_MAX_PAYLOAD
+#define SCHED_COLLECT_MAX_PAYLOAD SCHED_COLLECT_CONF_MAX_PAYLOAD
+#else
+#define SCHED_COLLECT_MAX_PAYLOAD (89 - SCHED_COLLECT_SEC_OVERHEAD)
+#endif
 /*---------------------------------------------------------------------------*/
 #define COLLECT_CHANNEL 0xAA
 /*---------------------------------------------------------------------------*/
-/* Callback structure */
+/* Callback structure: recv is called on the sink, active on the other
+ * nodes when they wake up for the next epoch, so that the application can
+ * queue its packet without waking the CPU during the radio-off period */
 struct sched_collect_callbacks {
   void (* recv)(const linkaddr_t *originator, uint8_t hops);
+  void (* active)(void);
 };
 /*---------------------------------------------------------------------------*/
 /* Connection object */
@@ -36,6 +93,7 @@ struct sched_collect_conn {
   struct ctimer beacon_timer;
   struct ctimer sync_timer;
   struct ctimer radio_timer;
+  struct ctimer urgent_timer;
   uint16_t metric;
   uint16_t beacon_seqn;
   uint16_t received_packet_from_parent_delay;
@@ -46,7 +104,8 @@ struct sched_collect_conn {
  *  - conn -- a pointer to a connection object
  *  - channels -- starting channel C (the collect uses two: C and C+1)
  *  - is_sink -- initialize in either sink or router mode
- *  - callbacks -- a pointer to the callback structure */
+ *  - callbacks -- a pointer to the callback structure (may be NULL on
+ *                 the other nodes) */
 void sched_collect_open(
     struct sched_collect_conn* conn,
     uint16_t channels,
@@ -67,4 +126,47 @@ int sched_collect_send(
     uint8_t *data,
     uint8_t len);
 /*---------------------------------------------------------------------------*/
+/* Send packet to the sink with the given priority
+ * Parameters:
+ *  - conn -- a pointer to a connection object
+ *  - data -- a pointer to the data packet to be sent
+ *  - len  -- data length to be send in bytes
+ *  - prio -- SCHED_COLLECT_PRIO_NORMAL (same as sched_collect_send) or
+ *            SCHED_COLLECT_PRIO_URGENT
+ *
+ * Returns zero if the packet cannot be stored nor sent, e.g. because an
+ * urgent packet is still pending. Non-zero otherwise.
+ */
+int sched_collect_send_prio(
+    struct sched_collect_conn *c,
+    uint8_t *data,
+    uint8_t len,
+    uint8_t prio);
+/*---------------------------------------------------------------------------*/
+/* Reserve room for a packet in the slot buffer, to be written in place
+ * Parameters:
+ *  - conn -- a pointer to a connection object
+ *  - len  -- the largest length the record may have, in bytes
+ *
+ * Returns a pointer to len bytes the application fills and then passes to
+ * sched_collect_commit(), or NULL if the buffer holds a packet not sent yet
+ * or len exceeds SCHED_COLLECT_MAX_PAYLOAD. Reserving again before the
+ * commit returns the same buffer.
+ */
+uint8_t *sched_collect_reserve(
+    struct sched_collect_conn *c,
+    uint8_t len);
+/*---------------------------------------------------------------------------*/
+/* Queue the reserved packet for the node's slot
+ * Parameters:
+ *  - conn -- a pointer to a connection object
+ *  - len  -- the length actually written, at most the reserved one
+ *
+ * Returns zero if nothing is reserved or len is out of range, in which case
+ * the reservation is kept. Non-zero otherwise.
+ */
+int sched_collect_commit(
+    struct sched_collect_conn *c,
+    uint8_t len);
+/*---------------------------------------------------------------------------*/
 #endif //SCHED_COLLECT_H
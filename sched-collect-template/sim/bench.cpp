@@ -0,0 +1,704 @@
+/**
+ * \file
+ *         Microbenchmark of the sched_collect callbacks on the host.
+ *
+ *         Usage: bench [-n ITERATIONS] [-o HISTORY.csv] [-t PERCENT]
+ *                      [-c COMMIT]
+ *
+ *         Builds sched_collect.c against the stub Contiki layers of the
+ *         simulator (contiki-stubs.cpp) and first runs a small network for
+ *         a few epochs: a sink, a relay and MAX_NODES - 2 leaves behind it,
+ *         with one packet lost so that the sink NACKs it. In the last epoch
+ *         it saves the protocol state of the node right before each of
+ *         send_beacon() on the sink, bc_recv() on the relay, uc_recv() on
+ *         the relay (forwarding) and on the sink, and
+ *         datacollection_send_unicast_cb() on the leaf with the NACKed
+ *         packet, together with the frame received. Every callback is then
+ *         replayed ITERATIONS times from that state.
+ *
+ *         The time per call is the fastest of ten batches, less the cost of
+ *         restoring the state and the packetbuf alone. Instructions per
+ *         call are counted with perf_event_open(2), where the kernel allows
+ *         it. The protocol's printf() output is formatted and discarded.
+ *
+ *         With -o the results are appended to a CSV history, tagged with
+ *         the commit (git describe, or -c). The previous commit found in
+ *         the history is the baseline: a callback more than PERCENT
+ *         (default 10) slower, in instructions when both runs counted them
+ *         and in time otherwise, is flagged and the exit status is 2.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "sim.h"
+extern "C" {
+/* Entry points of sched_collect.c, not in its header */
+void send_beacon(struct sched_collect_conn *conn);
+void datacollection_send_unicast_cb(void *ptr);
+void beacon_timer_cb(void *ptr);
+}
+/*---------------------------------------------------------------------------*/
+#define BYTE_US         32
+#define FRAME_OVERHEAD  21   /* PHY, 802.15.4 and Rime headers, as in sim */
+#define BENCH_RSSI      -60
+#define WARMUP_EPOCHS   6
+#define BATCHES         10
+/*---------------------------------------------------------------------------*/
+extern "C" uint8_t __start_sim_state[], __stop_sim_state[];
+/*---------------------------------------------------------------------------*/
+struct frame {
+  int64_t time;       /* end of the transmission */
+  uint32_t sender;
+  uint16_t channel;
+  bool unicast;
+  linkaddr_t dest;
+  uint8_t len;
+  uint8_t data[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+};
+/*---------------------------------------------------------------------------*/
+/* A callback and the state of its node right before it ran */
+struct bench_case {
+  const char *name;
+  bool saved;
+  uint32_t node;
+  std::vector<uint8_t> state;
+  struct sched_collect_conn conn;
+  int64_t now;
+  uint64_t rng;
+  frame fr;           /* received frame, for the receive callbacks */
+  double ns;
+  double instructions;  /* < 0 if not counted */
+};
+/*---------------------------------------------------------------------------*/
+enum {
+  CASE_SEND_BEACON,
+  CASE_BC_RECV,
+  CASE_UC_RECV_FORWARD,
+  CASE_UC_RECV_SINK,
+  CASE_SEND_UNICAST,
+  CASES
+};
+static bench_case cases[CASES] = {
+  {"send_beacon", false, 0, {}, {}, 0, 0, {}, 0, -1},
+  {"bc_recv", false, 0, {}, {}, 0, 0, {}, 0, -1},
+  {"uc_recv/forward", false, 0, {}, {}, 0, 0, {}, 0, -1},
+  {"uc_recv/sink", false, 0, {}, {}, 0, 0, {}, 0, -1},
+  {"datacollection_send_unicast_cb", false, 0, {}, {}, 0, 0, {}, 0, -1},
+};
+/*---------------------------------------------------------------------------*/
+static std::vector<sim_node> nodes;
+static std::vector<frame> air;     /* frames in flight */
+static sim_node *current;
+static int64_t now_us;
+static uint64_t rng = 1;
+static bool replaying;             /* frames are dropped while replaying */
+static unsigned epoch;
+/*---------------------------------------------------------------------------*/
+/* sim.h interface of the stub layer */
+/*---------------------------------------------------------------------------*/
+int64_t
+sim_now(void)
+{
+  return now_us;
+}
+/*---------------------------------------------------------------------------*/
+sim_node *
+sim_current(void)
+{
+  return current;
+}
+/*---------------------------------------------------------------------------*/
+bool
+sim_verbose(void)
+{
+  return false;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+sim_random16(void)
+{
+  /* xorshift64*, restored with the state of a case */
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return uint16_t((rng * 0x2545f4914f6cdd1dULL) >> 48);
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_enter(sim_node *n)
+{
+  size_t size = __stop_sim_state - __start_sim_state;
+  if(current == n) {
+    return;
+  }
+  if(current != nullptr) {
+    memcpy(current->state.data(), __start_sim_state, size);
+  }
+  memcpy(__start_sim_state, n->state.data(), size);
+  current = n;
+  node_id = n->id;
+  linkaddr_node_addr = n->addr;
+}
+/*---------------------------------------------------------------------------*/
+/* One clock for all nodes, without drift */
+clock_time_t
+sim_local_clock(const sim_node *n, int64_t t_us)
+{
+  (void)n;
+  return clock_time_t(t_us * CLOCK_SECOND / 1000000);
+}
+/*---------------------------------------------------------------------------*/
+/* The timers are the four of the connection, scanned by next_timer() */
+void
+sim_schedule_ctimer(struct ctimer *c)
+{
+  (void)c;
+}
+/*---------------------------------------------------------------------------*/
+int
+sim_transmit(uint16_t channel, const linkaddr_t *dest)
+{
+  static frame replay_frame;
+  frame &fr = replaying ? replay_frame : (air.emplace_back(), air.back());
+
+  fr.sender = current - nodes.data();
+  fr.channel = channel;
+  fr.unicast = dest != nullptr;
+  fr.dest = dest ? *dest : linkaddr_null;
+  fr.len = packetbuf_copyto(fr.data);
+  fr.time = now_us + int64_t(fr.len + FRAME_OVERHEAD) * BYTE_US;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_radio(bool on)
+{
+  current->radio_on = on;
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_log_line(const sim_node *n, const char *line, size_t len)
+{
+  (void)n;
+  (void)line;
+  (void)len;
+}
+/*---------------------------------------------------------------------------*/
+/* Energest is not accounted */
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_phase(uint8_t phase)
+{
+  (void)phase;
+}
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_quiet(uint8_t on)
+{
+  (void)on;
+}
+/*---------------------------------------------------------------------------*/
+void
+energest_flush(void)
+{
+}
+/*---------------------------------------------------------------------------*/
+unsigned long
+energest_type_time(int type)
+{
+  (void)type;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Application: one record per epoch, queued when the node wakes up */
+/*---------------------------------------------------------------------------*/
+static void
+app_queue(void)
+{
+  uint8_t *p = sched_collect_reserve(&current->conn, sizeof(uint16_t));
+  if(p != nullptr) {
+    memcpy(p, &current->seqn, sizeof(uint16_t));
+    sched_collect_commit(&current->conn, sizeof(uint16_t));
+    current->seqn++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+app_recv(const linkaddr_t *originator, uint8_t hops)
+{
+  (void)originator;
+  (void)hops;
+}
+/*---------------------------------------------------------------------------*/
+static const struct sched_collect_callbacks sink_cb = {.recv = app_recv,
+                                                       .active = nullptr};
+static const struct sched_collect_callbacks node_cb = {.recv = nullptr,
+                                                       .active = app_queue};
+/*---------------------------------------------------------------------------*/
+/* Network: node 1 is the sink, node 2 the relay, the others are leaves */
+/*---------------------------------------------------------------------------*/
+static bool
+linked(uint32_t a, uint32_t b)
+{
+  if(a == b) {
+    return false;
+  }
+  if(a > b) {
+    std::swap(a, b);
+  }
+  /* The sink hears the relay only, the leaves hear the relay and each
+   * other */
+  return a == 0 ? b == 1 : a >= 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+save_case(int c, uint32_t node, const frame *fr)
+{
+  bench_case &b = cases[c];
+  if(b.saved || epoch + 1 < WARMUP_EPOCHS) {
+    return;
+  }
+  sim_enter(&nodes[node]);
+  b.saved = true;
+  b.node = node;
+  b.state.assign(__start_sim_state, __stop_sim_state);
+  b.conn = nodes[node].conn;
+  b.now = now_us;
+  b.rng = rng;
+  if(fr != nullptr) {
+    b.fr = *fr;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+deliver(uint32_t to, const frame &fr)
+{
+  sim_node &r = nodes[to];
+  sim_enter(&r);
+  packetbuf_copyfrom(fr.data, fr.len);
+  packetbuf_set_attr(PACKETBUF_ATTR_RSSI, packetbuf_attr_t(BENCH_RSSI));
+  if(fr.unicast) {
+    r.conn.uc.u->recv(&r.conn.uc, &nodes[fr.sender].addr);
+  } else {
+    r.conn.bc.u->recv(&r.conn.bc, &nodes[fr.sender].addr);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+transmit(const frame &fr)
+{
+  sim_node &s = nodes[fr.sender];
+
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    if(!linked(fr.sender, i) || !nodes[i].radio_on ||
+       (fr.unicast && !linkaddr_cmp(&fr.dest, &nodes[i].addr))) {
+      continue;
+    }
+    if(!fr.unicast) {
+      if(fr.sender == 0 && i == 1) {
+        save_case(CASE_BC_RECV, i, &fr);
+      }
+    } else if(i == 1) {
+      save_case(CASE_UC_RECV_FORWARD, i, &fr);
+    } else if(i == 0) {
+      save_case(CASE_UC_RECV_SINK, i, &fr);
+    }
+    /* One packet of the first leaf is lost, to be NACKed by the sink */
+    if(fr.unicast && fr.sender == 2 && epoch + 3 == WARMUP_EPOCHS) {
+      continue;
+    }
+    deliver(i, fr);
+  }
+  sim_enter(&s);
+  packetbuf_copyfrom(fr.data, fr.len);
+  packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &fr.dest);
+  if(fr.unicast) {
+    s.conn.uc.u->sent(&s.conn.uc, MAC_TX_OK, 1);
+  } else {
+    s.conn.bc.u->sent(&s.conn.bc, MAC_TX_OK, 1);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Earliest active timer of the connections, NULL if none before until */
+static struct ctimer *
+next_timer(int64_t until, uint32_t *node, int64_t *due)
+{
+  struct ctimer *next = nullptr;
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    struct sched_collect_conn &c = nodes[i].conn;
+    for(struct ctimer *t : {&c.beacon_timer, &c.sync_timer, &c.radio_timer,
+                            &c.urgent_timer}) {
+      int64_t at = int64_t(t->start + t->interval) * 1000000 / CLOCK_SECOND;
+      if(t->active && at < until && (next == nullptr || at < *due)) {
+        next = t;
+        *node = i;
+        *due = at;
+      }
+    }
+  }
+  return next;
+}
+/*---------------------------------------------------------------------------*/
+/* Run timers and frames, in time order, up to until */
+static void
+run(int64_t until)
+{
+  for(;;) {
+    uint32_t node = 0;
+    int64_t due = until;
+    struct ctimer *t = next_timer(until, &node, &due);
+    auto f = std::min_element(air.begin(), air.end(),
+      [](const frame &a, const frame &b) { return a.time < b.time; });
+    if(f != air.end() && f->time <= due && f->time < until) {
+      frame fr = *f;
+      air.erase(f);
+      now_us = std::max(now_us, fr.time);
+      transmit(fr);
+      continue;
+    }
+    if(t == nullptr) {
+      break;
+    }
+    now_us = std::max(now_us, due);
+    if(t->f == beacon_timer_cb) {
+      save_case(CASE_SEND_BEACON, node, nullptr);
+    } else if(t->f == datacollection_send_unicast_cb && node == 2) {
+      save_case(CASE_SEND_UNICAST, node, nullptr);
+    }
+    sim_enter(&nodes[node]);
+    t->active = 0;
+    t->f(t->ptr);
+  }
+  now_us = until;
+}
+/*---------------------------------------------------------------------------*/
+static void
+warm_up(void)
+{
+  std::vector<uint8_t> pristine(__start_sim_state, __stop_sim_state);
+
+  nodes.resize(std::max(MAX_NODES, 3));
+  for(uint32_t i = 0; i < nodes.size(); i++) {
+    sim_node &n = nodes[i];
+    n.id = i + 1;
+    n.addr.u8[0] = n.id & 0xff;
+    n.addr.u8[1] = n.id >> 8;
+    n.state = pristine;
+    n.radio_on = true;
+    sim_enter(&n);
+    sched_collect_open(&n.conn, COLLECT_CHANNEL, n.id == SIM_SINK_ID,
+                       n.id == SIM_SINK_ID ? &sink_cb : &node_cb);
+    if(n.id != SIM_SINK_ID) {
+      app_queue();
+    }
+  }
+  for(epoch = 0; epoch < WARMUP_EPOCHS; epoch++) {
+    run(int64_t(epoch + 1) * EPOCH_DURATION * 1000000 / CLOCK_SECOND);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Instruction counter of this thread, -1 where perf events are not allowed */
+/*---------------------------------------------------------------------------*/
+static int
+counter_open(void)
+{
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof(a));
+  a.type = PERF_TYPE_HARDWARE;
+  a.size = sizeof(a);
+  a.config = PERF_COUNT_HW_INSTRUCTIONS;
+  a.disabled = 1;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+counter_read(int fd)
+{
+  uint64_t v = 0;
+  if(fd >= 0 && read(fd, &v, sizeof(v)) != sizeof(v)) {
+    v = 0;
+  }
+  return v;
+}
+/*---------------------------------------------------------------------------*/
+/* Replay */
+/*---------------------------------------------------------------------------*/
+static inline void
+restore(const bench_case &b, sim_node &n)
+{
+  memcpy(__start_sim_state, b.state.data(), b.state.size());
+  n.conn = b.conn;
+  now_us = b.now;
+  rng = b.rng;
+  if(b.fr.len > 0) {
+    packetbuf_copyfrom(b.fr.data, b.fr.len);
+    packetbuf_set_attr(PACKETBUF_ATTR_RSSI, packetbuf_attr_t(BENCH_RSSI));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+call(int c, sim_node &n)
+{
+  switch(c) {
+  case CASE_SEND_BEACON:
+    send_beacon(&n.conn);
+    break;
+  case CASE_BC_RECV:
+    n.conn.bc.u->recv(&n.conn.bc, &nodes[cases[c].fr.sender].addr);
+    break;
+  case CASE_UC_RECV_FORWARD:
+  case CASE_UC_RECV_SINK:
+    n.conn.uc.u->recv(&n.conn.uc, &nodes[cases[c].fr.sender].addr);
+    break;
+  case CASE_SEND_UNICAST:
+    datacollection_send_unicast_cb(&n.conn);
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Fastest batch time (ns) and instructions of iterations restores, each
+ * followed by the call if with_call */
+static void
+measure(int c, unsigned iterations, bool with_call, int counter,
+        double *ns, uint64_t *instructions)
+{
+  const bench_case &b = cases[c];
+  sim_node &n = nodes[b.node];
+  unsigned batch = std::max(1u, iterations / BATCHES);
+
+  sim_enter(&n);
+  *ns = 0;
+  *instructions = 0;
+  for(unsigned k = 0; k < BATCHES; k++) {
+    uint64_t i0 = counter_read(counter);
+    auto t0 = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < batch; i++) {
+      restore(b, n);
+      if(with_call) {
+        call(c, n);
+      }
+      asm volatile("" ::: "memory");
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    *instructions += counter_read(counter) - i0;
+    double t = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    if(k == 0 || t < *ns) {
+      *ns = t;
+    }
+  }
+  *ns /= batch;
+  *instructions /= uint64_t(batch) * BATCHES;
+}
+/*---------------------------------------------------------------------------*/
+static void
+bench(int c, unsigned iterations, int counter)
+{
+  double ns_call, ns_base;
+  uint64_t in_call, in_base;
+
+  measure(c, iterations, true, counter, &ns_call, &in_call);
+  measure(c, iterations, false, counter, &ns_base, &in_base);
+  cases[c].ns = std::max(0.0, ns_call - ns_base);
+  cases[c].instructions = counter >= 0 ?
+    double(in_call) - double(in_base) : -1;
+}
+/*---------------------------------------------------------------------------*/
+/* History */
+/*---------------------------------------------------------------------------*/
+struct history_row {
+  std::string commit, callback;
+  double ns, instructions;
+};
+/*---------------------------------------------------------------------------*/
+static std::string
+git_commit(void)
+{
+  char buf[64] = "";
+  FILE *p = popen("git describe --always --dirty 2>/dev/null", "r");
+  if(p != nullptr) {
+    if(fgets(buf, sizeof(buf), p) == nullptr) {
+      buf[0] = '\0';
+    }
+    pclose(p);
+  }
+  buf[strcspn(buf, "\r\n")] = '\0';
+  return buf[0] ? buf : "unknown";
+}
+/*---------------------------------------------------------------------------*/
+static std::vector<history_row>
+history_read(const char *file)
+{
+  std::vector<history_row> rows;
+  FILE *f = fopen(file, "r");
+  char line[256], commit[64], callback[64];
+  double ns, instructions;
+  unsigned calls;
+
+  if(f == nullptr) {
+    return rows;
+  }
+  while(fgets(line, sizeof(line), f) != nullptr) {
+    /* commit,callback,calls,ns_per_call,instructions_per_call */
+    int k = sscanf(line, "%63[^,],%63[^,],%u,%lf,%lf", commit, callback,
+                   &calls, &ns, &instructions);
+    if(k >= 4) {
+      rows.push_back({commit, callback, ns, k == 5 ? instructions : -1});
+    }
+  }
+  fclose(f);
+  return rows;
+}
+/*---------------------------------------------------------------------------*/
+/* Compare with the last other commit of the history, true on regression */
+static bool
+history_compare(const std::vector<history_row> &rows,
+                const std::string &commit, double threshold)
+{
+  std::string base;
+  bool regression = false;
+
+  for(auto it = rows.rbegin(); it != rows.rend(); ++it) {
+    if(it->commit != commit) {
+      base = it->commit;
+      break;
+    }
+  }
+  if(base.empty()) {
+    return false;
+  }
+  printf("\nAgainst %s:\n", base.c_str());
+  for(const bench_case &b : cases) {
+    const history_row *old = nullptr;
+    for(const history_row &r : rows) {
+      if(r.commit == base && r.callback == b.name) {
+        old = &r;
+      }
+    }
+    if(old == nullptr) {
+      continue;
+    }
+    bool by_instr = b.instructions >= 0 && old->instructions >= 0;
+    double was = by_instr ? old->instructions : old->ns;
+    double is = by_instr ? b.instructions : b.ns;
+    double change = was > 0 ? (is - was) / was * 100 : 0;
+    bool slower = change > threshold;
+    printf("  %-32s %+7.1f%% %s%s\n", b.name, change,
+           by_instr ? "instructions" : "time", slower ? "  REGRESSION" : "");
+    regression = regression || slower;
+  }
+  return regression;
+}
+/*---------------------------------------------------------------------------*/
+static bool
+history_append(const char *file, const std::string &commit,
+               unsigned iterations)
+{
+  FILE *f = fopen(file, "a");
+  if(f == nullptr) {
+    perror(file);
+    return false;
+  }
+  if(ftell(f) == 0) {
+    fprintf(f, "commit,callback,calls,ns_per_call,instructions_per_call\n");
+  }
+  for(const bench_case &b : cases) {
+    fprintf(f, "%s,%s,%u,%.1f,", commit.c_str(), b.name, iterations, b.ns);
+    if(b.instructions >= 0) {
+      fprintf(f, "%.0f", b.instructions);
+    }
+    fprintf(f, "\n");
+  }
+  fclose(f);
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-n iterations] [-o history.csv] "
+          "[-t percent] [-c commit]\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  unsigned iterations = 1000000;
+  const char *history = nullptr;
+  double threshold = 10;
+  std::string commit;
+
+  for(int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has_value = i + 1 < argc;
+    if(!strcmp(a, "-n") && has_value) {
+      iterations = strtoul(argv[++i], nullptr, 0);
+    } else if(!strcmp(a, "-o") && has_value) {
+      history = argv[++i];
+    } else if(!strcmp(a, "-t") && has_value) {
+      threshold = atof(argv[++i]);
+    } else if(!strcmp(a, "-c") && has_value) {
+      commit = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(iterations < BATCHES) {
+    fprintf(stderr, "At least %d iterations are needed.\n", BATCHES);
+    return 1;
+  }
+
+  warm_up();
+  replaying = true;
+  int counter = counter_open();
+  if(counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  printf("%-32s %10s %10s %12s\n", "callback", "calls", "ns/call",
+         "instr/call");
+  for(int c = 0; c < CASES; c++) {
+    if(!cases[c].saved) {
+      fprintf(stderr, "%s did not run in the warm-up.\n", cases[c].name);
+      return 1;
+    }
+    bench(c, iterations, counter);
+    printf("%-32s %10u %10.1f ", cases[c].name, iterations, cases[c].ns);
+    if(cases[c].instructions >= 0) {
+      printf("%12.0f\n", cases[c].instructions);
+    } else {
+      printf("%12s\n", "-");
+    }
+  }
+  if(counter < 0) {
+    printf("(instruction counts need perf events, see "
+           "/proc/sys/kernel/perf_event_paranoid)\n");
+  }
+
+  if(history != nullptr) {
+    if(commit.empty()) {
+      commit = git_commit();
+    }
+    bool regression = history_compare(history_read(history), commit,
+                                      threshold);
+    if(!history_append(history, commit, iterations)) {
+      return 1;
+    }
+    return regression ? 2 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,555 @@
+/**
+ * \file
+ *         Contiki API stand-ins for the host simulator.
+ *
+ *         Clock, ctimer, random, LEDs, link addresses, packetbuf, the
+ *         Rime broadcast/unicast primitives, the cfs file system API
+ *         (files kept in memory per node) and the CCM* driver, implemented
+ *         on top of the
+ *         discrete-event engine in sim.cpp. Everything runs on behalf of
+ *         sim_current(), the node whose state is loaded.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include "sim.h"
+extern "C" {
+#include "leds.h"
+#include "lib/random.h"
+#include "cfs/cfs-coffee.h"
+#include "lib/ccm-star.h"
+}
+/*---------------------------------------------------------------------------*/
+/* Identity of the running node, set by sim_enter() */
+unsigned short node_id;
+linkaddr_t linkaddr_node_addr;
+const linkaddr_t linkaddr_null = {{0, 0}};
+/*---------------------------------------------------------------------------*/
+/* Clock */
+/*---------------------------------------------------------------------------*/
+clock_time_t
+clock_time(void)
+{
+  sim_node *n = sim_current();
+  return n ? sim_local_clock(n, sim_now()) : 0;
+}
+/*---------------------------------------------------------------------------*/
+unsigned long
+clock_seconds(void)
+{
+  return clock_time() / CLOCK_SECOND;
+}
+/*---------------------------------------------------------------------------*/
+/* Callback timers */
+/*---------------------------------------------------------------------------*/
+void
+ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr)
+{
+  c->f = f;
+  c->ptr = ptr;
+  c->start = clock_time();
+  c->interval = t;
+  c->generation++;
+  c->active = 1;
+  sim_schedule_ctimer(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+ctimer_reset(struct ctimer *c)
+{
+  c->start += c->interval;
+  c->generation++;
+  c->active = 1;
+  sim_schedule_ctimer(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+ctimer_restart(struct ctimer *c)
+{
+  c->start = clock_time();
+  c->generation++;
+  c->active = 1;
+  sim_schedule_ctimer(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+ctimer_stop(struct ctimer *c)
+{
+  c->generation++;
+  c->active = 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+ctimer_expired(struct ctimer *c)
+{
+  return !c->active;
+}
+/*---------------------------------------------------------------------------*/
+/* Random numbers, one generator for the whole (reproducible) run */
+/*---------------------------------------------------------------------------*/
+void
+random_init(unsigned short seed)
+{
+  (void)seed;
+}
+/*---------------------------------------------------------------------------*/
+unsigned short
+random_rand(void)
+{
+  return sim_random16();
+}
+/*---------------------------------------------------------------------------*/
+/* LEDs */
+/*---------------------------------------------------------------------------*/
+void
+leds_on(unsigned char leds)
+{
+  sim_current()->leds |= leds;
+}
+/*---------------------------------------------------------------------------*/
+void
+leds_off(unsigned char leds)
+{
+  sim_current()->leds &= ~leds;
+}
+/*---------------------------------------------------------------------------*/
+void
+leds_toggle(unsigned char leds)
+{
+  sim_current()->leds ^= leds;
+}
+/*---------------------------------------------------------------------------*/
+unsigned char
+leds_get(void)
+{
+  return sim_current()->leds;
+}
+/*---------------------------------------------------------------------------*/
+/* Link addresses */
+/*---------------------------------------------------------------------------*/
+void
+linkaddr_copy(linkaddr_t *dest, const linkaddr_t *from)
+{
+  memcpy(dest, from, LINKADDR_SIZE);
+}
+/*---------------------------------------------------------------------------*/
+int
+linkaddr_cmp(const linkaddr_t *addr1, const linkaddr_t *addr2)
+{
+  return memcmp(addr1, addr2, LINKADDR_SIZE) == 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+linkaddr_set_node_addr(linkaddr_t *addr)
+{
+  linkaddr_copy(&linkaddr_node_addr, addr);
+}
+/*---------------------------------------------------------------------------*/
+/* Packet buffer: header space grows down from PACKETBUF_HDR_SIZE, data
+ * grows up from it, like the Contiki 3.x packetbuf */
+/*---------------------------------------------------------------------------*/
+static uint8_t packetbuf[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+static uint16_t hdr_off = PACKETBUF_HDR_SIZE;
+static uint16_t data_off = PACKETBUF_HDR_SIZE;
+static uint16_t data_len;
+static packetbuf_attr_t attrs[PACKETBUF_NUM_ATTRS];
+static linkaddr_t addrs[PACKETBUF_NUM_ADDRS];
+/*---------------------------------------------------------------------------*/
+void
+packetbuf_clear(void)
+{
+  hdr_off = data_off = PACKETBUF_HDR_SIZE;
+  data_len = 0;
+  memset(attrs, 0, sizeof(attrs));
+  memset(addrs, 0, sizeof(addrs));
+}
+/*---------------------------------------------------------------------------*/
+void *
+packetbuf_dataptr(void)
+{
+  return packetbuf + data_off;
+}
+/*---------------------------------------------------------------------------*/
+void *
+packetbuf_hdrptr(void)
+{
+  return packetbuf + hdr_off;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+packetbuf_datalen(void)
+{
+  return data_len;
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+packetbuf_hdrlen(void)
+{
+  return data_off - hdr_off;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+packetbuf_totlen(void)
+{
+  return packetbuf_hdrlen() + data_len;
+}
+/*---------------------------------------------------------------------------*/
+void
+packetbuf_set_datalen(uint16_t len)
+{
+  data_len = len;
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_copyfrom(const void *from, uint16_t len)
+{
+  packetbuf_clear();
+  data_len = len < PACKETBUF_SIZE ? len : PACKETBUF_SIZE;
+  memcpy(packetbuf + data_off, from, data_len);
+  return data_len;
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_copyto(void *to)
+{
+  memcpy(to, packetbuf + hdr_off, packetbuf_totlen());
+  return packetbuf_totlen();
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_hdralloc(int size)
+{
+  if(size < 0 || size > hdr_off) {
+    return 0;
+  }
+  hdr_off -= size;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_hdrreduce(int size)
+{
+  if(size < 0 || size > data_len) {
+    return 0;
+  }
+  data_off += size;
+  data_len -= size;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val)
+{
+  attrs[type] = val;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+packetbuf_attr_t
+packetbuf_attr(uint8_t type)
+{
+  return attrs[type];
+}
+/*---------------------------------------------------------------------------*/
+int
+packetbuf_set_addr(uint8_t type, const linkaddr_t *addr)
+{
+  linkaddr_copy(&addrs[type - PACKETBUF_ADDR_FIRST], addr);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+const linkaddr_t *
+packetbuf_addr(uint8_t type)
+{
+  return &addrs[type - PACKETBUF_ADDR_FIRST];
+}
+/*---------------------------------------------------------------------------*/
+/* Rime */
+/*---------------------------------------------------------------------------*/
+void
+broadcast_open(struct broadcast_conn *c, uint16_t channel,
+               const struct broadcast_callbacks *u)
+{
+  sim_node *n = sim_current();
+  c->u = u;
+  c->channel = channel;
+  c->node = n->id;
+  n->bcs.push_back(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+broadcast_close(struct broadcast_conn *c)
+{
+  auto &v = sim_current()->bcs;
+  v.erase(std::remove(v.begin(), v.end(), c), v.end());
+}
+/*---------------------------------------------------------------------------*/
+int
+broadcast_send(struct broadcast_conn *c)
+{
+  return sim_transmit(c->channel, nullptr);
+}
+/*---------------------------------------------------------------------------*/
+void
+unicast_open(struct unicast_conn *c, uint16_t channel,
+             const struct unicast_callbacks *u)
+{
+  sim_node *n = sim_current();
+  c->u = u;
+  c->channel = channel;
+  c->node = n->id;
+  n->ucs.push_back(c);
+}
+/*---------------------------------------------------------------------------*/
+void
+unicast_close(struct unicast_conn *c)
+{
+  auto &v = sim_current()->ucs;
+  v.erase(std::remove(v.begin(), v.end(), c), v.end());
+}
+/*---------------------------------------------------------------------------*/
+int
+unicast_send(struct unicast_conn *c, const linkaddr_t *receiver)
+{
+  packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, receiver);
+  return sim_transmit(c->channel, receiver);
+}
+/*---------------------------------------------------------------------------*/
+/* MAC: only the radio switch is used by the protocol */
+/*---------------------------------------------------------------------------*/
+static int
+mac_on(void)
+{
+  sim_radio(true);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+mac_off(int keep_radio_on)
+{
+  sim_radio(keep_radio_on != 0);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+const struct mac_driver sim_mac_driver = {
+  (char *)"sim", mac_on, mac_off
+};
+/*---------------------------------------------------------------------------*/
+/* File system: no size limit, reservations only create the file */
+/*---------------------------------------------------------------------------*/
+static sim_fd *
+fd_get(int fd)
+{
+  sim_node *n = sim_current();
+  if(fd < 0 || size_t(fd) >= n->fds.size() || n->fds[fd].flags == 0) {
+    return nullptr;
+  }
+  return &n->fds[fd];
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_open(const char *name, int flags)
+{
+  sim_node *n = sim_current();
+  auto f = n->files.find(name);
+
+  if(f == n->files.end()) {
+    if(!(flags & CFS_WRITE)) {
+      return -1;
+    }
+    f = n->files.emplace(name, std::vector<uint8_t>()).first;
+  }
+  size_t fd = 0;
+  while(fd < n->fds.size() && n->fds[fd].flags != 0) {
+    fd++;
+  }
+  if(fd == n->fds.size()) {
+    n->fds.emplace_back();
+  }
+  n->fds[fd].name = name;
+  n->fds[fd].offset = (flags & CFS_APPEND) ? f->second.size() : 0;
+  n->fds[fd].flags = flags;
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+void
+cfs_close(int fd)
+{
+  sim_fd *d = fd_get(fd);
+  if(d != nullptr) {
+    d->flags = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_read(int fd, void *buf, unsigned int len)
+{
+  sim_fd *d = fd_get(fd);
+  if(d == nullptr || !(d->flags & CFS_READ)) {
+    return -1;
+  }
+  auto f = sim_current()->files.find(d->name);
+  if(f == sim_current()->files.end()) {
+    return -1;
+  }
+  size_t size = f->second.size();
+  len = d->offset < size ? std::min<size_t>(len, size - d->offset) : 0;
+  memcpy(buf, f->second.data() + d->offset, len);
+  d->offset += len;
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_write(int fd, const void *buf, unsigned int len)
+{
+  sim_fd *d = fd_get(fd);
+  if(d == nullptr || !(d->flags & CFS_WRITE)) {
+    return -1;
+  }
+  auto f = sim_current()->files.find(d->name);
+  if(f == sim_current()->files.end()) {
+    return -1;
+  }
+  if(f->second.size() < d->offset + len) {
+    f->second.resize(d->offset + len);
+  }
+  memcpy(f->second.data() + d->offset, buf, len);
+  d->offset += len;
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+cfs_offset_t
+cfs_seek(int fd, cfs_offset_t offset, int whence)
+{
+  sim_fd *d = fd_get(fd);
+  if(d == nullptr) {
+    return -1;
+  }
+  auto f = sim_current()->files.find(d->name);
+  cfs_offset_t base = whence == CFS_SEEK_SET ? 0 :
+    whence == CFS_SEEK_CUR ? cfs_offset_t(d->offset) :
+    f == sim_current()->files.end() ? 0 : cfs_offset_t(f->second.size());
+  if(base + offset < 0) {
+    return -1;
+  }
+  d->offset = base + offset;
+  return d->offset;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_remove(const char *name)
+{
+  return sim_current()->files.erase(name) ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_coffee_reserve(const char *name, cfs_offset_t size)
+{
+  sim_node *n = sim_current();
+  if(size <= 0 || n->files.count(name)) {
+    return -1;
+  }
+  n->files.emplace(name, std::vector<uint8_t>());
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* CCM*: a keyed hash stands in for AES, which is enough for the protocol
+ * to tell forged and altered frames apart. It is NOT a real cipher. The key
+ * is shared: every node sets the same one */
+/*---------------------------------------------------------------------------*/
+static uint8_t ccm_key[16];
+/*---------------------------------------------------------------------------*/
+static uint64_t
+ccm_mix(uint64_t h, const uint8_t *p, size_t len)
+{
+  for(size_t i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  h ^= h >> 31;
+  h *= 0x7fb5d329728ea185ULL;
+  return h ^ (h >> 27);
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+ccm_prf(const uint8_t *nonce, uint8_t tag, uint32_t block)
+{
+  uint8_t b[5] = {tag, uint8_t(block), uint8_t(block >> 8),
+                  uint8_t(block >> 16), uint8_t(block >> 24)};
+  uint64_t h = ccm_mix(0xcbf29ce484222325ULL, ccm_key, sizeof(ccm_key));
+  h = ccm_mix(h, nonce, CCM_STAR_NONCE_LENGTH);
+  return ccm_mix(h, b, sizeof(b));
+}
+/*---------------------------------------------------------------------------*/
+static void
+ccm_set_key(const uint8_t *key)
+{
+  memcpy(ccm_key, key, sizeof(ccm_key));
+}
+/*---------------------------------------------------------------------------*/
+static void
+ccm_aead(const uint8_t *nonce, uint8_t *m, uint8_t m_len, const uint8_t *a,
+         uint8_t a_len, uint8_t *result, uint8_t mic_len, int forward)
+{
+  uint64_t h = ccm_prf(nonce, 0, 0);
+
+  /* The MIC covers the associated data and the plaintext */
+  if(!forward) {
+    for(uint8_t i = 0; i < m_len; i++) {
+      m[i] ^= uint8_t(ccm_prf(nonce, 1, i / 8) >> (8 * (i % 8)));
+    }
+  }
+  h = ccm_mix(h, &a_len, 1);
+  h = ccm_mix(h, a, a_len);
+  h = ccm_mix(h, &m_len, 1);
+  h = ccm_mix(h, m, m_len);
+  for(uint8_t i = 0; i < mic_len; i++) {
+    if(i % 8 == 0 && i > 0) {
+      h = ccm_mix(h, &i, 1);
+    }
+    result[i] = uint8_t(h >> (8 * (i % 8)));
+  }
+  if(forward) {
+    for(uint8_t i = 0; i < m_len; i++) {
+      m[i] ^= uint8_t(ccm_prf(nonce, 1, i / 8) >> (8 * (i % 8)));
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+const struct ccm_star_driver ccm_star_driver = {ccm_set_key, ccm_aead};
+/*---------------------------------------------------------------------------*/
+/* Node output, split in lines and prefixed like the Cooja log listener */
+/*---------------------------------------------------------------------------*/
+int
+sim_printf(const char *fmt, ...)
+{
+  char buf[256];
+  va_list ap;
+  sim_node *n = sim_current();
+
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if(n == nullptr || len <= 0) {
+    return len;
+  }
+  /* Without -v only the compact Sync:, Route: and Telemetry: records of
+   * the protocol are kept */
+  if(!sim_verbose() && !(n->line.empty() && (!strncmp(buf, "Sync: ", 6)
+                         || !strncmp(buf, "Route: ", 7)
+                         || !strncmp(buf, "Telemetry: ", 11)))) {
+    return len;
+  }
+  n->line.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+  size_t start = 0, nl;
+  while((nl = n->line.find('\n', start)) != std::string::npos) {
+    sim_log_line(n, n->line.data() + start, nl - start);
+    start = nl + 1;
+  }
+  n->line.erase(0, start);
+  return len;
+}
+/*---------------------------------------------------------------------------*/
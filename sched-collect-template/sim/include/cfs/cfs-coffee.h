@@ -0,0 +1,21 @@
+/**
+ * \file
+ *         Coffee extensions of the file system API.
+ */
+
+#ifndef CFS_COFFEE_H_
+#define CFS_COFFEE_H_
+/*---------------------------------------------------------------------------*/
+#include "cfs/cfs.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+int cfs_coffee_reserve(const char *name, cfs_offset_t size);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CFS_COFFEE_H_ */
@@ -0,0 +1,36 @@
+/**
+ * \file
+ *         Contiki file system API, backed by per-node files in memory.
+ */
+
+#ifndef CFS_H_
+#define CFS_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+typedef int cfs_offset_t;
+
+#define CFS_READ   1
+#define CFS_WRITE  2
+#define CFS_APPEND 4
+
+#define CFS_SEEK_SET 0
+#define CFS_SEEK_CUR 1
+#define CFS_SEEK_END 2
+
+int cfs_open(const char *name, int flags);
+void cfs_close(int fd);
+int cfs_read(int fd, void *buf, unsigned int len);
+int cfs_write(int fd, const void *buf, unsigned int len);
+cfs_offset_t cfs_seek(int fd, cfs_offset_t offset, int whence);
+int cfs_remove(const char *name);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CFS_H_ */
@@ -0,0 +1,35 @@
+/**
+ * \file
+ *         Host simulation platform configuration.
+ *
+ *         Stands in for the platform contiki-conf.h: pulls in the project
+ *         configuration and fixes the few platform types sched_collect
+ *         depends on.
+ */
+
+#ifndef CONTIKI_CONF_H_
+#define CONTIKI_CONF_H_
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+/*---------------------------------------------------------------------------*/
+#ifdef PROJECT_CONF_H
+#include PROJECT_CONF_H
+#endif
+/*---------------------------------------------------------------------------*/
+/* Test key for the simulated security, which replaces AES anyway */
+#ifndef SCHED_COLLECT_SEC_KEY
+#define SCHED_COLLECT_SEC_KEY { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, \
+                                0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f }
+#endif
+/*---------------------------------------------------------------------------*/
+/* 32-bit clock like the CC2538 (Sky uses 16 bits and wraps every minute) */
+typedef uint32_t clock_time_t;
+typedef uint16_t packetbuf_attr_t;
+/*---------------------------------------------------------------------------*/
+#ifndef CLOCK_CONF_SECOND
+#define CLOCK_CONF_SECOND 128UL
+#endif
+/*---------------------------------------------------------------------------*/
+#define RTIMER_SECOND 32768UL
+/*---------------------------------------------------------------------------*/
+#endif /* CONTIKI_CONF_H_ */
@@ -0,0 +1,34 @@
+/**
+ * \file
+ *         Host simulation stand-in for the Contiki main header.
+ *
+ *         Only the subset of the Contiki API used by the collection
+ *         protocols is provided; every call is routed to the discrete-event
+ *         simulator (see sim.h).
+ */
+
+#ifndef CONTIKI_H_
+#define CONTIKI_H_
+/*---------------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "contiki-conf.h"
+#include "sys/clock.h"
+#include "sys/ctimer.h"
+#include "sys/energest.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+/* Node output goes through the simulator, which prefixes every line with
+ * the simulated time and node id like the Cooja log listener does */
+int sim_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define printf sim_printf
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CONTIKI_H_ */
@@ -0,0 +1 @@
+#include "net/linkaddr.h"
@@ -0,0 +1 @@
+#include "sys/clock.h"
@@ -0,0 +1,28 @@
+/**
+ * \file
+ *         Simulated LEDs: state is kept per node for the LED timeline.
+ */
+
+#ifndef LEDS_H_
+#define LEDS_H_
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+#define LEDS_GREEN  1
+#define LEDS_YELLOW 2
+#define LEDS_RED    4
+#define LEDS_BLUE   LEDS_YELLOW
+#define LEDS_ALL    7
+/*---------------------------------------------------------------------------*/
+void leds_on(unsigned char leds);
+void leds_off(unsigned char leds);
+void leds_toggle(unsigned char leds);
+unsigned char leds_get(void);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* LEDS_H_ */
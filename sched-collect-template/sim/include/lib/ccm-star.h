@@ -0,0 +1,30 @@
+/**
+ * \file
+ *         CCM* driver interface of Contiki, with a simulated cipher.
+ */
+
+#ifndef CCM_STAR_H_
+#define CCM_STAR_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+#define CCM_STAR ccm_star_driver
+#define CCM_STAR_NONCE_LENGTH 13
+/*---------------------------------------------------------------------------*/
+struct ccm_star_driver {
+  void (* set_key)(const uint8_t *key);
+  void (* aead)(const uint8_t *nonce, uint8_t *m, uint8_t m_len,
+                const uint8_t *a, uint8_t a_len, uint8_t *result,
+                uint8_t mic_len, int forward);
+};
+extern const struct ccm_star_driver CCM_STAR;
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CCM_STAR_H_ */
@@ -0,0 +1,22 @@
+/**
+ * \file
+ *         Simulated pseudo-random generator (seeded from the command line).
+ */
+
+#ifndef RANDOM_H_
+#define RANDOM_H_
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+#define RANDOM_RAND_MAX 65535U
+/*---------------------------------------------------------------------------*/
+void random_init(unsigned short seed);
+unsigned short random_rand(void);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* RANDOM_H_ */
@@ -0,0 +1,33 @@
+/**
+ * \file
+ *         Rime link-layer addresses (two bytes, as on Sky and Firefly).
+ */
+
+#ifndef LINKADDR_H_
+#define LINKADDR_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki-conf.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+#define LINKADDR_SIZE 2
+/*---------------------------------------------------------------------------*/
+typedef union {
+  unsigned char u8[LINKADDR_SIZE];
+  uint16_t u16;
+} linkaddr_t;
+/*---------------------------------------------------------------------------*/
+extern linkaddr_t linkaddr_node_addr;
+extern const linkaddr_t linkaddr_null;
+/*---------------------------------------------------------------------------*/
+void linkaddr_copy(linkaddr_t *dest, const linkaddr_t *from);
+int linkaddr_cmp(const linkaddr_t *addr1, const linkaddr_t *addr2);
+void linkaddr_set_node_addr(linkaddr_t *addr);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* LINKADDR_H_ */
@@ -0,0 +1,28 @@
+/**
+ * \file
+ *         Simulated network stack: only the MAC on/off switch is exposed.
+ */
+
+#ifndef NETSTACK_H_
+#define NETSTACK_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki-conf.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+struct mac_driver {
+  char *name;
+  int (*on)(void);
+  int (*off)(int keep_radio_on);
+};
+/*---------------------------------------------------------------------------*/
+extern const struct mac_driver sim_mac_driver;
+#define NETSTACK_MAC sim_mac_driver
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* NETSTACK_H_ */
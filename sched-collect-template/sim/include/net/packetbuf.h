@@ -0,0 +1,66 @@
+/**
+ * \file
+ *         Contiki 3.x packet buffer, shared by all simulated nodes exactly
+ *         like the single packetbuf of a real node.
+ */
+
+#ifndef PACKETBUF_H_
+#define PACKETBUF_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki-conf.h"
+#include "net/linkaddr.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+#ifndef PACKETBUF_CONF_SIZE
+#define PACKETBUF_CONF_SIZE 128
+#endif
+#define PACKETBUF_SIZE     PACKETBUF_CONF_SIZE
+#define PACKETBUF_HDR_SIZE 48
+/*---------------------------------------------------------------------------*/
+enum {
+  PACKETBUF_ATTR_NONE,
+  PACKETBUF_ATTR_CHANNEL,
+  PACKETBUF_ATTR_RSSI,
+  PACKETBUF_ATTR_LINK_QUALITY,
+  PACKETBUF_ATTR_TIMESTAMP,
+  PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS,
+  PACKETBUF_ATTR_MAC_SEQNO,
+  PACKETBUF_ATTR_MAC_ACK,
+  PACKETBUF_ATTR_PACKET_TYPE,
+  PACKETBUF_ATTR_EPOCH,
+  PACKETBUF_ATTR_HOPS,
+  PACKETBUF_NUM_ATTRS
+};
+/* Addresses, set by Rime on sending and kept for the sent callback */
+enum {
+  PACKETBUF_ADDR_SENDER = PACKETBUF_NUM_ATTRS,
+  PACKETBUF_ADDR_RECEIVER,
+  PACKETBUF_ADDR_MAX
+};
+#define PACKETBUF_ADDR_FIRST PACKETBUF_ADDR_SENDER
+#define PACKETBUF_NUM_ADDRS  (PACKETBUF_ADDR_MAX - PACKETBUF_ADDR_FIRST)
+/*---------------------------------------------------------------------------*/
+void packetbuf_clear(void);
+void *packetbuf_dataptr(void);
+void *packetbuf_hdrptr(void);
+uint16_t packetbuf_datalen(void);
+uint8_t packetbuf_hdrlen(void);
+uint16_t packetbuf_totlen(void);
+void packetbuf_set_datalen(uint16_t len);
+int packetbuf_copyfrom(const void *from, uint16_t len);
+int packetbuf_copyto(void *to);
+int packetbuf_hdralloc(int size);
+int packetbuf_hdrreduce(int size);
+int packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val);
+packetbuf_attr_t packetbuf_attr(uint8_t type);
+int packetbuf_set_addr(uint8_t type, const linkaddr_t *addr);
+const linkaddr_t *packetbuf_addr(uint8_t type);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* PACKETBUF_H_ */
@@ -0,0 +1,69 @@
+/**
+ * \file
+ *         Simulated Rime broadcast and unicast primitives.
+ *
+ *         Packets are handed to the simulator's radio model instead of a
+ *         MAC layer; callbacks run on the receiving node with the
+ *         packetbuf filled in, like in Rime.
+ */
+
+#ifndef RIME_H_
+#define RIME_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+#include "net/linkaddr.h"
+#include "net/packetbuf.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+struct broadcast_conn;
+struct unicast_conn;
+/*---------------------------------------------------------------------------*/
+struct broadcast_callbacks {
+  void (*recv)(struct broadcast_conn *ptr, const linkaddr_t *sender);
+  void (*sent)(struct broadcast_conn *ptr, int status, int num_tx);
+};
+
+struct broadcast_conn {
+  const struct broadcast_callbacks *u;
+  uint16_t channel;
+  unsigned short node;  /* simulator node owning the connection */
+};
+
+struct unicast_callbacks {
+  void (*recv)(struct unicast_conn *c, const linkaddr_t *from);
+  void (*sent)(struct unicast_conn *ptr, int status, int num_tx);
+};
+
+struct unicast_conn {
+  const struct unicast_callbacks *u;
+  uint16_t channel;
+  unsigned short node;
+};
+/*---------------------------------------------------------------------------*/
+/* MAC transmission status passed to the sent callbacks */
+enum {
+  MAC_TX_OK,
+  MAC_TX_COLLISION,
+  MAC_TX_NOACK,
+  MAC_TX_DEFERRED,
+  MAC_TX_ERR,
+  MAC_TX_ERR_FATAL,
+};
+/*---------------------------------------------------------------------------*/
+void broadcast_open(struct broadcast_conn *c, uint16_t channel,
+                    const struct broadcast_callbacks *u);
+void broadcast_close(struct broadcast_conn *c);
+int broadcast_send(struct broadcast_conn *c);
+void unicast_open(struct unicast_conn *c, uint16_t channel,
+                  const struct unicast_callbacks *u);
+void unicast_close(struct unicast_conn *c);
+int unicast_send(struct unicast_conn *c, const linkaddr_t *receiver);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* RIME_H_ */
@@ -0,0 +1,24 @@
+/**
+ * \file
+ *         Simulated node clock: every node has its own drifting clock.
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+/*---------------------------------------------------------------------------*/
+#include "contiki-conf.h"
+/*---------------------------------------------------------------------------*/
+#define CLOCK_SECOND CLOCK_CONF_SECOND
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+clock_time_t clock_time(void);
+unsigned long clock_seconds(void);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CLOCK_H_ */
@@ -0,0 +1,34 @@
+/**
+ * \file
+ *         Simulated callback timers, scheduled on the local node clock.
+ */
+
+#ifndef CTIMER_H_
+#define CTIMER_H_
+/*---------------------------------------------------------------------------*/
+#include "sys/clock.h"
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+struct ctimer {
+  void (*f)(void *);
+  void *ptr;
+  clock_time_t start;
+  clock_time_t interval;
+  uint32_t generation; /* bumped on set/stop to invalidate queued events */
+  uint8_t active;
+};
+/*---------------------------------------------------------------------------*/
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr);
+void ctimer_reset(struct ctimer *c);
+void ctimer_restart(struct ctimer *c);
+void ctimer_stop(struct ctimer *c);
+int ctimer_expired(struct ctimer *c);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* CTIMER_H_ */
@@ -0,0 +1,31 @@
+/**
+ * \file
+ *         Simulated Energest: time of the running node in each state.
+ *
+ *         The counters are kept by the simulator (radio on, transmitting,
+ *         callbacks charged as CPU time) and returned in rtimer ticks.
+ */
+
+#ifndef ENERGEST_H_
+#define ENERGEST_H_
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+enum energest_type {
+  ENERGEST_TYPE_CPU,
+  ENERGEST_TYPE_LPM,
+  ENERGEST_TYPE_TRANSMIT,
+  ENERGEST_TYPE_LISTEN,
+  ENERGEST_TYPE_MAX
+};
+/*---------------------------------------------------------------------------*/
+void energest_flush(void);
+unsigned long energest_type_time(int type);
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* ENERGEST_H_ */
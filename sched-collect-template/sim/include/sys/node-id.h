@@ -0,0 +1,19 @@
+/**
+ * \file
+ *         Node id of the node currently executing in the simulator.
+ */
+
+#ifndef NODE_ID_H_
+#define NODE_ID_H_
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*---------------------------------------------------------------------------*/
+extern unsigned short node_id;
+/*---------------------------------------------------------------------------*/
+#ifdef __cplusplus
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* NODE_ID_H_ */
@@ -0,0 +1,93 @@
+/**
+ * \file
+ *         Pluggable radio propagation models for the host simulator.
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include "radio-model.h"
+#include <algorithm>
+#include <cmath>
+/*---------------------------------------------------------------------------*/
+#define UDGM_SS_STRONG   -10.0  /* dBm at distance 0 */
+#define UDGM_SS_WEAK     -95.0  /* dBm at the edge of the disk */
+
+#define PATH_LOSS_D0     40.0   /* dB at 1 m, 2.4 GHz free space */
+#define NOISE_FLOOR      -100.0 /* dBm */
+#define SNR_50           3.0    /* SNR (dB) with 50% packet reception */
+#define SNR_SLOPE        0.8    /* dB, width of the reception curve */
+#define PRR_MIN          0.001  /* weaker links are not kept */
+/*---------------------------------------------------------------------------*/
+bool
+unit_disk_model::link(double d, uint16_t a, uint16_t b, link_quality *q) const
+{
+  (void)a;
+  (void)b;
+  if(d > range_) {
+    return false;
+  }
+  q->prr = ratio_;
+  q->rssi = int16_t(std::lround(UDGM_SS_STRONG
+                                + (UDGM_SS_WEAK - UDGM_SS_STRONG) * d / range_));
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+log_distance_model::log_distance_model(double ptx_dbm, double exponent,
+                                       double sigma_db, uint32_t seed)
+  : ptx_(ptx_dbm), exponent_(exponent), sigma_(sigma_db), seed_(seed)
+{
+  /* Beyond this distance even a +3 sigma shadowing gives PRR < PRR_MIN */
+  double snr_min = SNR_50 + SNR_SLOPE * std::log(PRR_MIN / (1 - PRR_MIN));
+  double budget = ptx_ - PATH_LOSS_D0 + 3 * sigma_ - (NOISE_FLOOR + snr_min);
+  max_range_ = std::pow(10.0, budget / (10.0 * exponent_));
+}
+/*---------------------------------------------------------------------------*/
+/* Deterministic uniform (0, 1) per unordered node pair, for shadowing */
+static double
+pair_uniform(uint16_t a, uint16_t b, uint32_t seed, uint32_t salt)
+{
+  uint64_t x = (uint64_t(std::min(a, b)) << 32) | (uint64_t(std::max(a, b)) << 16)
+               | salt;
+  x ^= uint64_t(seed) * 0x9e3779b97f4a7c15ULL;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return (double(x >> 11) + 0.5) / double(1ULL << 53);
+}
+/*---------------------------------------------------------------------------*/
+bool
+log_distance_model::link(double d, uint16_t a, uint16_t b, link_quality *q) const
+{
+  if(d > max_range_) {
+    return false;
+  }
+  d = std::max(d, 1.0);
+  double shadowing = 0;
+  if(sigma_ > 0) {
+    /* Box-Muller on two per-link uniforms */
+    double u1 = pair_uniform(a, b, seed_, 1), u2 = pair_uniform(a, b, seed_, 2);
+    shadowing = sigma_ * std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2);
+  }
+  double rssi = ptx_ - PATH_LOSS_D0 - 10 * exponent_ * std::log10(d) + shadowing;
+  double snr = rssi - NOISE_FLOOR;
+  q->prr = 1.0 / (1.0 + std::exp(-(snr - SNR_50) / SNR_SLOPE));
+  q->rssi = int16_t(std::lround(rssi));
+  return q->prr >= PRR_MIN;
+}
+/*---------------------------------------------------------------------------*/
+std::unique_ptr<radio_model>
+make_radio_model(const std::string &name, double range, double prr,
+                 double exponent, double sigma, uint32_t seed)
+{
+  if(name == "udgm") {
+    return std::unique_ptr<radio_model>(new unit_disk_model(range, prr));
+  }
+  if(name == "logdist") {
+    return std::unique_ptr<radio_model>(
+      new log_distance_model(0.0, exponent, sigma, seed));
+  }
+  return nullptr;
+}
+/*---------------------------------------------------------------------------*/
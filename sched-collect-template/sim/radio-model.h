@@ -0,0 +1,88 @@
+/**
+ * \file
+ *         Pluggable radio propagation models for the host simulator.
+ *
+ *         A model decides, for an ordered pair of node positions, whether
+ *         a link exists, its packet reception ratio and the RSSI reported
+ *         to the receiver. Links are evaluated once when the topology is
+ *         built, so models may be arbitrarily expensive.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#ifndef RADIO_MODEL_H
+#define RADIO_MODEL_H
+/*---------------------------------------------------------------------------*/
+#include <cstdint>
+#include <memory>
+#include <string>
+/*---------------------------------------------------------------------------*/
+struct link_quality {
+  double prr;    /* probability that a frame is received */
+  int16_t rssi;  /* dBm, as reported by PACKETBUF_ATTR_RSSI */
+};
+/*---------------------------------------------------------------------------*/
+class radio_model {
+public:
+  virtual ~radio_model() = default;
+  /**
+   * \brief      Evaluate the link from a sender to a receiver
+   * \param d    Distance in metres
+   * \param a,b  Node ids, for models with per-link randomness
+   * \return     false if the receiver cannot hear the sender at all
+   */
+  virtual bool link(double d, uint16_t a, uint16_t b, link_quality *q) const = 0;
+  /* Distance beyond which no link can exist, used to prune the search */
+  virtual double max_range() const = 0;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Cooja Unit Disk Graph Medium
+ *
+ *               Full reception within tx_range (with a fixed success
+ *               ratio), RSSI decreasing linearly from -10 dBm to -95 dBm at
+ *               the edge of the disk, like Cooja's UDGM.
+ */
+class unit_disk_model : public radio_model {
+public:
+  unit_disk_model(double tx_range, double success_ratio)
+    : range_(tx_range), ratio_(success_ratio) {}
+  bool link(double d, uint16_t a, uint16_t b, link_quality *q) const override;
+  double max_range() const override { return range_; }
+
+private:
+  double range_;
+  double ratio_;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief        Log-distance path loss with log-normal shadowing
+ *
+ *               RSSI = Ptx - PL(d0) - 10 n log10(d / d0) + X, where X is a
+ *               per-link (symmetric) Gaussian shadowing term. The PRR is a
+ *               logistic function of the SNR over the noise floor that
+ *               approximates the O-QPSK reception curve of 802.15.4 radios.
+ */
+class log_distance_model : public radio_model {
+public:
+  log_distance_model(double ptx_dbm, double exponent, double sigma_db,
+                     uint32_t seed);
+  bool link(double d, uint16_t a, uint16_t b, link_quality *q) const override;
+  double max_range() const override { return max_range_; }
+
+private:
+  double ptx_;
+  double exponent_;
+  double sigma_;
+  uint32_t seed_;
+  double max_range_;
+};
+/*---------------------------------------------------------------------------*/
+/* Build a model from its command-line name ("udgm" or "logdist") */
+std::unique_ptr<radio_model> make_radio_model(const std::string &name,
+                                              double range, double prr,
+                                              double exponent, double sigma,
+                                              uint32_t seed);
+/*---------------------------------------------------------------------------*/
+#endif /* RADIO_MODEL_H */
@@ -0,0 +1,1070 @@
+/**
+ * \file
+ *         Host-native discrete-event simulator for sched_collect.
+ *
+ *         Usage: sim [-n NODES] [--topology grid|line|random] [--spacing M]
+ *                    [--model udgm|logdist] [--range M] [--prr P]
+ *                    [--exponent N] [--sigma DB] [--drift PPM]
+ *                    [--boot-spread S] [-d DURATION_S] [-s SEED]
+ *                    [-o LOGFILE] [-v]
+ *
+ *         Runs the unchanged sched_collect.c on NODES simulated motes (node
+ *         1 is the sink) together with the test application of app.c and
+ *         simple-energest, and writes a log in the format of the headless
+ *         Cooja log listener, so parse-stats.py and the tools in analysis/
+ *         work on it directly. Every node has its own clock, running with a
+ *         constant drift drawn uniformly in [-PPM, +PPM], and boots at a
+ *         random time within the first BOOT_SPREAD seconds.
+ *
+ *         The radio is a shared 250 kbps 802.15.4 channel. Links come from
+ *         the selected radio model; a frame overlapping another one at a
+ *         receiver is lost (no capture effect), nodes cannot receive while
+ *         transmitting or with the radio off. The MAC mimics csma over
+ *         nullrdc with auto-ack: CCA with random backoff, acknowledged
+ *         unicast with retransmissions and duplicate detection.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include "sim.h"
+/*---------------------------------------------------------------------------*/
+/* Radio and MAC timing, 802.15.4 at 250 kbps */
+#define BYTE_US              32
+#define FRAME_OVERHEAD       21   /* PHY, 802.15.4 and Rime headers */
+#define ACK_US               352  /* turnaround + 5-byte ACK frame */
+#define CCA_US               128
+#define BACKOFF_SLOT_US      320
+#define MIN_BE               3
+#define MAX_BE               5
+#define MAX_BACKOFFS         5
+#define MAX_TRANSMISSIONS    3    /* csma default for unicast frames */
+#define CPU_PER_EVENT_US     250  /* CPU time charged to every callback */
+/*---------------------------------------------------------------------------*/
+/* Application, as in app.c and simple-energest.c */
+#define SINK_OPEN_DELAY      (2 * CLOCK_SECOND)
+#define ENERGEST_PERIOD      (15 * CLOCK_SECOND)
+#define APP_ACTIVE_GUARD     CLOCK_SECOND  /* as in app.c */
+#define APP_ALARM_FLAG       0x8000  /* seqn of urgent alarms */
+/*---------------------------------------------------------------------------*/
+/* Per-node protocol state: the static data of sched_collect.c */
+extern "C" uint8_t __start_sim_state[], __stop_sim_state[];
+/*---------------------------------------------------------------------------*/
+enum event_type {
+  EV_BOOT,
+  EV_CTIMER,
+  EV_APP,
+  EV_ALARM,
+  EV_FAIL,
+  EV_OUTAGE,
+  EV_ENERGEST,
+  EV_MAC_START,
+  EV_RX_END,
+  EV_TX_END,
+};
+
+struct event {
+  int64_t time;
+  uint64_t seq;       /* FIFO order among simultaneous events */
+  uint8_t type;
+  uint32_t node;
+  uint32_t arg;       /* ctimer generation or frame index */
+  struct ctimer *timer;
+
+  bool operator>(const event &e) const {
+    return time != e.time ? time > e.time : seq > e.seq;
+  }
+};
+
+struct frame {
+  uint32_t sender;
+  uint16_t channel;
+  bool unicast;
+  linkaddr_t dest;
+  uint8_t mac_seqno;
+  uint8_t len;
+  uint8_t data[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+  int64_t air_us;
+  int transmissions;
+  int backoffs;
+  bool acked;
+  int refs;           /* pending receptions + the sender */
+};
+/*---------------------------------------------------------------------------*/
+struct sim_config {
+  unsigned nodes = MAX_NODES;
+  std::string topology = "grid";
+  double spacing = 30;
+  std::string model = "udgm";
+  double range = 50;
+  double prr = 1.0;
+  double exponent = 3.0;
+  double sigma = 4.0;
+  double drift_ppm = 20;
+  double boot_spread = 1.0;
+  double duration = 600;
+  double alarm_period = 0;
+  unsigned payload = sizeof(uint16_t);  /* periodic record size, bytes */
+  std::vector<std::pair<unsigned, double>> kills;  /* node id, time (s) */
+  struct outage { unsigned id; double start, end; };
+  std::vector<outage> outages;
+  uint32_t seed = 1;
+  const char *log_file = nullptr;
+  bool verbose = false;
+};
+/*---------------------------------------------------------------------------*/
+static sim_config cfg;
+static std::vector<sim_node> nodes;
+static std::vector<frame> frames;
+static std::vector<uint32_t> free_frames;
+static std::vector<std::deque<uint32_t>> tx_queue;
+static std::vector<std::unordered_map<uint16_t, uint8_t>> last_seqno;
+static std::vector<uint8_t> next_seqno;
+static std::priority_queue<event, std::vector<event>, std::greater<event>> queue;
+static uint64_t event_seq;
+static uint64_t events_handled;
+static int64_t now_us;
+static int64_t end_us;
+static sim_node *current;
+static std::vector<uint8_t> pristine_state;
+static std::mt19937_64 rng;
+static FILE *out;
+static uint64_t app_sent, app_recv;
+/* Urgent alarms: send time by (node id, seqn), latencies at the sink */
+static uint64_t alarm_sent, alarm_recv;
+static std::unordered_map<uint32_t, int64_t> alarm_sent_us;
+static std::vector<double> alarm_latency_ms;
+/*---------------------------------------------------------------------------*/
+#define NO_FRAME UINT32_MAX
+/*---------------------------------------------------------------------------*/
+int64_t
+sim_now(void)
+{
+  return now_us;
+}
+/*---------------------------------------------------------------------------*/
+sim_node *
+sim_current(void)
+{
+  return current;
+}
+/*---------------------------------------------------------------------------*/
+bool
+sim_verbose(void)
+{
+  return cfg.verbose;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+sim_random16(void)
+{
+  return uint16_t(rng() >> 48);
+}
+/*---------------------------------------------------------------------------*/
+static double
+uniform(void)
+{
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_enter(sim_node *n)
+{
+  size_t size = __stop_sim_state - __start_sim_state;
+  if(current == n) {
+    return;
+  }
+  if(current != nullptr) {
+    memcpy(current->state.data(), __start_sim_state, size);
+  }
+  memcpy(__start_sim_state, n->state.data(), size);
+  current = n;
+  node_id = n->id;
+  linkaddr_node_addr = n->addr;
+}
+/*---------------------------------------------------------------------------*/
+/* Ticks of the (unwrapped) local clock of n at simulated time t_us */
+static uint64_t
+local_ticks(const sim_node *n, int64_t t_us)
+{
+  double ticks = (t_us - n->boot_us) * (1.0 + n->drift) * CLOCK_SECOND / 1e6;
+  return ticks <= 0 ? 0 : uint64_t(ticks);
+}
+/*---------------------------------------------------------------------------*/
+clock_time_t
+sim_local_clock(const sim_node *n, int64_t t_us)
+{
+  return clock_time_t(local_ticks(n, t_us));
+}
+/*---------------------------------------------------------------------------*/
+/* First simulated time at which the local clock of n reaches `ticks` */
+static int64_t
+local_to_sim(const sim_node *n, uint64_t ticks)
+{
+  double us = ticks * 1e6 / ((1.0 + n->drift) * CLOCK_SECOND);
+  int64_t t = n->boot_us + int64_t(std::ceil(us));
+  while(local_ticks(n, t) < ticks) {
+    t++;
+  }
+  return t;
+}
+/*---------------------------------------------------------------------------*/
+static void
+schedule(int64_t time, uint8_t type, uint32_t node, uint32_t arg = 0,
+         struct ctimer *timer = nullptr)
+{
+  if(time > end_us) {
+    return;
+  }
+  queue.push(event{std::max(time, now_us), event_seq++, type, node, arg, timer});
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_schedule_ctimer(struct ctimer *c)
+{
+  sim_node *n = current;
+  schedule(local_to_sim(n, uint64_t(c->start) + c->interval), EV_CTIMER,
+           n - nodes.data(), c->generation, c);
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_log_line(const sim_node *n, const char *line, size_t len)
+{
+  fprintf(out, "%" PRId64 "\tID:%u\t%.*s\n", now_us, n->id, int(len), line);
+}
+/*---------------------------------------------------------------------------*/
+/* Log a line of the application layer, which is always shown */
+static void __attribute__((format(printf, 2, 3)))
+app_log(const sim_node *n, const char *fmt, ...)
+{
+  char buf[128];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  sim_log_line(n, buf, std::min<size_t>(len, sizeof(buf) - 1));
+}
+/*---------------------------------------------------------------------------*/
+/* Radio */
+/*---------------------------------------------------------------------------*/
+static void
+account_radio(sim_node *n)
+{
+  if(n->radio_on) {
+    n->radio_on_us += now_us - n->radio_on_since_us;
+  }
+  n->radio_on_since_us = now_us;
+}
+/*---------------------------------------------------------------------------*/
+void
+sim_radio(bool on)
+{
+  sim_node *n = current;
+  if(n->radio_on == on) {
+    return;
+  }
+  account_radio(n);
+  n->radio_on = on;
+  if(!on) {
+    /* A reception in progress is lost */
+    n->rx_corrupted = true;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+alloc_frame(void)
+{
+  if(free_frames.empty()) {
+    frames.emplace_back();
+    return frames.size() - 1;
+  }
+  uint32_t f = free_frames.back();
+  free_frames.pop_back();
+  return f;
+}
+/*---------------------------------------------------------------------------*/
+static void
+release_frame(uint32_t f)
+{
+  if(--frames[f].refs == 0) {
+    free_frames.push_back(f);
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+sim_transmit(uint16_t channel, const linkaddr_t *dest)
+{
+  uint32_t idx = current - nodes.data();
+  uint32_t f = alloc_frame();
+  frame &fr = frames[f];
+
+  fr.sender = idx;
+  fr.channel = channel;
+  fr.unicast = dest != nullptr;
+  fr.dest = dest ? *dest : linkaddr_null;
+  fr.mac_seqno = next_seqno[idx]++;
+  fr.len = packetbuf_copyto(fr.data);
+  fr.air_us = int64_t(fr.len + FRAME_OVERHEAD) * BYTE_US;
+  fr.transmissions = 0;
+  fr.backoffs = 0;
+  fr.acked = false;
+  fr.refs = 1;
+
+  tx_queue[idx].push_back(f);
+  if(tx_queue[idx].size() == 1) {
+    schedule(now_us, EV_MAC_START, idx);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+backoff(uint32_t idx, frame &fr)
+{
+  int be = std::min(MIN_BE + fr.backoffs, MAX_BE);
+  int64_t slots = rng() % (1u << be);
+  schedule(now_us + CCA_US + slots * BACKOFF_SLOT_US, EV_MAC_START, idx);
+}
+/*---------------------------------------------------------------------------*/
+static void
+mac_done(uint32_t idx, int status)
+{
+  uint32_t f = tx_queue[idx].front();
+  /* The callback may transmit, growing frames: no reference to fr after it */
+  const frame fr = frames[f];
+  sim_node &n = nodes[idx];
+
+  /* MAC outcome to the Rime sent callback of the connection, with the
+   * frame back in the packetbuf as in Contiki. The frame leaves the queue
+   * afterwards, so that a frame sent by the callback is started below and
+   * not twice */
+  sim_enter(&n);
+  packetbuf_copyfrom(fr.data, fr.len);
+  packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &fr.dest);
+  if(fr.unicast) {
+    for(struct unicast_conn *c : n.ucs) {
+      if(c->channel == fr.channel && c->u->sent) {
+        c->u->sent(c, status, fr.transmissions);
+        break;
+      }
+    }
+  } else {
+    for(struct broadcast_conn *c : n.bcs) {
+      if(c->channel == fr.channel && c->u->sent) {
+        c->u->sent(c, status, fr.transmissions);
+        break;
+      }
+    }
+  }
+  tx_queue[idx].pop_front();
+  release_frame(f);
+  if(!tx_queue[idx].empty()) {
+    schedule(now_us, EV_MAC_START, idx);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+mac_start(uint32_t idx)
+{
+  sim_node &n = nodes[idx];
+  uint32_t f = tx_queue[idx].front();
+  frame &fr = frames[f];
+
+  /* Clear channel assessment: any frame in the air we can hear */
+  if(n.rx_end_us > now_us || n.tx_end_us > now_us) {
+    if(++fr.backoffs > MAX_BACKOFFS) {
+      mac_done(idx, MAC_TX_COLLISION);
+      return;
+    }
+    backoff(idx, fr);
+    return;
+  }
+
+  int64_t end = now_us + fr.air_us;
+  fr.transmissions++;
+  fr.acked = false;
+  n.tx_end_us = end;
+  n.tx_us += fr.air_us;
+  /* Half duplex: our own reception is lost */
+  n.rx_corrupted = true;
+
+  for(const sim_link &l : n.links) {
+    sim_node &r = nodes[l.to];
+    if(!r.radio_on || r.tx_end_us > now_us || n.cut || r.cut) {
+      continue;
+    }
+    if(r.rx_end_us > now_us) {
+      /* Collision: both frames are lost */
+      r.rx_corrupted = true;
+      r.rx_end_us = std::max(r.rx_end_us, end);
+      continue;
+    }
+    r.rx_frame = f;
+    r.rx_end_us = end;
+    r.rx_corrupted = uniform() >= l.q.prr;
+    fr.refs++;
+    schedule(end, EV_RX_END, l.to, f);
+  }
+  schedule(end + (fr.unicast ? ACK_US : 0), EV_TX_END, idx, f);
+}
+/*---------------------------------------------------------------------------*/
+static const sim_link *
+find_link(const sim_node &from, uint32_t to)
+{
+  for(const sim_link &l : from.links) {
+    if(l.to == to) {
+      return &l;
+    }
+  }
+  return nullptr;
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_end(uint32_t idx, uint32_t f)
+{
+  sim_node &r = nodes[idx];
+  frame &fr = frames[f];
+  bool ok = r.rx_frame == f && !r.rx_corrupted && r.radio_on;
+
+  if(r.rx_frame == f) {
+    r.rx_frame = NO_FRAME;
+  }
+  if(!ok) {
+    release_frame(f);
+    return;
+  }
+
+  const sim_node &s = nodes[fr.sender];
+  const sim_link *l = find_link(s, idx);
+  if(fr.unicast) {
+    if(!linkaddr_cmp(&fr.dest, &r.addr)) {
+      release_frame(f);
+      return;
+    }
+    /* Auto-ack, lost with the probability of the reverse link */
+    const sim_link *back = find_link(r, fr.sender);
+    fr.acked = back != nullptr && uniform() < back->q.prr;
+    /* Retransmissions of a frame already received are dropped */
+    auto it = last_seqno[idx].find(s.id);
+    if(it != last_seqno[idx].end() && it->second == fr.mac_seqno) {
+      release_frame(f);
+      return;
+    }
+    last_seqno[idx][s.id] = fr.mac_seqno;
+  }
+
+  sim_enter(&r);
+  r.events++;
+  packetbuf_copyfrom(fr.data, fr.len);
+  packetbuf_set_attr(PACKETBUF_ATTR_RSSI, packetbuf_attr_t(l ? l->q.rssi : 0));
+  if(fr.unicast) {
+    for(struct unicast_conn *c : r.ucs) {
+      if(c->channel == fr.channel && c->u->recv) {
+        c->u->recv(c, &s.addr);
+        break;
+      }
+    }
+  } else {
+    for(struct broadcast_conn *c : r.bcs) {
+      if(c->channel == fr.channel && c->u->recv) {
+        c->u->recv(c, &s.addr);
+        break;
+      }
+    }
+  }
+  release_frame(f);
+}
+/*---------------------------------------------------------------------------*/
+static void
+tx_end(uint32_t idx, uint32_t f)
+{
+  frame &fr = frames[f];
+  if(fr.unicast && !fr.acked && fr.transmissions < MAX_TRANSMISSIONS) {
+    fr.backoffs = 0;
+    backoff(idx, fr);
+    return;
+  }
+  mac_done(idx, fr.unicast && !fr.acked ? MAC_TX_NOACK : MAC_TX_OK);
+}
+/*---------------------------------------------------------------------------*/
+/* Application: app.c and simple-energest.c */
+/*---------------------------------------------------------------------------*/
+typedef struct {
+  uint16_t seqn;
+} __attribute__((packed)) test_msg_t;
+/*---------------------------------------------------------------------------*/
+static void
+recv_cb(const linkaddr_t *originator, uint8_t hops)
+{
+  test_msg_t msg;
+  if(packetbuf_datalen() < sizeof(msg)) {
+    app_log(current, "App: wrong length: %d", packetbuf_datalen());
+    return;
+  }
+  memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+  if(msg.seqn & APP_ALARM_FLAG) {
+    msg.seqn &= ~APP_ALARM_FLAG;
+    app_log(current, "App: Recv alarm from %02x:%02x seqn %d hops %d",
+            originator->u8[0], originator->u8[1], msg.seqn, hops);
+    uint16_t id = originator->u8[0] | originator->u8[1] << 8;
+    auto it = alarm_sent_us.find(uint32_t(id) << 16 | msg.seqn);
+    if(it != alarm_sent_us.end()) {
+      alarm_latency_ms.push_back((now_us - it->second) / 1000.0);
+      alarm_sent_us.erase(it);
+      alarm_recv++;
+    }
+    return;
+  }
+  app_log(current, "App: Recv from %02x:%02x seqn %d hops %d",
+          originator->u8[0], originator->u8[1], msg.seqn, hops);
+  app_recv++;
+}
+static void app_active(void);
+static const struct sched_collect_callbacks app_cb = {.recv = recv_cb,
+                                                       .active = nullptr};
+static const struct sched_collect_callbacks app_node_cb = {.recv = nullptr,
+                                                            .active = app_active};
+/*---------------------------------------------------------------------------*/
+static void
+app_boot(sim_node &n)
+{
+  uint32_t idx = &n - nodes.data();
+  app_log(&n, "Rime started with address %u.%u", n.addr.u8[0], n.addr.u8[1]);
+  account_radio(&n);
+  n.radio_on = true;
+  n.last_energest_us = now_us;
+  n.phase_since_us = now_us;
+  schedule(local_to_sim(&n, ENERGEST_PERIOD), EV_ENERGEST, idx, 1);
+  if(n.id == SIM_SINK_ID) {
+    schedule(local_to_sim(&n, SINK_OPEN_DELAY), EV_APP, idx, 0);
+  } else {
+    sched_collect_open(&n.conn, COLLECT_CHANNEL, false, &app_node_cb);
+    schedule(now_us, EV_APP, idx, n.app_gen);
+    if(cfg.alarm_period > 0) {
+      schedule(now_us + int64_t(uniform() * cfg.alarm_period * 1e6), EV_ALARM,
+               idx, 0);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Queue the periodic record and re-arm the app timer: a full epoch after a
+ * timeout, longer by APP_ACTIVE_GUARD after an active callback (app.c) */
+static void
+app_send(sim_node &n, bool active)
+{
+  uint32_t idx = &n - nodes.data();
+  /* The record is written in place, the seqn first and padding after */
+  test_msg_t msg = {n.seqn};
+  uint8_t *buf = sched_collect_reserve(&n.conn, cfg.payload);
+  if(buf != nullptr) {
+    memcpy(buf, &msg, sizeof(msg));
+    memset(buf + sizeof(msg), 0, cfg.payload - sizeof(msg));
+  }
+  if(buf != nullptr && sched_collect_commit(&n.conn, cfg.payload)) {
+    app_log(&n, "App: Send seqn %d", msg.seqn);
+    app_sent++;
+  } else {
+    app_log(&n, "App: packet with seqn %d could not be scheduled.", msg.seqn);
+  }
+  n.seqn++;
+  n.app_gen++;
+  schedule(local_to_sim(&n, local_ticks(&n, now_us) + EPOCH_DURATION +
+                        (active ? APP_ACTIVE_GUARD : 0)), EV_APP, idx,
+           n.app_gen);
+}
+/*---------------------------------------------------------------------------*/
+static void
+app_timer(sim_node &n)
+{
+  if(n.id == SIM_SINK_ID) {
+    sched_collect_open(&n.conn, COLLECT_CHANNEL, true, &app_cb);
+    return;
+  }
+  app_send(n, false);
+}
+/*---------------------------------------------------------------------------*/
+/* sched_collect woke up for the epoch: no wake-up of the app's own */
+static void
+app_active(void)
+{
+  app_send(*current, true);
+}
+/*---------------------------------------------------------------------------*/
+/* Urgent alarm at random times, alarm_period apart on average */
+static void
+app_alarm(sim_node &n)
+{
+  uint32_t idx = &n - nodes.data();
+  test_msg_t msg = {uint16_t(APP_ALARM_FLAG | n.alarm_seqn)};
+  if(sched_collect_send_prio(&n.conn, (uint8_t *)&msg, sizeof(msg),
+                             SCHED_COLLECT_PRIO_URGENT)) {
+    app_log(&n, "App: Alarm seqn %d", n.alarm_seqn);
+    alarm_sent_us[uint32_t(n.id) << 16 | n.alarm_seqn] = now_us;
+    alarm_sent++;
+  } else {
+    app_log(&n, "App: alarm with seqn %d could not be scheduled.",
+            n.alarm_seqn);
+  }
+  n.alarm_seqn = (n.alarm_seqn + 1) & ~APP_ALARM_FLAG;
+  schedule(now_us + int64_t((0.5 + uniform()) * cfg.alarm_period * 1e6),
+           EV_ALARM, idx, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* Close the running phase of a node: time, radio and callbacks since the
+ * last phase change go to it */
+static void
+phase_account(sim_node *n)
+{
+  account_radio(n);
+  sim_phase &p = n->phases[n->phase];
+  p.time_us += now_us - n->phase_since_us;
+  p.radio_us += n->radio_on_us - n->phase_radio_mark;
+  p.tx_us += n->tx_us - n->phase_tx_mark;
+  p.events += n->events - n->phase_events_mark;
+  n->phase_since_us = now_us;
+  n->phase_radio_mark = n->radio_on_us;
+  n->phase_tx_mark = n->tx_us;
+  n->phase_events_mark = n->events;
+}
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_phase(uint8_t phase)
+{
+  sim_node *n = current;
+  if(phase >= SIMPLE_ENERGEST_PHASES || phase == n->phase) {
+    return;
+  }
+  phase_account(n);
+  n->phase = phase;
+}
+/*---------------------------------------------------------------------------*/
+/* Energest of the running node, cumulative since boot */
+void
+energest_flush(void)
+{
+  account_radio(current);
+}
+/*---------------------------------------------------------------------------*/
+unsigned long
+energest_type_time(int type)
+{
+  const sim_node *n = current;
+  uint64_t elapsed = now_us - n->boot_us;
+  uint64_t cpu = std::min<uint64_t>(n->events * CPU_PER_EVENT_US, elapsed);
+  uint64_t tx = std::min(n->tx_us, n->radio_on_us);
+  uint64_t us = 0;
+  switch(type) {
+  case ENERGEST_TYPE_CPU:
+    us = cpu;
+    break;
+  case ENERGEST_TYPE_LPM:
+    us = elapsed - cpu;
+    break;
+  case ENERGEST_TYPE_TRANSMIT:
+    us = tx;
+    break;
+  case ENERGEST_TYPE_LISTEN:
+    us = n->radio_on_us - tx;
+    break;
+  }
+  return (unsigned long)(us * RTIMER_SECOND / 1000000);
+}
+/*---------------------------------------------------------------------------*/
+/* Print an Energest line, or an Energest-phase line if phase >= 0 */
+static void
+energest_log(sim_node *n, int phase, uint64_t elapsed, uint64_t radio,
+             uint64_t tx, uint64_t events)
+{
+  double scale = RTIMER_SECOND / 1e6;
+  tx = std::min(tx, radio);
+  uint64_t cpu = std::min<uint64_t>(events * CPU_PER_EVENT_US, elapsed);
+  char prefix[32];
+  if(phase < 0) {
+    snprintf(prefix, sizeof(prefix), "Energest: %u", n->energest_cnt);
+  } else {
+    snprintf(prefix, sizeof(prefix), "Energest-phase: %u %d", n->energest_cnt,
+             phase);
+  }
+  app_log(n, "%s %lu %lu %lu %lu", prefix, (unsigned long)(cpu * scale),
+          (unsigned long)((elapsed - cpu) * scale), (unsigned long)(tx * scale),
+          (unsigned long)((radio - tx) * scale));
+}
+/*---------------------------------------------------------------------------*/
+static void
+energest_step(sim_node &n, uint32_t round)
+{
+  uint32_t idx = &n - nodes.data();
+  account_radio(&n);
+  energest_log(&n, -1, now_us - n.last_energest_us,
+               n.radio_on_us - n.last_radio_on_us,
+               n.tx_us - n.last_tx_us, n.events - n.last_events);
+  n.last_energest_us = now_us;
+  n.last_radio_on_us = n.radio_on_us;
+  n.last_tx_us = n.tx_us;
+  n.last_events = n.events;
+
+  /* Same period, split by phase */
+  phase_account(&n);
+  for(int i = 0; i < SIMPLE_ENERGEST_PHASES; i++) {
+    sim_phase &p = n.phases[i];
+    energest_log(&n, i, p.time_us, p.radio_us, p.tx_us, p.events);
+    p = sim_phase();
+  }
+  n.energest_cnt++;
+  /* A step deferred by a quiet period covers the rounds missed */
+  do {
+    round++;
+  } while(local_to_sim(&n, uint64_t(round) * ENERGEST_PERIOD) <= now_us);
+  schedule(local_to_sim(&n, uint64_t(round) * ENERGEST_PERIOD), EV_ENERGEST,
+           idx, round);
+}
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_quiet(uint8_t on)
+{
+  sim_node *n = current;
+  n->energest_quiet = on;
+  if(!on && n->energest_due) {
+    n->energest_due = false;
+    energest_step(*n, n->energest_round);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Topology */
+/*---------------------------------------------------------------------------*/
+static bool
+place_nodes(void)
+{
+  unsigned count = cfg.nodes;
+  unsigned cols = unsigned(std::ceil(std::sqrt(double(count))));
+  double side = cfg.spacing * (std::sqrt(double(count)) - 1);
+
+  for(unsigned i = 0; i < count; i++) {
+    sim_node &n = nodes[i];
+    if(cfg.topology == "line") {
+      n.x = i * cfg.spacing;
+      n.y = 0;
+    } else if(cfg.topology == "grid") {
+      /* Row-major grid with the sink in the middle */
+      unsigned pos = (i + count / 2 + cols / 2) % count;
+      n.x = (pos % cols) * cfg.spacing;
+      n.y = (pos / cols) * cfg.spacing;
+    } else if(cfg.topology == "random") {
+      /* Same density as the grid, sink in the centre */
+      n.x = i == 0 ? side / 2 : uniform() * side;
+      n.y = i == 0 ? side / 2 : uniform() * side;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+static size_t
+build_links(const radio_model &model)
+{
+  size_t count = 0;
+  double max_d = model.max_range();
+  /* Sort along x to visit only the candidates within range */
+  std::vector<uint32_t> order(nodes.size());
+  for(uint32_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [](uint32_t a, uint32_t b) { return nodes[a].x < nodes[b].x; });
+
+  for(size_t i = 0; i < order.size(); i++) {
+    sim_node &a = nodes[order[i]];
+    for(size_t j = i + 1; j < order.size(); j++) {
+      sim_node &b = nodes[order[j]];
+      if(b.x - a.x > max_d) {
+        break;
+      }
+      double d = std::hypot(a.x - b.x, a.y - b.y);
+      link_quality q;
+      if(model.link(d, a.id, b.id, &q)) {
+        a.links.push_back({uint16_t(order[j]), q});
+        count++;
+      }
+      if(model.link(d, b.id, a.id, &q)) {
+        b.links.push_back({uint16_t(order[i]), q});
+        count++;
+      }
+    }
+  }
+  return count;
+}
+/*---------------------------------------------------------------------------*/
+static void
+init_nodes(void)
+{
+  std::uniform_real_distribution<double> drift(-cfg.drift_ppm, cfg.drift_ppm);
+  for(unsigned i = 0; i < nodes.size(); i++) {
+    sim_node &n = nodes[i];
+    n.id = i + 1;
+    n.addr.u8[0] = n.id & 0xff;
+    n.addr.u8[1] = n.id >> 8;
+    n.drift = drift(rng) * 1e-6;
+    n.boot_us = n.id == SIM_SINK_ID ? 0 : int64_t(uniform() * cfg.boot_spread * 1e6);
+    n.state = pristine_state;
+    n.rx_frame = NO_FRAME;
+    n.tx_end_us = n.rx_end_us = -1;
+    schedule(n.boot_us, EV_BOOT, i);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+run(void)
+{
+  while(!queue.empty()) {
+    event ev = queue.top();
+    queue.pop();
+    now_us = ev.time;
+    events_handled++;
+    sim_node &n = nodes[ev.node];
+
+    /* A failed node only lets its pending receptions end */
+    if(n.dead && ev.type != EV_RX_END) {
+      continue;
+    }
+    switch(ev.type) {
+    case EV_BOOT:
+      sim_enter(&n);
+      n.booted = true;
+      app_boot(n);
+      break;
+    case EV_CTIMER:
+      if(!ev.timer->active || ev.timer->generation != ev.arg) {
+        break;
+      }
+      sim_enter(&n);
+      n.events++;
+      ev.timer->active = 0;
+      ev.timer->f(ev.timer->ptr);
+      break;
+    case EV_APP:
+      /* Re-armed since: the etimer never fired */
+      if(ev.arg != n.app_gen) {
+        break;
+      }
+      sim_enter(&n);
+      n.events++;
+      app_timer(n);
+      break;
+    case EV_ALARM:
+      sim_enter(&n);
+      n.events++;
+      app_alarm(n);
+      break;
+    case EV_ENERGEST:
+      /* Stopped while quiet, the step is taken at the next wake-up */
+      if(n.energest_quiet) {
+        n.energest_due = true;
+        n.energest_round = ev.arg;
+        break;
+      }
+      sim_enter(&n);
+      n.events++;
+      energest_step(n, ev.arg);
+      break;
+    case EV_FAIL:
+      account_radio(&n);
+      n.radio_on = false;
+      n.dead = true;
+      app_log(&n, "Sim: node failed");
+      break;
+    case EV_OUTAGE:
+      n.cut = ev.arg;
+      app_log(&n, ev.arg ? "Sim: outage started" : "Sim: outage ended");
+      break;
+    case EV_MAC_START:
+      mac_start(ev.node);
+      break;
+    case EV_RX_END:
+      rx_end(ev.node, ev.arg);
+      break;
+    case EV_TX_END:
+      tx_end(ev.node, ev.arg);
+      break;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-n nodes] [--topology grid|line|random] "
+          "[--spacing m]\n"
+          "          [--model udgm|logdist] [--range m] [--prr p] "
+          "[--exponent n] [--sigma db]\n"
+          "          [--drift ppm] [--boot-spread s] [-d duration_s] "
+          "[-s seed] [-o logfile] [-v]\n"
+          "          [--alarm-period s] [--payload bytes] "
+          "[--kill id@s]... [--outage id@s-s]...\n", prog);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  for(int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has_value = i + 1 < argc;
+    if((!strcmp(a, "-n") || !strcmp(a, "--nodes")) && has_value) {
+      cfg.nodes = atoi(argv[++i]);
+    } else if(!strcmp(a, "--topology") && has_value) {
+      cfg.topology = argv[++i];
+    } else if(!strcmp(a, "--spacing") && has_value) {
+      cfg.spacing = atof(argv[++i]);
+    } else if(!strcmp(a, "--model") && has_value) {
+      cfg.model = argv[++i];
+    } else if(!strcmp(a, "--range") && has_value) {
+      cfg.range = atof(argv[++i]);
+    } else if(!strcmp(a, "--prr") && has_value) {
+      cfg.prr = atof(argv[++i]);
+    } else if(!strcmp(a, "--exponent") && has_value) {
+      cfg.exponent = atof(argv[++i]);
+    } else if(!strcmp(a, "--sigma") && has_value) {
+      cfg.sigma = atof(argv[++i]);
+    } else if(!strcmp(a, "--drift") && has_value) {
+      cfg.drift_ppm = atof(argv[++i]);
+    } else if(!strcmp(a, "--boot-spread") && has_value) {
+      cfg.boot_spread = atof(argv[++i]);
+    } else if(!strcmp(a, "--alarm-period") && has_value) {
+      cfg.alarm_period = atof(argv[++i]);
+    } else if(!strcmp(a, "--payload") && has_value) {
+      cfg.payload = atoi(argv[++i]);
+    } else if(!strcmp(a, "--kill") && has_value &&
+              strchr(argv[i + 1], '@') != nullptr) {
+      const char *k = argv[++i];
+      cfg.kills.emplace_back(atoi(k), atof(strchr(k, '@') + 1));
+    } else if(!strcmp(a, "--outage") && has_value &&
+              strchr(argv[i + 1], '@') != nullptr &&
+              strchr(strchr(argv[i + 1], '@') + 1, '-') != nullptr) {
+      const char *o = strchr(argv[++i], '@') + 1;
+      cfg.outages.push_back({unsigned(atoi(argv[i])), atof(o),
+                             atof(strchr(o, '-') + 1)});
+    } else if((!strcmp(a, "-d") || !strcmp(a, "--duration")) && has_value) {
+      cfg.duration = atof(argv[++i]);
+    } else if((!strcmp(a, "-s") || !strcmp(a, "--seed")) && has_value) {
+      cfg.seed = strtoul(argv[++i], nullptr, 0);
+    } else if((!strcmp(a, "-o") || !strcmp(a, "--output")) && has_value) {
+      cfg.log_file = argv[++i];
+    } else if(!strcmp(a, "-v") || !strcmp(a, "--verbose")) {
+      cfg.verbose = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(cfg.payload < sizeof(test_msg_t) ||
+     cfg.payload > SCHED_COLLECT_MAX_PAYLOAD) {
+    fprintf(stderr, "The payload must be between %zu and %d bytes.\n",
+            sizeof(test_msg_t), SCHED_COLLECT_MAX_PAYLOAD);
+    return 1;
+  }
+  if(cfg.nodes < 2 || cfg.nodes > 65535) {
+    fprintf(stderr, "The number of nodes must be between 2 and 65535.\n");
+    return 1;
+  }
+  std::unique_ptr<radio_model> model = make_radio_model(
+    cfg.model, cfg.range, cfg.prr, cfg.exponent, cfg.sigma, cfg.seed);
+  if(!model) {
+    fprintf(stderr, "Unknown radio model %s.\n", cfg.model.c_str());
+    return 1;
+  }
+  if(cfg.nodes > MAX_NODES) {
+    fprintf(stderr, "Warning: %u nodes but sched_collect was built with "
+            "MAX_NODES %d (rebuild with MAX_NODES=%u).\n", cfg.nodes,
+            MAX_NODES, cfg.nodes);
+  }
+
+  out = stdout;
+  if(cfg.log_file && (out = fopen(cfg.log_file, "w")) == nullptr) {
+    perror(cfg.log_file);
+    return 1;
+  }
+  static char out_buf[1 << 20];
+  setvbuf(out, out_buf, _IOFBF, sizeof(out_buf));
+
+  auto wall_start = std::chrono::steady_clock::now();
+  rng.seed(cfg.seed);
+  end_us = int64_t(cfg.duration * 1e6);
+  pristine_state.assign(__start_sim_state, __stop_sim_state);
+  nodes.resize(cfg.nodes);
+  tx_queue.resize(cfg.nodes);
+  last_seqno.resize(cfg.nodes);
+  next_seqno.resize(cfg.nodes);
+  if(!place_nodes()) {
+    fprintf(stderr, "Unknown topology %s.\n", cfg.topology.c_str());
+    return 1;
+  }
+  size_t links = build_links(*model);
+  init_nodes();
+  for(auto &[id, t] : cfg.kills) {
+    if(id < 1 || id > cfg.nodes) {
+      fprintf(stderr, "No node %u to kill.\n", id);
+      return 1;
+    }
+    schedule(int64_t(t * 1e6), EV_FAIL, id - 1);
+  }
+  for(auto &o : cfg.outages) {
+    if(o.id < 1 || o.id > cfg.nodes || o.end <= o.start) {
+      fprintf(stderr, "Bad outage of node %u.\n", o.id);
+      return 1;
+    }
+    schedule(int64_t(o.start * 1e6), EV_OUTAGE, o.id - 1, 1);
+    schedule(int64_t(o.end * 1e6), EV_OUTAGE, o.id - 1, 0);
+  }
+  run();
+
+  /* Close the last energest period for the summary */
+  double radio = 0;
+  unsigned alive = 0;
+  for(sim_node &n : nodes) {
+    account_radio(&n);
+    if(n.id != SIM_SINK_ID && n.booted && !n.dead) {
+      radio += double(n.radio_on_us) / (now_us - n.boot_us);
+      alive++;
+    }
+  }
+  fflush(out);
+  if(out != stdout) {
+    fclose(out);
+  }
+  double wall = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - wall_start).count();
+  fprintf(stderr, "%u nodes, %.1f links/node, %.0f s simulated in %.2f s "
+          "(%" PRIu64 " events)\n", cfg.nodes, double(links) / cfg.nodes,
+          cfg.duration, wall, events_handled);
+  fprintf(stderr, "App: sent %" PRIu64 ", received %" PRIu64 " (%.2f%%), "
+          "mean radio duty cycle %.3f%%\n", app_sent, app_recv,
+          app_sent ? 100.0 * app_recv / app_sent : 0.0,
+          alive ? 100.0 * radio / alive : 0.0);
+  if(alarm_sent) {
+    std::vector<double> &l = alarm_latency_ms;
+    std::sort(l.begin(), l.end());
+    double mean = 0;
+    for(double x : l) {
+      mean += x;
+    }
+    fprintf(stderr, "Alarms: sent %" PRIu64 ", received %" PRIu64 " (%.2f%%), "
+            "latency mean %.0f ms, p95 %.0f ms, max %.0f ms\n", alarm_sent,
+            alarm_recv, 100.0 * alarm_recv / alarm_sent,
+            l.empty() ? 0.0 : mean / l.size(),
+            l.empty() ? 0.0 : l[size_t(0.95 * (l.size() - 1))],
+            l.empty() ? 0.0 : l.back());
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
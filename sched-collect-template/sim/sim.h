@@ -0,0 +1,128 @@
+/**
+ * \file
+ *         Host-native discrete-event simulator for sched_collect.
+ *
+ *         sched_collect.c is compiled unchanged against the stub Contiki
+ *         headers in include/. Its static variables are moved into the
+ *         `sim_state` section at build time (see the Makefile), and the
+ *         simulator swaps a per-node copy of that section in and out
+ *         whenever it runs code on behalf of a different node. Every node
+ *         therefore sees its own protocol state, its own drifting clock and
+ *         its own node_id / linkaddr_node_addr, exactly as on a mote.
+ *
+ * \author
+ *         Sebin Shaji Philip <sebin.shajiphilip@studenti.unitn.it>
+ */
+
+#ifndef SIM_H
+#define SIM_H
+/*---------------------------------------------------------------------------*/
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "radio-model.h"
+extern "C" {
+#include "sched_collect.h"
+#include "simple-energest.h"
+#include "node-id.h"
+}
+/* Keep the host printf in the simulator itself */
+#undef printf
+/*---------------------------------------------------------------------------*/
+#define SIM_SINK_ID 1
+/*---------------------------------------------------------------------------*/
+struct sim_link {
+  uint16_t to;
+  link_quality q;
+};
+/*---------------------------------------------------------------------------*/
+/* Time accounted to one phase of simple_energest_phase() */
+struct sim_phase {
+  uint64_t time_us;
+  uint64_t radio_us;
+  uint64_t tx_us;
+  uint64_t events;
+};
+/*---------------------------------------------------------------------------*/
+/* Open file of the cfs stand-in */
+struct sim_fd {
+  std::string name;
+  size_t offset;
+  int flags;                 /* 0 when the descriptor is free */
+};
+/*---------------------------------------------------------------------------*/
+struct sim_node {
+  uint16_t id;
+  linkaddr_t addr;
+  double x, y;
+  double drift;              /* relative clock rate error, e.g. 20e-6 */
+  int64_t boot_us;
+  bool booted;
+  bool dead;                 /* failed, see --kill */
+  bool cut;                  /* radio isolated, see --outage */
+  std::vector<sim_link> links;
+  std::vector<uint8_t> state; /* this node's copy of the sim_state section */
+
+  /* Rime connections opened by the node */
+  std::vector<struct broadcast_conn *> bcs;
+  std::vector<struct unicast_conn *> ucs;
+
+  /* Radio */
+  bool radio_on;
+  int64_t radio_on_since_us;
+  uint64_t radio_on_us;      /* accumulated, including tx */
+  uint64_t tx_us;
+  int64_t tx_end_us;
+  int64_t rx_end_us;
+  uint32_t rx_frame;
+  bool rx_corrupted;
+
+  /* Application and Energest */
+  struct sched_collect_conn conn;
+  uint16_t seqn;
+  uint16_t alarm_seqn;
+  uint32_t app_gen;          /* app timer re-arms; stale EV_APP are dropped */
+  uint32_t energest_cnt;
+  bool energest_quiet;       /* simple_energest_quiet() */
+  bool energest_due;         /* a step came due while quiet */
+  uint32_t energest_round;
+  uint64_t last_radio_on_us, last_tx_us;
+  int64_t last_energest_us;
+  uint64_t events, last_events;  /* callbacks run, charged as CPU time */
+  uint8_t phase;
+  int64_t phase_since_us;
+  uint64_t phase_radio_mark, phase_tx_mark, phase_events_mark;
+  sim_phase phases[SIMPLE_ENERGEST_PHASES];
+  unsigned char leds;
+  std::string line;          /* partial printf output */
+
+  /* Flash file system (cfs/Coffee) */
+  std::map<std::string, std::vector<uint8_t>> files;
+  std::vector<sim_fd> fds;
+};
+/*---------------------------------------------------------------------------*/
+/* Simulated time in microseconds */
+int64_t sim_now(void);
+/* Node whose code is running (its state is loaded) */
+sim_node *sim_current(void);
+/* Load the given node's protocol state and identity */
+void sim_enter(sim_node *n);
+/* Local clock of the running node */
+clock_time_t sim_local_clock(const sim_node *n, int64_t t_us);
+/* Schedule a ctimer of the running node at c->start + c->interval ticks
+ * of its local clock (the interval is not wrapped, like in Contiki) */
+void sim_schedule_ctimer(struct ctimer *c);
+/* Transmit the packetbuf content; dest == NULL for broadcast */
+int sim_transmit(uint16_t channel, const linkaddr_t *dest);
+/* Radio switch of the running node */
+void sim_radio(bool on);
+/* Draw a 16-bit random number from the simulation PRNG */
+uint16_t sim_random16(void);
+/* Write one complete log line of the running node */
+void sim_log_line(const sim_node *n, const char *line, size_t len);
+/* Whether node printf output is logged */
+bool sim_verbose(void);
+/*---------------------------------------------------------------------------*/
+#endif /* SIM_H */
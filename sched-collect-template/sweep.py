@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""
+Parameter sweep for the sched_collect timing constants.
+
+Builds one firmware variant per combination of the given constants
+(DELAY_CEIL, GUARD_TIME, RSSI_THRESHOLD, GREEN_LED_GUARD, BLUE_LED_GUARD or
+any other macro of sched_collect.c guarded by #ifndef), runs every variant
+with several random seeds in parallel, and collects PDR and duty cycle of
+each run into one results table. Example:
+
+	./sweep.py -p DELAY_CEIL=250,350,450 -p GUARD_TIME=-75,-50,-25 --seeds 3
+
+With the default Cooja backend every run is a headless Cooja instance started
+from a copy of the .csc template (test_nogui_udgm.csc) with its own seed.
+With --backend sim the host simulator in sim/ is used instead, with as many
+nodes as the template has motes.
+"""
+
+import os
+import re
+import sys
+import shutil
+import argparse
+import itertools
+import xml.etree.ElementTree as ET
+import subprocess
+from concurrent.futures import ThreadPoolExecutor
+
+project_dir = os.path.dirname(os.path.abspath(__file__))
+repo_dir = os.path.dirname(project_dir)
+
+# Files copied into every variant's build directory
+project_files = ["Makefile", "app.c", "sched_collect.c", "sched_collect.h",
+	"project-conf.h", "tools", "sim"]
+
+
+def parse_params(specs):
+	# "NAME=v1,v2,v3" -> [("NAME", ["v1", "v2", "v3"])]
+	params = []
+	for spec in specs:
+		name, sep, values = spec.partition("=")
+		if not sep or not re.match(r"^[A-Z_][A-Z0-9_]*$", name) or not values:
+			raise argparse.ArgumentTypeError("bad parameter {}".format(spec))
+		params.append((name, values.split(",")))
+	return params
+
+
+def run_cmd(cmd, cwd, log_name):
+	# Run a command, keeping its output in cwd/log_name
+	with open(os.path.join(cwd, log_name), "w") as out:
+		return subprocess.call(cmd, cwd=cwd, stdout=out,
+			stderr=subprocess.STDOUT) == 0
+
+
+def build_variant(args, variant):
+	# Copy the project and build it with the variant's definitions
+	vdir = variant["dir"]
+	if os.path.exists(vdir):
+		shutil.rmtree(vdir)
+	os.makedirs(vdir)
+	for name in project_files:
+		src = os.path.join(project_dir, name)
+		if os.path.isdir(src):
+			shutil.copytree(src, os.path.join(vdir, name),
+				ignore=shutil.ignore_patterns("*.o", "obj_*", "sim"))
+		else:
+			shutil.copy(src, vdir)
+	defines = " ".join("{}={}".format(k, v)
+		for k, v in sorted(variant["params"].items()))
+
+	if args.backend == "cooja":
+		cmd = ["make", "app.sky", "TARGET=sky", "CONTIKI=" + args.contiki,
+			"EXTRA_DEFINES=" + defines]
+		return run_cmd(cmd, vdir, "build.log")
+	cmd = ["make", "-C", "sim", "EXTRA_DEFINES=" + defines,
+		"MAX_NODES={}".format(args.nodes)]
+	return run_cmd(cmd, vdir, "build.log")
+
+
+def write_csc(template, variant, seed, path):
+	# Per-run copy of the simulation: own seed, variant firmware
+	with open(template) as f:
+		csc = f.read()
+	csc = re.sub(r"<randomseed>[^<]*</randomseed>",
+		"<randomseed>{}</randomseed>".format(seed), csc)
+	csc = csc.replace("[CONFIG_DIR]/app.sky",
+		os.path.join(variant["dir"], "app.sky"))
+	csc = csc.replace("[CONFIG_DIR]/app.c",
+		os.path.join(variant["dir"], "app.c"))
+	with open(path, "w") as f:
+		f.write(csc)
+
+
+def parse_log(log_file, rdir):
+	# Prefer the native parser, fall back to parse-stats.py
+	native = os.path.join(repo_dir, "analysis", "parse-stats")
+	if os.access(native, os.X_OK):
+		cmd = [native, log_file]
+	else:
+		cmd = [sys.executable, os.path.join(project_dir, "parse-stats.py"),
+			log_file]
+	if not run_cmd(cmd, rdir, "parse.log"):
+		return None
+
+	common = os.path.splitext(log_file)[0]
+	sent = recv = 0
+	with open(common + "-pdr.csv") as f:
+		next(f)
+		for line in f:
+			cols = line.split("\t")
+			sent += int(float(cols[2]))
+			recv += int(float(cols[3]))
+	dcs = []
+	with open(common + "-dc.csv") as f:
+		next(f)
+		for line in f:
+			dcs.append(float(line.split("\t")[1]))
+	pdr = 100.0 * recv / sent if sent else float("nan")
+	dc = sum(dcs) / len(dcs) if dcs else float("nan")
+	return pdr, dc
+
+
+def run_point(args, variant, seed):
+	# One simulation of a variant with a given seed
+	rdir = os.path.join(variant["dir"], "seed-{}".format(seed))
+	os.makedirs(rdir, exist_ok=True)
+
+	if args.backend == "cooja":
+		csc = os.path.join(rdir, "sweep.csc")
+		write_csc(args.csc, variant, seed, csc)
+		# The test script names its log file, e.g. test_nogui_udgm.log
+		m = re.search(r'new FileWriter\("([^"]+)"\)', open(csc).read())
+		log_file = os.path.join(rdir, m.group(1) if m else "COOJA.testlog")
+		cmd = ["java", "-mx512m", "-jar",
+			os.path.join(args.contiki, "tools", "cooja", "dist", "cooja.jar"),
+			"-nogui=" + csc, "-contiki=" + args.contiki]
+	else:
+		log_file = os.path.join(rdir, "sim.log")
+		cmd = [os.path.join(variant["dir"], "sim", "sim"), "-n", str(args.nodes),
+			"-s", str(seed), "-d", str(args.duration), "-o", log_file]
+		cmd += args.sim_args.split()
+
+	if not run_cmd(cmd, rdir, "run.log") or not os.path.exists(log_file):
+		return None
+	return parse_log(log_file, rdir)
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__,
+		formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument("-p", "--param", action="append", default=[],
+		metavar="NAME=V1,V2", help="constant to sweep and its values")
+	parser.add_argument("--seeds", type=int, default=3,
+		help="runs per variant, with seeds 1..N")
+	parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+		help="parallel builds/runs (default: all cores)")
+	parser.add_argument("--backend", choices=["cooja", "sim"], default="cooja")
+	parser.add_argument("--csc", default=os.path.join(project_dir,
+		"test_nogui_udgm.csc"), help="Cooja simulation template")
+	parser.add_argument("--contiki", default=os.path.join(repo_dir, "..",
+		"contiki"), help="Contiki tree (cooja backend)")
+	parser.add_argument("--duration", type=int, default=1800,
+		help="simulated seconds (sim backend; Cooja uses the script TIMEOUT)")
+	parser.add_argument("--sim-args", default="",
+		help="extra options for the host simulator")
+	parser.add_argument("-w", "--workdir", default="sweep",
+		help="directory for builds, logs and results")
+	parser.add_argument("-o", "--output", default=None,
+		help="results table (default: WORKDIR/sweep-results.csv)")
+	args = parser.parse_args()
+
+	try:
+		params = parse_params(args.param)
+	except argparse.ArgumentTypeError as e:
+		parser.error(str(e))
+	if not params:
+		parser.error("at least one parameter to sweep is needed (-p)")
+	args.contiki = os.path.abspath(args.contiki)
+	args.csc = os.path.abspath(args.csc)
+	# Only the motes of the simulation, not the <mote> lists of the plugins
+	args.nodes = len(ET.parse(args.csc).getroot().findall("simulation/mote"))
+	workdir = os.path.abspath(args.workdir)
+	output = args.output or os.path.join(workdir, "sweep-results.csv")
+
+	names = [name for name, _ in params]
+	variants = []
+	for idx, values in enumerate(itertools.product(*[v for _, v in params])):
+		variants.append({"name": "v{:03d}".format(idx),
+			"dir": os.path.join(workdir, "v{:03d}".format(idx)),
+			"params": dict(zip(names, values))})
+	print("{} variants x {} seeds, {} backend, {} jobs".format(
+		len(variants), args.seeds, args.backend, args.jobs))
+
+	with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+		built = list(pool.map(lambda v: build_variant(args, v), variants))
+		for variant, ok in zip(variants, built):
+			if not ok:
+				print("Warning: build of {} failed, see {}/build.log".format(
+					variant["name"], variant["dir"]))
+		points = [(v, s) for v, ok in zip(variants, built) if ok
+			for s in range(1, args.seeds + 1)]
+		results = list(pool.map(lambda p: run_point(args, *p), points))
+
+	# One row per run, then the per-variant averages sorted by PDR and DC
+	summary = []
+	with open(output, "w") as f:
+		f.write("variant\t{}\tseed\tpdr\tdc\n".format("\t".join(names)))
+		for (variant, seed), res in zip(points, results):
+			pdr, dc = res if res else (float("nan"), float("nan"))
+			f.write("{}\t{}\t{}\t{:.3f}\t{:.3f}\n".format(variant["name"],
+				"\t".join(variant["params"][n] for n in names), seed, pdr, dc))
+		for variant in variants:
+			runs = [r for (v, s), r in zip(points, results)
+				if v is variant and r is not None]
+			if runs:
+				summary.append((sum(r[0] for r in runs) / len(runs),
+					sum(r[1] for r in runs) / len(runs), len(runs), variant))
+	summary.sort(key=lambda s: (-s[0], s[1]))
+
+	print("\n{:7s} {} {:>8s} {:>8s} {:>5s}".format("variant",
+		" ".join("{:>15s}".format(n) for n in names), "PDR(%)", "DC(%)", "runs"))
+	for pdr, dc, runs, variant in summary:
+		print("{:7s} {} {:8.2f} {:8.3f} {:5d}".format(variant["name"],
+			" ".join("{:>15s}".format(variant["params"][n]) for n in names),
+			pdr, dc, runs))
+	if summary:
+		best = summary[0][3]
+		print("\nBest: {}".format(" ".join("{}={}".format(n, best["params"][n])
+			for n in names)))
+	print("Saving sweep results in: {}".format(output))
+	return 0 if summary else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main())
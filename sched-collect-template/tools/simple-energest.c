@@ -43,6 +43,8 @@
 #include "simple-energest.h"
 #include <stdio.h>
 /*---------------------------------------------------------------------------*/
+#define ENERGEST_PERIOD (15 * CLOCK_SECOND)
+/*---------------------------------------------------------------------------*/
 #define DEBUG 1
 #if DEBUG
 #define PRINTF(...) printf(__VA_ARGS__)
@@ -54,6 +56,17 @@ static uint16_t cnt;
 static uint32_t last_cpu, last_lpm, last_tx, last_rx;
 static uint32_t delta_cpu, delta_lpm, delta_tx, delta_rx;
 static uint32_t curr_cpu, curr_lpm, curr_tx, curr_rx;
+/* Per-phase accounting: counters at the last phase change and the time
+ * accumulated by every phase since the last step */
+static uint8_t phase;
+static uint32_t phase_cpu, phase_lpm, phase_tx, phase_rx;
+static uint32_t acc_cpu[SIMPLE_ENERGEST_PHASES], acc_lpm[SIMPLE_ENERGEST_PHASES],
+  acc_tx[SIMPLE_ENERGEST_PHASES], acc_rx[SIMPLE_ENERGEST_PHASES];
+/* Quiet period: the periodic timer is stopped, next_step is when the next
+ * step is due */
+static struct etimer periodic;
+static uint8_t quiet;
+static clock_time_t next_step;
 /*---------------------------------------------------------------------------*/
 PROCESS(energest_process, "Energest Process");
 /*---------------------------------------------------------------------------*/
@@ -67,13 +80,67 @@ simple_energest_start(void)
   last_tx = energest_type_time(ENERGEST_TYPE_TRANSMIT);
   last_rx = energest_type_time(ENERGEST_TYPE_LISTEN);
 
+  phase_cpu = last_cpu;
+  phase_lpm = last_lpm;
+  phase_tx = last_tx;
+  phase_rx = last_rx;
+
   /* Start Energest Printing Process */
   process_start(&energest_process, NULL);
 }
 /*---------------------------------------------------------------------------*/
+static void
+phase_account(void)
+{
+  uint32_t cpu, lpm, tx, rx;
+
+  energest_flush();
+
+  cpu = energest_type_time(ENERGEST_TYPE_CPU);
+  lpm = energest_type_time(ENERGEST_TYPE_LPM);
+  tx = energest_type_time(ENERGEST_TYPE_TRANSMIT);
+  rx = energest_type_time(ENERGEST_TYPE_LISTEN);
+
+  acc_cpu[phase] += cpu - phase_cpu;
+  acc_lpm[phase] += lpm - phase_lpm;
+  acc_tx[phase] += tx - phase_tx;
+  acc_rx[phase] += rx - phase_rx;
+
+  phase_cpu = cpu;
+  phase_lpm = lpm;
+  phase_tx = tx;
+  phase_rx = rx;
+}
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_phase(uint8_t next)
+{
+  if(next >= SIMPLE_ENERGEST_PHASES || next == phase) {
+    return;
+  }
+  phase_account();
+  phase = next;
+}
+/*---------------------------------------------------------------------------*/
+void
+simple_energest_quiet(uint8_t on)
+{
+  if(on == quiet) {
+    return;
+  }
+  quiet = on;
+  if(quiet) {
+    etimer_stop(&periodic);
+  } else {
+    process_poll(&energest_process);
+  }
+}
+/*---------------------------------------------------------------------------*/
 void 
 simple_energest_step(void)
 {
+  uint8_t i;
+
   energest_flush();
 
   curr_cpu = energest_type_time(ENERGEST_TYPE_CPU);
@@ -92,23 +159,45 @@ simple_energest_step(void)
   last_rx = curr_rx;
 
   PRINTF("Energest: %u %lu %lu %lu %lu\n",
-  	cnt++,
+  	cnt,
   	delta_cpu,
   	delta_lpm,
   	delta_tx,
   	delta_rx);
+
+  /* Same period, split by phase */
+  phase_account();
+  for(i = 0; i < SIMPLE_ENERGEST_PHASES; i++) {
+    PRINTF("Energest-phase: %u %u %lu %lu %lu %lu\n",
+      cnt, i, acc_cpu[i], acc_lpm[i], acc_tx[i], acc_rx[i]);
+    acc_cpu[i] = acc_lpm[i] = acc_tx[i] = acc_rx[i] = 0;
+  }
+  cnt++;
 }
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(energest_process, ev, data)
 {
-  static struct etimer periodic;
   PROCESS_BEGIN();
-  etimer_set(&periodic, 15 * CLOCK_SECOND);
+  next_step = clock_time() + ENERGEST_PERIOD;
+  etimer_set(&periodic, ENERGEST_PERIOD);
   
   while(1) {
-    PROCESS_WAIT_UNTIL(etimer_expired(&periodic));
-    etimer_reset(&periodic);
+    PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_TIMER ||
+      ev == PROCESS_EVENT_POLL);
+    if(quiet) {
+      continue;
+    }
+    if(CLOCK_LT(clock_time(), next_step)) {
+      /* End of a quiet period before the step is due */
+      etimer_set(&periodic, next_step - clock_time());
+      continue;
+    }
     simple_energest_step();
+    /* Keep the period, skipping the steps missed while quiet */
+    do {
+      next_step += ENERGEST_PERIOD;
+    } while(!CLOCK_LT(clock_time(), next_step));
+    etimer_set(&periodic, next_step - clock_time());
   }
 
   PROCESS_END();
@@ -38,7 +38,23 @@
 #ifndef SIMPLE_ENERGEST_H
 #define SIMPLE_ENERGEST_H
 /*---------------------------------------------------------------------------*/
+/* Number of phases of the per-phase accounting (simple_energest_phase) */
+#ifdef SIMPLE_ENERGEST_CONF_PHASES
+#define SIMPLE_ENERGEST_PHASES SIMPLE_ENERGEST_CONF_PHASES
+#else
+#define SIMPLE_ENERGEST_PHASES 4
+#endif
+/*---------------------------------------------------------------------------*/
 void simple_energest_start(void);
 void simple_energest_step(void);
+/* Close the current phase and start accounting to the given one. Every
+ * step also prints the time spent in each phase since the previous step
+ * ("Energest-phase: cnt phase cpu lpm tx rx"). Phase 0 is the initial
+ * one, out-of-range phases are ignored. */
+void simple_energest_phase(uint8_t phase);
+/* While quiet, the periodic step does not wake the CPU: a step due in the
+ * meantime is taken when the quiet period ends, covering the longer
+ * interval. Used to sleep through the radio-off period. */
+void simple_energest_quiet(uint8_t on);
 /*---------------------------------------------------------------------------*/
 #endif /* SIMPLE_ENERGEST_H */